@@ -0,0 +1,131 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+
+/*
+ * Compare the routing table entry index against the std::map it replaced.
+ *
+ * For each table size the same destination set is inserted, looked up,
+ * updated in place and swept the way RoutingTable::Purge does, and the
+ * wall clock time of every phase is printed in milliseconds.
+ *
+ *   ./waf --run "rtable-benchmark --lookups=1000000"
+ */
+
+#include "ns3/core-module.h"
+#include "ns3/rtable.h"
+#include <map>
+
+using namespace ns3;
+using namespace ns3::offchain;
+
+typedef std::map<Ipv4Address, RoutingTableEntry> RouteMap;
+
+static Ipv4Address
+Destination (uint32_t i)
+{
+  // 10.0.0.0/8, spread over several subnets
+  return Ipv4Address (0x0a000000 | ((i * 2654435761u) & 0x00ffffff));
+}
+
+static void
+BenchMap (uint32_t n, uint32_t lookups)
+{
+  RouteMap table;
+  SystemWallClockMs clock;
+  uint32_t hits = 0;
+
+  clock.Start ();
+  for (uint32_t i = 0; i < n; ++i)
+    {
+      RoutingTableEntry rt (0, Destination (i));
+      table.insert (std::make_pair (rt.GetDestination (), rt));
+    }
+  int64_t insert = clock.End ();
+
+  clock.Start ();
+  for (uint32_t i = 0; i < lookups; ++i)
+    {
+      RouteMap::const_iterator j = table.find (Destination (i % n));
+      hits += (j != table.end ());
+    }
+  int64_t lookup = clock.End ();
+
+  clock.Start ();
+  for (uint32_t i = 0; i < lookups; ++i)
+    {
+      RouteMap::iterator j = table.find (Destination (i % n));
+      j->second.SetHop (i & 0xff);
+    }
+  int64_t update = clock.End ();
+
+  clock.Start ();
+  for (RouteMap::iterator j = table.begin (); j != table.end (); ++j)
+    {
+      hits += (j->second.GetLifeTime () < Seconds (0));
+    }
+  int64_t purge = clock.End ();
+
+  std::cout << "std::map      " << n << "\t" << insert << "\t" << lookup << "\t"
+            << update << "\t" << purge << "\t(" << hits << ")" << std::endl;
+}
+
+static void
+BenchEntryMap (uint32_t n, uint32_t lookups)
+{
+  RouteEntryMap table;
+  SystemWallClockMs clock;
+  uint32_t hits = 0;
+
+  clock.Start ();
+  for (uint32_t i = 0; i < n; ++i)
+    {
+      RoutingTableEntry rt (0, Destination (i));
+      table.Insert (rt);
+    }
+  int64_t insert = clock.End ();
+
+  clock.Start ();
+  for (uint32_t i = 0; i < lookups; ++i)
+    {
+      hits += (table.Find (Destination (i % n)) != RouteEntryMap::NONE);
+    }
+  int64_t lookup = clock.End ();
+
+  clock.Start ();
+  for (uint32_t i = 0; i < lookups; ++i)
+    {
+      table.Get (table.Find (Destination (i % n))).SetHop (i & 0xff);
+    }
+  int64_t update = clock.End ();
+
+  clock.Start ();
+  for (RouteEntryMap::Handle h = table.First (); h != RouteEntryMap::NONE; h = table.Next (h))
+    {
+      hits += (table.Get (h).GetLifeTime () < Seconds (0));
+    }
+  int64_t purge = clock.End ();
+
+  std::cout << "RouteEntryMap " << n << "\t" << insert << "\t" << lookup << "\t"
+            << update << "\t" << purge << "\t(" << hits << ")" << std::endl;
+}
+
+int
+main (int argc, char *argv[])
+{
+  uint32_t lookups = 1000000;
+
+  CommandLine cmd;
+  cmd.AddValue ("lookups", "Number of lookups and updates per table size", lookups);
+  cmd.Parse (argc, argv);
+
+  std::cout << "sizeof (RoutingTableEntry) = " << sizeof (RoutingTableEntry) << " bytes" << std::endl;
+  std::cout << "table         size\tinsert\tlookup\tupdate\tpurge\t(ms)" << std::endl;
+  uint32_t sizes[] = { 1000, 10000, 100000 };
+  for (uint32_t i = 0; i < sizeof (sizes) / sizeof (sizes[0]); ++i)
+    {
+      BenchMap (sizes[i], lookups);
+      BenchEntryMap (sizes[i], lookups);
+    }
+
+  Simulator::Destroy ();
+  return 0;
+}
@@ -1,6 +1,13 @@
 #include "neighbors.h"
 #include "ns3/log.h"
 #include <algorithm>
+#include <limits>
+// the AVX2 filter is compiled with a target attribute and picked at run time,
+// so builds for the baseline x86-64 ISA use it on CPUs that have it
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#include <immintrin.h>
+#define OFFCHAIN_AVX2_DISPATCH 1
+#endif
 
 NS_LOG_COMPONENT_DEFINE ("OffchainNeighbors");
 
@@ -10,7 +17,9 @@ namespace offchain
 {
 
 Neighbors::Neighbors (Time delay, uint32_t defaultDposit) : 
-  m_ntimer (Timer::CANCEL_ON_DESTROY)
+  m_ntimer (Timer::CANCEL_ON_DESTROY),
+  m_avoidedTimerEvents (0),
+  m_reservationTimeout (Seconds (30))
 {
   m_ntimer.SetDelay (delay);
   m_ntimer.SetFunction (&Neighbors::Purge, this);
@@ -19,180 +28,561 @@ Neighbors::Neighbors (Time delay, uint32_t defaultDposit) :
   b_autoChOpen = true;
 }
 
+static bool
+IsClosed (const Neighbors::Neighbor & nb)
+{
+  return ((nb.m_expireTime <= Simulator::Now ()) || nb.close);
+}
+
+/// Balance left after subtracting locked funds, never below zero
+static inline uint32_t
+FreeBalance (uint32_t avail, uint32_t locked)
+{
+  return avail - std::min (locked, avail);
+}
+
 bool
-Neighbors::IsNeighbor (Ipv4Address addr)
+Neighbors::FindLive (Ipv4Address addr, uint32_t & slot)
 {
-  Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin ();
-       i != m_nb.end (); ++i)
+  std::unordered_map<Ipv4Address, uint32_t, Ipv4AddressHash>::const_iterator i =
+    m_nbIndex.find (addr);
+  if (i == m_nbIndex.end ())
+    return false;
+  slot = i->second;
+  if (IsClosed (m_nb[slot]))
     {
-      if (i->m_neighborAddress == addr)
-        return true;
+      Remove (slot);
+      return false;
     }
-  return false;
+  return true;
 }
 
-Time
-Neighbors::GetExpireTime (Ipv4Address addr)
+void
+Neighbors::Remove (uint32_t slot)
 {
-  Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin (); i
-       != m_nb.end (); ++i)
+  Ipv4Address addr = m_nb[slot].m_neighborAddress;
+  NS_LOG_LOGIC ("Close link to " << addr);
+  // the last entry fills the gap, so only its index changes
+  uint32_t last = m_nb.size () - 1;
+  if (slot != last)
     {
-      if (i->m_neighborAddress == addr)
-        return (i->m_expireTime - Simulator::Now ());
+      m_nb[slot] = m_nb[last];
+      m_availChDeposit[slot] = m_availChDeposit[last];
+      m_peerAvailChDeposit[slot] = m_peerAvailChDeposit[last];
+      m_lockedChDeposit[slot] = m_lockedChDeposit[last];
+      m_nbIndex[m_nb[slot].m_neighborAddress] = slot;
     }
-  return Seconds (0);
+  m_nb.pop_back ();
+  m_availChDeposit.pop_back ();
+  m_peerAvailChDeposit.pop_back ();
+  m_lockedChDeposit.pop_back ();
+  m_nbIndex.erase (addr);
+  // funds locked on a closed channel are gone with it
+  for (std::unordered_map<uint32_t, Reservation>::iterator i = m_reservations.begin ();
+       i != m_reservations.end ();)
+    {
+      if (i->second.m_neighborAddress == addr)
+        i = m_reservations.erase (i);
+      else
+        ++i;
+    }
+  if (!m_handleLinkFailure.IsNull ())
+    m_handleLinkFailure (addr);
+}
+
+void
+Neighbors::Clear ()
+{
+  m_nb.clear ();
+  m_availChDeposit.clear ();
+  m_peerAvailChDeposit.clear ();
+  m_lockedChDeposit.clear ();
+  m_reservations.clear ();
+  m_reservationTimeouts = ReservationQueue ();
+  m_nbIndex.clear ();
+  m_expiry = ExpiryQueue ();
+}
+
+bool
+Neighbors::IsNeighbor (Ipv4Address addr)
+{
+  uint32_t slot;
+  return FindLive (addr, slot);
+}
+
+Time
+Neighbors::GetExpireTime (Ipv4Address addr)
+{
+  uint32_t slot;
+  if (!FindLive (addr, slot))
+    return Seconds (0);
+  return (m_nb[slot].m_expireTime - Simulator::Now ());
 }
 
 
 uint32_t 
 Neighbors::GetChMyDeposit(Ipv4Address addr)
 {
-  Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin (); i
-       != m_nb.end (); ++i)
+  uint32_t slot;
+  if (!FindLive (addr, slot))
     {
-      if (i->m_neighborAddress == addr)
-        return (i->m_totalChDeposit);
+      NS_LOG_LOGIC ("No available payment channel " << addr );
+      return -1;
     }
-    NS_LOG_LOGIC ("No available payment channel " << addr );
-    return -1;
+  return (m_nb[slot].m_totalChDeposit);
 }
 
 uint32_t 
 Neighbors::GetChMyAvailDeposit(Ipv4Address addr)
 {
-  Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin (); i
-       != m_nb.end (); ++i)
+  // expiring reservations may close channels and move slots, so before the lookup
+  ExpireReservations ();
+  uint32_t slot;
+  if (!FindLive (addr, slot))
     {
-      if (i->m_neighborAddress == addr)
-        return (i->m_availChDeposit);
+      NS_LOG_LOGIC ("No available payment channel " << addr );
+      return -1;
     }
-    NS_LOG_LOGIC ("No available payment channel " << addr );
-    return -1;
+  return (m_availChDeposit[slot] - std::min (m_lockedChDeposit[slot], m_availChDeposit[slot]));
+}
+
+uint32_t
+Neighbors::GetChMyBalance (Ipv4Address addr)
+{
+  uint32_t slot;
+  if (!FindLive (addr, slot))
+    {
+      NS_LOG_LOGIC ("No available payment channel " << addr );
+      return -1;
+    }
+  return m_availChDeposit[slot];
 }
 
 uint32_t 
 Neighbors::GetChPeerDeposit(Ipv4Address addr)
 {
-  Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin (); i
-       != m_nb.end (); ++i)
+  uint32_t slot;
+  if (!FindLive (addr, slot))
     {
-      if (i->m_neighborAddress == addr)
-        return (i->m_peerTotalChDeposit);
+      NS_LOG_LOGIC ("No available payment channel " << addr );
+      return -1;
     }
-    NS_LOG_LOGIC ("No available payment channel " << addr );
-    return -1;
+  return (m_nb[slot].m_peerTotalChDeposit);
 }
 
 uint32_t 
 Neighbors::GetChPeerAvailDeposit(Ipv4Address addr)
 {
-  Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin (); i
-       != m_nb.end (); ++i)
+  uint32_t slot;
+  if (!FindLive (addr, slot))
     {
-      if (i->m_neighborAddress == addr)
-        return (i->m_peerAvailChDeposit);
+      NS_LOG_LOGIC ("No available payment channel " << addr );
+      return -1;
     }
-    NS_LOG_LOGIC ("No available payment channel " << addr );
-    return -1;
+  return (m_peerAvailChDeposit[slot]);
+}
+
+uint32_t
+Neighbors::GetVersion (Ipv4Address addr)
+{
+  uint32_t slot;
+  if (!FindLive (addr, slot))
+    return 0;
+  return m_nb[slot].m_version;
+}
+
+bool
+Neighbors::Announce (int i, Time keepalive, uint32_t & version)
+{
+  Neighbor & nb = m_nb[i];
+  Time now = Simulator::Now ();
+  if (nb.m_announcedVersion == nb.m_version && now - nb.m_announceTime < keepalive)
+    return false;
+  nb.m_announcedVersion = nb.m_version;
+  nb.m_announceTime = now;
+  version = nb.m_version;
+  return true;
 }
 
 
 void 
 Neighbors::DecChDeposit(Ipv4Address addr, uint32_t pay)
 {
-  Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin (); i
-       != m_nb.end (); ++i)
+  uint32_t slot;
+  if (!FindLive (addr, slot))
     {
-      if (i->m_neighborAddress == addr)
-        i->m_availChDeposit -= pay;
+      NS_LOG_LOGIC ("No available payment channel " << addr );
+      return;
     }
-    NS_LOG_LOGIC ("No available payment channel " << addr );
-    return -1;
+  m_availChDeposit[slot] -= pay;
+  Touch (slot);
 }
 
 void 
 Neighbors::IncChDeposit(Ipv4Address addr, uint32_t pay)
 {
-  Purge ();
-  for (std::vector<Neighbor>::const_iterator i = m_nb.begin (); i
-       != m_nb.end (); ++i)
+  uint32_t slot;
+  if (!FindLive (addr, slot))
     {
-      if (i->m_neighborAddress == addr)
-        i->m_availChDeposit += pay;
+      NS_LOG_LOGIC ("No available payment channel " << addr );
+      return;
     }
-    NS_LOG_LOGIC ("No available payment channel " << addr );
-    return -1;
+  m_availChDeposit[slot] += pay;
+  Touch (slot);
 }
 
-int
-Neighbors::Update (Ipv4Address addr, uint32_t peerAvailAmount, Time expire, bool acked)
+
+bool
+Neighbors::ApplyBatch (std::vector<BalanceDelta> const & deltas, Ipv4Address & failed)
 {
-  for (std::vector<Neighbor>::iterator i = m_nb.begin (); i != m_nb.end (); ++i)
-    if (i->m_neighborAddress == addr)
-      {
-        if(i->m_peerAvailChDeposit == peerAvailAmount) //received deposit should be same as stored one.
+  ExpireReservations ();
+  // net change per touched slot; a settlement touches a handful of channels
+  std::vector<std::pair<uint32_t, int64_t> > net;
+  net.reserve (deltas.size ());
+  for (std::vector<BalanceDelta>::const_iterator i = deltas.begin (); i != deltas.end (); ++i)
+    {
+      uint32_t slot;
+      if (!FindLive (i->m_neighborAddress, slot))
         {
-          i->m_expireTime  = std::max (expire + Simulator::Now (), i->m_expireTime);
-          return 0;
+          NS_LOG_LOGIC ("No available payment channel " << i->m_neighborAddress);
+          failed = i->m_neighborAddress;
+          return false;
         }
-        else{
-          //need to redempt current balance to a main channel
-          return -1;
+      std::vector<std::pair<uint32_t, int64_t> >::iterator j = net.begin ();
+      while (j != net.end () && j->first != slot)
+        ++j;
+      if (j == net.end ())
+        j = net.insert (net.end (), std::make_pair (slot, int64_t (0)));
+      j->second += i->m_delta;
+    }
+  // only the net change counts, a payment may be covered by one received later in the batch
+  for (std::vector<std::pair<uint32_t, int64_t> >::const_iterator j = net.begin (); j != net.end (); ++j)
+    {
+      int64_t free = FreeBalance (m_availChDeposit[j->first], m_lockedChDeposit[j->first]);
+      if (free + j->second < 0
+          || int64_t (m_availChDeposit[j->first]) + j->second > int64_t (std::numeric_limits<uint32_t>::max ()))
+        {
+          NS_LOG_LOGIC ("Channel to " << m_nb[j->first].m_neighborAddress << " cannot apply " << j->second);
+          failed = m_nb[j->first].m_neighborAddress;
+          return false;
         }
+    }
+  for (std::vector<std::pair<uint32_t, int64_t> >::const_iterator j = net.begin (); j != net.end (); ++j)
+    {
+      m_availChDeposit[j->first] = uint32_t (int64_t (m_availChDeposit[j->first]) + j->second);
+      Touch (j->first);
+    }
+  return true;
+}
 
-      }
-  if (acked == true) //agreement for open channel from a peer
+#ifdef OFFCHAIN_AVX2_DISPATCH
+/*
+ * CollectAtLeast for the leading multiple of eight elements, eight balances
+ * compared per instruction; unsigned compare is done as max_epu32 (v, amount) == v.
+ * Returns the number of elements looked at.
+ */
+__attribute__ ((target ("avx2"))) static uint32_t
+CollectAtLeastAvx2 (const uint32_t *col, const uint32_t *locked, uint32_t n, uint32_t amount,
+                    std::vector<uint32_t> & slots)
+{
+  uint32_t i = 0;
+  const __m256i threshold = _mm256_set1_epi32 (amount);
+  for (; i + 8 <= n; i += 8)
+    {
+      __m256i v = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (col + i));
+      if (locked != 0)
+        {
+          __m256i l = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (locked + i));
+          v = _mm256_sub_epi32 (_mm256_max_epu32 (v, l), l);
+        }
+      __m256i ge = _mm256_cmpeq_epi32 (_mm256_max_epu32 (v, threshold), v);
+      uint32_t mask = _mm256_movemask_ps (_mm256_castsi256_ps (ge));
+      while (mask != 0)
+        {
+          slots.push_back (i + __builtin_ctz (mask));
+          mask &= mask - 1;
+        }
+    }
+  return i;
+}
+#endif
+
+/*
+ * Append to slots the index of every element of col (less locked, if given)
+ * that is >= amount. The AVX2 version is used when the CPU supports it.
+ */
+static void
+CollectAtLeast (const uint32_t *col, const uint32_t *locked, uint32_t n, uint32_t amount,
+                std::vector<uint32_t> & slots)
+{
+  uint32_t i = 0;
+#ifdef OFFCHAIN_AVX2_DISPATCH
+  static const bool avx2 = __builtin_cpu_supports ("avx2");
+  if (avx2)
+    i = CollectAtLeastAvx2 (col, locked, n, amount, slots);
+#endif
+  for (; i < n; ++i)
+    {
+      uint32_t v = (locked != 0) ? FreeBalance (col[i], locked[i]) : col[i];
+      if (v >= amount)
+        slots.push_back (i);
+    }
+}
+
+void
+Neighbors::FilterByAvailable (uint32_t amount, std::vector<Ipv4Address> & out, bool peer)
+{
+  out.clear ();
+  if (m_nb.empty ())
+    return;
+  ExpireReservations ();
+  const std::vector<uint32_t> & col = peer ? m_peerAvailChDeposit : m_availChDeposit;
+  const uint32_t *locked = peer ? 0 : &m_lockedChDeposit[0];
+  std::vector<uint32_t> slots;
+  CollectAtLeast (&col[0], locked, col.size (), amount, slots);
+  for (std::vector<uint32_t>::const_iterator i = slots.begin (); i != slots.end (); ++i)
+    {
+      // expired entries are left to the purge timer, just skip them here
+      if (!IsClosed (m_nb[*i]))
+        out.push_back (m_nb[*i].m_neighborAddress);
+    }
+}
+
+struct LargerBalance
+{
+  const std::vector<uint32_t> *m_col;
+  const std::vector<uint32_t> *m_locked;
+
+  uint32_t Get (uint32_t i) const
   {
-    NS_LOG_LOGIC ("Open a new payment channel to " << addr);
-    Neighbor neighbor (addr, m_initDeposit, peerAvailAmount, expire + Simulator::Now ());
-    m_nb.push_back (neighbor);
+    return (m_locked != 0) ? FreeBalance ((*m_col)[i], (*m_locked)[i]) : (*m_col)[i];
+  }
+  bool operator() (uint32_t a, uint32_t b) const
+  {
+    return (Get (a) > Get (b));
   }
-  Purge ();
+};
+
+void
+Neighbors::TopKByAvailable (uint32_t k, std::vector<Ipv4Address> & out, bool peer)
+{
+  out.clear ();
+  ExpireReservations ();
+  const std::vector<uint32_t> & col = peer ? m_peerAvailChDeposit : m_availChDeposit;
+  std::vector<uint32_t> slots;
+  slots.reserve (m_nb.size ());
+  for (uint32_t i = 0; i < m_nb.size (); ++i)
+    {
+      if (!IsClosed (m_nb[i]))
+        slots.push_back (i);
+    }
+  k = std::min<uint32_t> (k, slots.size ());
+  LargerBalance cmp;
+  cmp.m_col = &col;
+  cmp.m_locked = peer ? 0 : &m_lockedChDeposit;
+  std::partial_sort (slots.begin (), slots.begin () + k, slots.end (), cmp);
+  for (uint32_t i = 0; i < k; ++i)
+    out.push_back (m_nb[slots[i]].m_neighborAddress);
+}
+
+bool
+Neighbors::Reserve (Ipv4Address peer, uint32_t amount, uint32_t id)
+{
+  ExpireReservations ();
+  uint32_t slot;
+  if (!FindLive (peer, slot))
+    {
+      NS_LOG_LOGIC ("No available payment channel " << peer);
+      return false;
+    }
+  if (m_reservations.find (id) != m_reservations.end ())
+    {
+      NS_LOG_LOGIC ("Reservation " << id << " already exists");
+      return false;
+    }
+  if (FreeBalance (m_availChDeposit[slot], m_lockedChDeposit[slot]) < amount)
+    {
+      NS_LOG_LOGIC ("Channel to " << peer << " cannot lock " << amount);
+      return false;
+    }
+  m_lockedChDeposit[slot] += amount;
+  Reservation r;
+  r.m_neighborAddress = peer;
+  r.m_amount = amount;
+  r.m_deadline = Simulator::Now () + m_reservationTimeout;
+  m_reservations[id] = r;
+  m_reservationTimeouts.push (std::make_pair (r.m_deadline, id));
+  return true;
+}
+
+bool
+Neighbors::Commit (uint32_t id)
+{
+  ExpireReservations ();
+  std::unordered_map<uint32_t, Reservation>::iterator i = m_reservations.find (id);
+  if (i == m_reservations.end ())
+    {
+      NS_LOG_LOGIC ("No reservation " << id);
+      return false;
+    }
+  return Resolve (i, true);
 }
 
-struct CloseNeighbor
+bool
+Neighbors::Abort (uint32_t id)
 {
-  bool operator() (const Neighbors::Neighbor & nb) const
+  ExpireReservations ();
+  std::unordered_map<uint32_t, Reservation>::iterator i = m_reservations.find (id);
+  if (i == m_reservations.end ())
+    {
+      NS_LOG_LOGIC ("No reservation " << id);
+      return false;
+    }
+  return Resolve (i, false);
+}
+
+uint32_t
+Neighbors::GetReservationCount ()
+{
+  ExpireReservations ();
+  return m_reservations.size ();
+}
+
+bool
+Neighbors::Resolve (std::unordered_map<uint32_t, Reservation>::iterator i, bool commit)
+{
+  Reservation r = i->second;
+  m_reservations.erase (i);
+  uint32_t slot;
+  if (!FindLive (r.m_neighborAddress, slot))
+    return false;
+  m_lockedChDeposit[slot] -= std::min (r.m_amount, m_lockedChDeposit[slot]);
+  if (commit)
+    {
+      // DecChDeposit does not respect locks, the funds may be gone already
+      if (m_availChDeposit[slot] < r.m_amount)
+        {
+          NS_LOG_LOGIC ("Channel to " << r.m_neighborAddress << " no longer holds " << r.m_amount);
+          return false;
+        }
+      m_availChDeposit[slot] -= r.m_amount;
+      Touch (slot);
+    }
+  return true;
+}
+
+void
+Neighbors::ExpireReservations ()
+{
+  Time now = Simulator::Now ();
+  while (!m_reservationTimeouts.empty () && m_reservationTimeouts.top ().first <= now)
+    {
+      std::pair<Time, uint32_t> timeout = m_reservationTimeouts.top ();
+      m_reservationTimeouts.pop ();
+      // a resolved reservation leaves its record behind, its id may be in use again
+      std::unordered_map<uint32_t, Reservation>::iterator i = m_reservations.find (timeout.second);
+      if (i != m_reservations.end () && i->second.m_deadline == timeout.first)
+        {
+          NS_LOG_LOGIC ("Reservation " << timeout.second << " timed out");
+          Resolve (i, false);
+        }
+    }
+}
+
+int
+Neighbors::Update (Ipv4Address addr, uint32_t peerAvailAmount, Time expire, bool acked, uint32_t version)
+{
+  uint32_t slot;
+  if (FindLive (addr, slot))
+    {
+      Neighbor & nb = m_nb[slot];
+      Time expireTime = expire + Simulator::Now ();
+      if (expireTime > nb.m_expireTime)
+        {
+          // moving the deadline the timer is armed for would need a reschedule,
+          // Purge re-queues the later one when the old one comes up instead
+          if (nb.m_queuedExpire == m_timerDeadline)
+            m_avoidedTimerEvents++;
+          nb.m_expireTime = expireTime;
+        }
+      int32_t age = int32_t (version - nb.m_peerVersion);
+      if (age < 0)
+        return 0; // reordered or lost-and-resent announcement, already superseded
+      bool mismatch = (age == 0 && m_peerAvailChDeposit[slot] != peerAvailAmount);
+      m_peerAvailChDeposit[slot] = peerAvailAmount;
+      nb.m_peerVersion = version;
+      if (mismatch)
+        {
+          // same version, other balance: resync both sides instead of closing
+          NS_LOG_LOGIC ("Balance of " << addr << " out of sync at version " << version);
+          nb.m_announcedVersion = nb.m_version - 1;
+          return -1;
+        }
+      return (age > 0) ? 1 : 0;
+    }
+  if (acked == true) //agreement for open channel from a peer
   {
-    return ((nb.m_expireTime < Simulator::Now ()) || nb.close);
+    NS_LOG_LOGIC ("Open a new payment channel to " << addr);
+    Neighbor neighbor (addr, m_initDeposit, peerAvailAmount, expire + Simulator::Now (), version);
+    m_nbIndex[addr] = m_nb.size ();
+    m_nb.push_back (neighbor);
+    m_availChDeposit.push_back (m_initDeposit);
+    m_peerAvailChDeposit.push_back (peerAvailAmount);
+    m_lockedChDeposit.push_back (0);
+    bool earliest = m_expiry.empty () || neighbor.m_expireTime < m_expiry.top ().m_expire;
+    m_expiry.push (ExpiryEntry (neighbor.m_expireTime, addr));
+    if (earliest)
+      ScheduleTimer ();
+    else
+      m_avoidedTimerEvents++;
   }
-};
+  return 0;
+}
 
 void
 Neighbors::Purge ()
 {
-  if (m_nb.empty ())
-    return;
-
-  CloseNeighbor pred;
-  if (!m_handleLinkFailure.IsNull ())
+  Time now = Simulator::Now ();
+  while (!m_expiry.empty () && m_expiry.top ().m_expire <= now)
     {
-      for (std::vector<Neighbor>::iterator j = m_nb.begin (); j != m_nb.end (); ++j)
+      ExpiryEntry e = m_expiry.top ();
+      m_expiry.pop ();
+      std::unordered_map<Ipv4Address, uint32_t, Ipv4AddressHash>::const_iterator i =
+        m_nbIndex.find (e.m_neighborAddress);
+      if (i == m_nbIndex.end ())
+        continue; // already closed by a read
+      Neighbor & nb = m_nb[i->second];
+      if (nb.m_queuedExpire != e.m_expire)
+        continue; // record of a previous channel to the same peer
+      if (IsClosed (nb))
+        {
+          Remove (i->second);
+        }
+      else
         {
-          if (pred (*j))
-            {
-              NS_LOG_LOGIC ("Close link to " << j->m_neighborAddress);
-              m_handleLinkFailure (j->m_neighborAddress);
-            }
+          // lifetime was extended since the record was queued
+          nb.m_queuedExpire = nb.m_expireTime;
+          m_expiry.push (ExpiryEntry (nb.m_expireTime, nb.m_neighborAddress));
         }
     }
-  m_nb.erase (std::remove_if (m_nb.begin (), m_nb.end (), pred), m_nb.end ());
-  m_ntimer.Cancel ();
-  m_ntimer.Schedule ();
+  ScheduleTimer ();
 }
 
 void
 Neighbors::ScheduleTimer ()
 {
+  if (m_expiry.empty ())
+    return;
+  Time deadline = m_expiry.top ().m_expire;
+  if (m_ntimer.IsRunning () && m_timerDeadline <= deadline)
+    {
+      // an earlier expiry fires first and re-arms the timer from Purge
+      m_avoidedTimerEvents++;
+      return;
+    }
   m_ntimer.Cancel ();
-  m_ntimer.Schedule ();
+  m_timerDeadline = deadline;
+  m_ntimer.Schedule (std::max (deadline - Simulator::Now (), Seconds (0)));
 }
 
 
@@ -202,12 +592,11 @@ Neighbors::ProcessTxError (WifiMacHeader const & hdr)
 {
   Mac48Address addr = hdr.GetAddr1 ();
 
-  for (std::vector<Neighbor>::iterator i = m_nb.begin (); i != m_nb.end (); ++i)
+  for (uint32_t i = m_nb.size (); i > 0; --i)
     {
-      if (i->m_hardwareAddress == addr)
-        i->close = true;
+      if (m_nb[i - 1].m_hardwareAddress == addr)
+        Remove (i - 1);
     }
-  Purge ();
 }
 }
 }
@@ -8,6 +8,9 @@
 #include "ns3/wifi-mac-header.h"
 #include "ns3/arp-cache.h"
 #include <vector>
+#include <functional>
+#include <queue>
+#include <unordered_map>
 
 namespace ns3
 {
@@ -27,14 +30,19 @@ public:
   {
     Ipv4Address m_neighborAddress;
     Time m_expireTime;    
+    Time m_queuedExpire;  // deadline under which this entry sits in the expiry heap
     uint32_t m_totalChDeposit;  //my total channel deposit
-    uint32_t m_availChDeposit;  // my available balance including received amount
     uint32_t m_peerTotalChDeposit;  //peer total channel deposit
-    uint32_t m_peerAvailChDeposit;  // peer available balance including received amount 
+    uint32_t m_version;  ///< version of my available balance, bumped on every change
+    uint32_t m_peerVersion;  ///< version of the peer balance last accepted
+    uint32_t m_announcedVersion;  ///< m_version when my balance was last announced
+    Time m_announceTime;  ///< when my balance was last announced
     bool close;
 
-    Neighbor (Ipv4Address ip, uint32_t myAmount, uint32_t peerAmount, Time t) :
-      m_neighborAddress (ip), m_expireTime (t), m_totalChDeposit (myAmount), m_peerTotalChDeposit (peerAmount), close (false)
+    Neighbor (Ipv4Address ip, uint32_t myAmount, uint32_t peerAmount, Time t, uint32_t peerVersion) :
+      m_neighborAddress (ip), m_expireTime (t), m_queuedExpire (t), m_totalChDeposit (myAmount),
+      m_peerTotalChDeposit (peerAmount), m_version (0), m_peerVersion (peerVersion),
+      m_announcedVersion (~0u), m_announceTime (Seconds (0)), close (false)
     {
     }
   };
@@ -43,28 +51,105 @@ public:
   Time GetExpireTime (Ipv4Address addr);
   /// Check that node with address addr  is neighbor
   bool IsNeighbor (Ipv4Address addr);
-  /// Update expire time for entry with address addr, if it exists, else add new entry
-  int Update (Ipv4Address addr, uint32_t amount, Time expire, bool acked);
-  /// Remove all expired entries
+  /**
+   * Update expire time for entry with address addr, if it exists, else add new entry
+   * \param amount peer available balance announced with version
+   * \param version peer balance version; an older one only refreshes the entry
+   * \return 1 if a newer balance was taken, -1 if the peer announced another
+   * balance under the version already accepted. That balance is taken too and
+   * my own balance is announced again at the next hello, the channel stays
+   * open. 0 otherwise.
+   */
+  int Update (Ipv4Address addr, uint32_t amount, Time expire, bool acked, uint32_t version = 0);
+  /// Remove all expired entries. Only entries whose deadline has passed are touched.
   void Purge ();
-  /// Schedule m_ntimer.
+  /// Schedule m_ntimer at the earliest pending deadline, unless it is already armed at or before it.
   void ScheduleTimer ();
+  /**
+   * Number of m_ntimer Cancel/Schedule pairs saved compared to rescheduling whenever
+   * the earliest deadline changes: extensions of the deadline the timer is armed
+   * for, left to Purge, and new deadlines behind the armed one
+   */
+  uint64_t GetAvoidedTimerEvents () const { return m_avoidedTimerEvents; }
   /// Remove all entries
-  void Clear () { m_nb.clear (); }
+  void Clear ();
+  /// Number of entries, valid indices for GetNgbIPaddrByIndex
+  uint32_t GetSize () const { return m_nb.size (); }
   //get neighbor address by index
   Ipv4Address GetNgbIPaddrByIndex(int i){return m_nb[i].m_neighborAddress; }
   // get amount of total channel deposit
   uint32_t GetChMyDeposit(Ipv4Address addr);
-  // get current available channel deposit
+  // get current available channel deposit, excluding funds reserved for in-flight payments
   uint32_t GetChMyAvailDeposit(Ipv4Address addr);
+  /// My balance on the channel to addr including reserved funds, the amount GetVersion versions and HELLOs announce
+  uint32_t GetChMyBalance (Ipv4Address addr);
     // get amount of total channel deposit
   uint32_t GetChPeerDeposit(Ipv4Address addr);
   // get current available channel deposit
   uint32_t GetChPeerAvailDeposit(Ipv4Address addr);
+  /// Version of my available balance on the channel to addr, 0 if there is none
+  uint32_t GetVersion (Ipv4Address addr);
+  /**
+   * Decide whether my balance on channel i has to be announced: it changed
+   * since the last announcement or keepalive has passed. If so it is recorded
+   * as announced now.
+   * \param version set to the balance version to announce
+   */
+  bool Announce (int i, Time keepalive, uint32_t & version);
   // decrease channel deposit
   void DecChDeposit(Ipv4Address addr, uint32_t pay);
   //increase channel deposit
   void IncChDeposit(Ipv4Address addr, uint32_t pay);
+  /// One balance change of a batch settlement
+  struct BalanceDelta
+  {
+    Ipv4Address m_neighborAddress;
+    int64_t m_delta;  ///< negative pays the peer, positive is received from the peer
+
+    BalanceDelta (Ipv4Address ip, int64_t delta) : m_neighborAddress (ip), m_delta (delta) {}
+  };
+  /**
+   * Apply all deltas to my available balances in one pass, or none of them.
+   * Every channel is checked first: it has to exist and its free balance must
+   * cover the net outgoing amount, whatever the order of its deltas.
+   * \param deltas balance changes, a peer may appear more than once
+   * \param failed set to the first channel, in order of appearance, that cannot take its net delta
+   * \return true if the whole batch was applied
+   */
+  bool ApplyBatch (std::vector<BalanceDelta> const & deltas, Ipv4Address & failed);
+  /**
+   * Collect neighbors whose available balance is at least amount.
+   * \param amount payment amount the channel has to carry
+   * \param out addresses of matching neighbors, in index order
+   * \param peer compare the peer side balance instead of mine
+   */
+  void FilterByAvailable (uint32_t amount, std::vector<Ipv4Address> & out, bool peer = false);
+  /// Collect up to k neighbors with the largest available balance, largest first
+  void TopKByAvailable (uint32_t k, std::vector<Ipv4Address> & out, bool peer = false);
+
+  ///\name Liquidity reservations for in-flight payments
+  //\{
+  /**
+   * Lock amount on the channel to peer for payment id, so that concurrent route
+   * discoveries do not oversubscribe it. Unresolved reservations are aborted
+   * after the reservation timeout.
+   * \return false if there is no channel, id is in use or the free balance is too small
+   */
+  bool Reserve (Ipv4Address peer, uint32_t amount, uint32_t id);
+  /**
+   * Spend the funds locked by reservation id
+   * \return false if there is no such reservation or the available balance
+   * dropped below its amount meanwhile; the reservation is released then
+   */
+  bool Commit (uint32_t id);
+  /// Release the funds locked by reservation id
+  bool Abort (uint32_t id);
+  /// Number of reservations not yet committed, aborted or timed out
+  uint32_t GetReservationCount ();
+  /// Applies to new reservations, pending ones keep their deadline
+  void SetReservationTimeout (Time t) { m_reservationTimeout = t; }
+  Time GetReservationTimeout () const { return m_reservationTimeout; }
+  //\}
   //default deposit
   uint32_t GetDefaultDeposit(){ return m_initDeposit; }
   /// Get callback to ProcessTxError
@@ -75,20 +160,87 @@ public:
   void SetCallback (Callback<void, Ipv4Address> cb) { m_handleLinkFailure = cb; }
   Callback<void, Ipv4Address> GetCallback () const { return m_handleLinkFailure; }
   //\}
+  /// Set the function told the peer of every change of my available balance, which bumps its version
+  void SetBalanceChangeCallback (Callback<void, Ipv4Address> cb) { m_balanceChange = cb; }
 private:
   /// link failure callback
   Callback<void, Ipv4Address> m_handleLinkFailure;
+  /// See SetBalanceChangeCallback
+  Callback<void, Ipv4Address> m_balanceChange;
   /// TX error callback
   Callback<void, WifiMacHeader const &> m_txErrorCallback;
   /// Timer for neighbor's list. Schedule Purge().
   Timer m_ntimer;
-  /// vector of entries
+  /// Absolute time m_ntimer is armed for
+  Time m_timerDeadline;
+  /// See GetAvoidedTimerEvents
+  uint64_t m_avoidedTimerEvents;
+  /// vector of entries, kept dense. A closed entry is replaced by the last one,
+  /// so GetNgbIPaddrByIndex is stable between closures but not across them.
   std::vector<Neighbor> m_nb;
+  ///\name Balance columns, parallel to m_nb so capacity scans touch only the balances
+  //\{
+  std::vector<uint32_t> m_availChDeposit;  ///< my available balance including received amount
+  std::vector<uint32_t> m_peerAvailChDeposit;  ///< peer available balance including received amount
+  std::vector<uint32_t> m_lockedChDeposit;  ///< part of my available balance held by reservations
+  //\}
+  /// Funds locked on a channel for one payment
+  struct Reservation
+  {
+    Ipv4Address m_neighborAddress;
+    uint32_t m_amount;
+    Time m_deadline;  ///< aborted when this passes unresolved
+  };
+  /// payment id -> reservation
+  std::unordered_map<uint32_t, Reservation> m_reservations;
+  typedef std::priority_queue<std::pair<Time, uint32_t>, std::vector<std::pair<Time, uint32_t> >,
+                              std::greater<std::pair<Time, uint32_t> > > ReservationQueue;
+  /// min-heap of (deadline, payment id). Records of resolved reservations are
+  /// left in place and skipped when their deadline no longer matches.
+  ReservationQueue m_reservationTimeouts;
+  /// Lifetime of an unresolved reservation
+  Time m_reservationTimeout;
+  /// neighbor address -> slot in m_nb
+  std::unordered_map<Ipv4Address, uint32_t, Ipv4AddressHash> m_nbIndex;
+  /// Expiry heap record. Extending a neighbor lifetime does not push a new record,
+  /// the record is re-keyed lazily when its old deadline is reached.
+  struct ExpiryEntry
+  {
+    Time m_expire;
+    Ipv4Address m_neighborAddress;
+
+    ExpiryEntry (Time t, Ipv4Address ip) : m_expire (t), m_neighborAddress (ip) {}
+  };
+  struct LaterExpiry
+  {
+    bool operator() (const ExpiryEntry & a, const ExpiryEntry & b) const
+    {
+      return (a.m_expire > b.m_expire);
+    }
+  };
+  typedef std::priority_queue<ExpiryEntry, std::vector<ExpiryEntry>, LaterExpiry> ExpiryQueue;
+  /// min-heap of neighbor deadlines, one live record per neighbor
+  ExpiryQueue m_expiry;
   //default deposit
   uint32_t m_initDeposit;
 
   /// Process layer 2 TX error notification
   void ProcessTxError (WifiMacHeader const &);
+  /// Find slot of neighbor addr in O(1). Closes the touched entry first if it has expired.
+  bool FindLive (Ipv4Address addr, uint32_t & slot);
+  /// Remove entry in slot in O(1), moving the last entry into it, and notify link failure
+  void Remove (uint32_t slot);
+  /// Abort reservations whose timeout has passed
+  void ExpireReservations ();
+  /// Unlock reservation i and forget it; spend the funds too if commit is true
+  bool Resolve (std::unordered_map<uint32_t, Reservation>::iterator i, bool commit);
+  /// Record a change of my available balance in slot
+  void Touch (uint32_t slot)
+  {
+    m_nb[slot].m_version++;
+    if (!m_balanceChange.IsNull ())
+      m_balanceChange (m_nb[slot].m_neighborAddress);
+  }
 };
 
 }
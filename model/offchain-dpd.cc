@@ -1,19 +1,262 @@
 #include "offchain-dpd.h"
+#include <algorithm>
+#include <cmath>
 
 namespace ns3
 {
 namespace offchain
 {
 
+RotatingBloomFilter::RotatingBloomFilter (Time lifetime, uint32_t generations, uint32_t capacity, double fpRate) :
+  m_newest (0),
+  m_lifetime (lifetime)
+{
+  Configure (generations, capacity, fpRate);
+}
+
+void
+RotatingBloomFilter::Configure (uint32_t generations, uint32_t capacity, double fpRate)
+{
+  m_generations = std::max<uint32_t> (generations, 2);
+  m_capacity = std::max<uint32_t> (capacity, 1);
+  m_fpRate = std::min (std::max (fpRate, 1e-9), 0.5);
+  // a lookup tests all filters, so each gets a share of the rate
+  double each = m_fpRate / m_generations;
+  double bits = std::ceil (-double (m_capacity) * std::log (each) / (M_LN2 * M_LN2));
+  m_bits = (uint32_t (bits) + 63) & ~63u;
+  m_hashes = std::max<uint32_t> (uint32_t (std::floor (double (m_bits) / m_capacity * M_LN2 + 0.5)), 1);
+  m_filters.clear ();
+  m_setBits.clear ();
+}
+
+void
+RotatingBloomFilter::Allocate ()
+{
+  m_filters.assign (m_generations, std::vector<uint64_t> (m_bits / 64, 0));
+  m_setBits.assign (m_generations, 0);
+  m_newest = 0;
+  m_windowStart = Simulator::Now ();
+}
+
+void
+RotatingBloomFilter::SetLifetime (Time lifetime)
+{
+  Rotate ();
+  m_lifetime = lifetime;
+}
+
+uint64_t
+RotatingBloomFilter::Mix (uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+void
+RotatingBloomFilter::Rotate ()
+{
+  uint32_t generations = m_filters.size ();
+  if (generations == 0)
+    return;
+  Time window = m_lifetime / (generations - 1);
+  if (!window.IsStrictlyPositive ())
+    return;
+  int64_t ended = (Simulator::Now () - m_windowStart).GetTimeStep () / window.GetTimeStep ();
+  if (ended <= 0)
+    return;
+  m_windowStart = m_windowStart + window * ended;
+  for (int64_t i = 0; i < std::min<int64_t> (ended, generations); ++i)
+    {
+      m_newest = (m_newest + 1) % generations;
+      std::fill (m_filters[m_newest].begin (), m_filters[m_newest].end (), 0);
+      m_setBits[m_newest] = 0;
+    }
+}
+
+bool
+RotatingBloomFilter::IsDuplicate (uint64_t key)
+{
+  if (m_filters.empty ())
+    Allocate ();
+  Rotate ();
+  // double hashing: bit i is h1 + i * h2
+  uint64_t h1 = Mix (key);
+  uint64_t h2 = Mix (h1) | 1;
+  for (uint32_t g = 0; g < m_filters.size (); ++g)
+    {
+      std::vector<uint64_t> const & filter = m_filters[g];
+      uint64_t h = h1;
+      uint32_t i = 0;
+      for (; i < m_hashes; ++i, h += h2)
+        {
+          uint32_t bit = h % m_bits;
+          if (!(filter[bit >> 6] & (1ULL << (bit & 63))))
+            break;
+        }
+      if (i == m_hashes)
+        return true;
+    }
+  std::vector<uint64_t> & newest = m_filters[m_newest];
+  uint64_t h = h1;
+  for (uint32_t i = 0; i < m_hashes; ++i, h += h2)
+    {
+      uint32_t bit = h % m_bits;
+      uint64_t mask = 1ULL << (bit & 63);
+      if (!(newest[bit >> 6] & mask))
+        {
+          newest[bit >> 6] |= mask;
+          m_setBits[m_newest]++;
+        }
+    }
+  return false;
+}
+
+double
+RotatingBloomFilter::GetEstimatedFalsePositiveRate () const
+{
+  // a new key passes filter g with probability fill (g) ^ k
+  double miss = 1;
+  for (uint32_t g = 0; g < m_filters.size (); ++g)
+    miss *= 1 - std::pow (double (m_setBits[g]) / m_bits, double (m_hashes));
+  return 1 - miss;
+}
+
+
+bool
+DuplicatePacketDetection::GetContentKey (Ptr<const Packet> p, uint64_t & key, MessageType & type)
+{
+  Ptr<Packet> packet = p->Copy ();
+  TypeHeader tHeader;
+  if (packet->GetSize () < tHeader.GetSerializedSize ())
+    return false;
+  packet->RemoveHeader (tHeader);
+  if (!tHeader.IsValid ())
+    return false;
+  // a compact header is at least as long as one whose varints are all zero
+  uint8_t flags = 0;
+  packet->CopyData (&flags, 1);
+  bool compact = RreqView::IsCompact (&flags);
+  Ipv4Address origin;
+  uint32_t id;
+  uint32_t dstSeqno;
+  switch (tHeader.Get ())
+    {
+    case OFFCHAIN_TYPE_RREQ:
+      {
+        uint8_t buf[RreqView::MAX_SIZE];
+        RreqView rreqView (buf, packet->CopyData (buf, RreqView::MAX_SIZE));
+        if (!rreqView.IsValid ())
+          return false;
+        origin = rreqView.GetOrigin ();
+        id = rreqView.GetId ();
+        dstSeqno = rreqView.GetDstSeqno ();
+        break;
+      }
+    case OFFCHAIN_TYPE_RREP:
+      {
+        // an RREP carries no id, the destination it answers for tells replies apart;
+        // the hop count lets a reply over a shorter path through
+        RrepHeader rrepHeader;
+        rrepHeader.SetCompact (compact);
+        if (packet->GetSize () < rrepHeader.GetSerializedSize ())
+          return false;
+        packet->RemoveHeader (rrepHeader);
+        origin = rrepHeader.GetOrigin ();
+        id = rrepHeader.GetDst ().Get ();
+        dstSeqno = rrepHeader.GetDstSeqno () ^ (uint32_t (rrepHeader.GetHopCount ()) << 24);
+        break;
+      }
+    case OFFCHAIN_TYPE_RREQ_BATCH:
+      {
+        // copies of one flood may carry different subsets of the destinations
+        BatchedRreqHeader rreqHeader;
+        rreqHeader.SetCompact (compact);
+        if (packet->GetSize () < rreqHeader.GetSerializedSize ())
+          return false;
+        packet->RemoveHeader (rreqHeader);
+        origin = rreqHeader.GetOrigin ();
+        id = rreqHeader.GetId ();
+        dstSeqno = 0;
+        break;
+      }
+    default:
+      // HELLOs repeat unchanged fields every round, they keep the uid key
+      return false;
+    }
+  key = GetContentKey (tHeader.Get (), origin, id, dstSeqno);
+  type = tHeader.Get ();
+  return true;
+}
+
+uint64_t
+DuplicatePacketDetection::GetContentKey (MessageType type, Ipv4Address origin, uint32_t id, uint32_t dstSeqno)
+{
+  // keep the key apart from (source << 32 | uid) keys of other packets
+  uint64_t content = (uint64_t (type) << 32) | dstSeqno;
+  return RotatingBloomFilter::Mix (((uint64_t (origin.Get ()) << 32) | id) ^ RotatingBloomFilter::Mix (content));
+}
+
+const uint32_t DuplicatePacketDetection::MAX_TYPE;
+
 bool
 DuplicatePacketDetection::IsDuplicate  (Ptr<const Packet> p, const Ipv4Header & header)
 {
-  return m_idCache.IsDuplicate (header.GetSource (), p->GetUid () );
+  return IsDuplicate (p, header.GetSource ());
 }
+
+bool
+DuplicatePacketDetection::IsDuplicate (Ptr<const Packet> p, Ipv4Address src)
+{
+  uint32_t type = 0;
+  uint64_t key = (uint64_t (src.Get ()) << 32) ^ p->GetUid ();
+  MessageType control;
+  if (m_key == CONTENT && GetContentKey (p, key, control))
+    type = control;
+  return IsDuplicateKey (key, type);
+}
+
+bool
+DuplicatePacketDetection::IsDuplicate (MessageType type, Ipv4Address origin, uint32_t id, uint32_t dstSeqno,
+                                       Ipv4Address src, uint64_t uid)
+{
+  if (m_key == CONTENT)
+    return IsDuplicateKey (GetContentKey (type, origin, id, dstSeqno), type);
+  return IsDuplicateKey ((uint64_t (src.Get ()) << 32) ^ uid, 0);
+}
+
+bool
+DuplicatePacketDetection::IsDuplicateKey (uint64_t key, uint32_t type)
+{
+  type = std::min<uint32_t> (type, MAX_TYPE);
+  m_seen[type]++;
+  bool duplicate = IsDuplicateKey (key);
+  if (duplicate)
+    m_suppressed[type]++;
+  return duplicate;
+}
+
+bool
+DuplicatePacketDetection::IsDuplicateKey (uint64_t key)
+{
+  if (m_mode == EXACT)
+    return m_idCache.IsDuplicate (key);
+  bool duplicate = m_bloom.IsDuplicate (key);
+  if (m_check && !m_idCache.IsDuplicate (key))
+    {
+      m_checked++;
+      if (duplicate)
+        m_falsePositives++;
+    }
+  return duplicate;
+}
+
 void
 DuplicatePacketDetection::SetLifetime (Time lifetime)
 {
   m_idCache.SetLifetime (lifetime);
+  m_bloom.SetLifetime (lifetime);
 }
 
 Time
@@ -22,6 +265,14 @@ DuplicatePacketDetection::GetLifetime () const
   return m_idCache.GetLifeTime ();
 }
 
+double
+DuplicatePacketDetection::GetObservedFalsePositiveRate () const
+{
+  if (m_checked == 0)
+    return 0;
+  return double (m_falsePositives) / m_checked;
+}
+
 
 }
 }
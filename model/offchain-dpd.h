@@ -2,37 +2,195 @@
 #define OFFCHAIN_DPD_H
 
 #include "offchain-id.h"
+#include "payroute-packet.h"
 #include "ns3/nstime.h"
 #include "ns3/packet.h"
 #include "ns3/ipv4-header.h"
+#include <vector>
 
 
 namespace ns3
 {
 namespace offchain
 {
+/**
+ * \ingroup aodv
+ *
+ * \brief Bloom filters over consecutive time windows, remembering keys for a lifetime
+ *
+ * Each of the G filters covers one window of lifetime / (G - 1). Keys are
+ * added to the newest filter and looked up in all of them; when a window ends
+ * the oldest filter is cleared and becomes the newest. A key is therefore
+ * remembered for at least lifetime and at most lifetime * G / (G - 1).
+ *
+ * Filters are sized for capacity keys per window so that the G filters
+ * together give a false positive rate of about fpRate. They are allocated on
+ * first use; memory does not depend on how many keys are seen, past capacity
+ * the false positive rate grows.
+ */
+class RotatingBloomFilter
+{
+public:
+  /// c-tor
+  RotatingBloomFilter (Time lifetime, uint32_t generations = 2, uint32_t capacity = 10000, double fpRate = 0.001);
+  /// Check whether key was seen within the lifetime. Add it, if it wasn't.
+  bool IsDuplicate (uint64_t key);
+  /**
+   * Size for a new number of generations, keys per window and false positive rate.
+   * Drops the filters.
+   */
+  void Configure (uint32_t generations, uint32_t capacity, double fpRate);
+  /// Estimate of the current false positive rate from the filters fill
+  double GetEstimatedFalsePositiveRate () const;
+  ///\name Fields
+  //\{
+  void SetLifetime (Time lifetime);
+  Time GetLifetime () const { return m_lifetime; }
+  uint32_t GetGenerations () const { return m_generations; }
+  uint32_t GetCapacity () const { return m_capacity; }
+  double GetFalsePositiveRate () const { return m_fpRate; }
+  /// Bits per filter
+  uint32_t GetBits () const { return m_bits; }
+  /// Hash functions per key
+  uint32_t GetHashes () const { return m_hashes; }
+  //\}
+  /// splitmix64 finalizer
+  static uint64_t Mix (uint64_t x);
+private:
+  /// Clear the oldest filters of the windows that ended
+  void Rotate ();
+  /// Allocate the filters, the newest window starting now
+  void Allocate ();
+
+  /// Filter bits, m_filters[m_newest] takes new keys
+  std::vector<std::vector<uint64_t> > m_filters;
+  /// Bits set per filter, for the estimate
+  std::vector<uint32_t> m_setBits;
+  /// Filter taking new keys
+  uint32_t m_newest;
+  /// Number of filters
+  uint32_t m_generations;
+  /// Bits per filter
+  uint32_t m_bits;
+  /// Hash functions per key
+  uint32_t m_hashes;
+  /// Keys per window the filters are sized for
+  uint32_t m_capacity;
+  /// Target false positive rate
+  double m_fpRate;
+  /// Lifetime of a key
+  Time m_lifetime;
+  /// Start of the newest window
+  Time m_windowStart;
+};
+
 /**
  * \ingroup aodv
  * 
  * \brief Helper class used to remember already seen packets and detect duplicates.
  *
- * Currently duplicate detection is based on uinique packet ID given by Packet::GetUid ()
- * This approach is known to be weak and should be changed.
+ * By default duplicate detection is based on uinique packet ID given by Packet::GetUid ()
+ * This approach is known to be weak: every rebroadcast of a control message is a new
+ * packet with a new uid. With the CONTENT key a RREQ or RREP is identified by a hash
+ * of its type, origin, request id (destination and hop count for RREP) and destination
+ * sequence number instead, whoever forwarded it. Other packets keep the uid key,
+ * HELLOs included: a periodic HELLO repeats the fields of the previous one.
+ *
+ * In EXACT mode every key is recorded in an IdCache. In BLOOM mode a
+ * RotatingBloomFilter of fixed size is used instead, which may report a new
+ * packet as a duplicate. With the check enabled the exact cache is kept as
+ * well, to count those false positives.
  */
 class DuplicatePacketDetection
 {
 public:
+  /// Duplicate record keeping
+  enum Mode
+  {
+    EXACT,
+    BLOOM
+  };
+  /// What identifies a packet
+  enum Key
+  {
+    PACKET_UID,
+    CONTENT
+  };
+
   /// C-tor
-  DuplicatePacketDetection (Time lifetime) : m_idCache (lifetime) {}
+  DuplicatePacketDetection (Time lifetime) :
+    m_idCache (lifetime), m_bloom (lifetime), m_mode (EXACT), m_key (PACKET_UID), m_check (false),
+    m_checked (0), m_falsePositives (0), m_seen (), m_suppressed ()
+  {}
   /// Check that the packet is duplicated. If not, save information about this packet.
   bool IsDuplicate (Ptr<const Packet> p, const Ipv4Header & header);
+  /// Same for a control packet received from src, starting with its TypeHeader
+  bool IsDuplicate (Ptr<const Packet> p, Ipv4Address src);
+  /**
+   * Same for a RREQ or batched RREQ whose fields were read already, so that
+   * the packet is neither copied nor parsed again
+   * \param uid uid of the packet, the key unless keying on content
+   */
+  bool IsDuplicate (MessageType type, Ipv4Address origin, uint32_t id, uint32_t dstSeqno,
+                    Ipv4Address src, uint64_t uid);
   /// Set duplicate records lifetimes
   void SetLifetime (Time lifetime);
   /// Get duplicate records lifetimes
   Time GetLifetime () const;
+  void SetKey (Key key) { m_key = key; }
+  Key GetKey () const { return m_key; }
+  /**
+   * Key and type of a control packet from its content
+   * \return false if p is not a RREQ, batched RREQ or RREP
+   */
+  static bool GetContentKey (Ptr<const Packet> p, uint64_t & key, MessageType & type);
+  /// Content key of a control message of type with the given fields
+  static uint64_t GetContentKey (MessageType type, Ipv4Address origin, uint32_t id, uint32_t dstSeqno);
+  ///\name Counters by message type, 0 for packets that are not control messages
+  //\{
+  uint32_t GetSeen (uint32_t type) const { return m_seen[std::min<uint32_t> (type, MAX_TYPE)]; }
+  uint32_t GetSuppressed (uint32_t type) const { return m_suppressed[std::min<uint32_t> (type, MAX_TYPE)]; }
+  //\}
+  ///\name Bloom filter mode
+  //\{
+  void SetMode (Mode mode) { m_mode = mode; }
+  Mode GetMode () const { return m_mode; }
+  RotatingBloomFilter & GetBloomFilter () { return m_bloom; }
+  RotatingBloomFilter const & GetBloomFilter () const { return m_bloom; }
+  /// Keep the exact cache alongside the filter and count its false positives
+  void SetBloomCheck (bool check) { m_check = check; }
+  bool GetBloomCheck () const { return m_check; }
+  /// Packets the filter reported as duplicates that the exact cache had not seen
+  uint32_t GetFalsePositives () const { return m_falsePositives; }
+  /// False positives per new packet seen by the check
+  double GetObservedFalsePositiveRate () const;
+  //\}
 private:
   /// Impl
   IdCache m_idCache;
+  /// Impl in BLOOM mode
+  RotatingBloomFilter m_bloom;
+  /// Record keeping in use
+  Mode m_mode;
+  /// Packet identification in use
+  Key m_key;
+  /// Whether the exact cache checks the filter
+  bool m_check;
+  /// New packets seen by the check
+  uint32_t m_checked;
+  /// False positives seen by the check
+  uint32_t m_falsePositives;
+  /// Largest message type counted on its own, the last MessageType
+  static const uint32_t MAX_TYPE = OFFCHAIN_TYPE_RREQ_BATCH;
+  /// Packets looked up, by message type
+  uint32_t m_seen[MAX_TYPE + 1];
+  /// Duplicates found, by message type
+  uint32_t m_suppressed[MAX_TYPE + 1];
+
+  /// Look key up in the records in use
+  bool IsDuplicateKey (uint64_t key);
+  /// Same, counting the lookup under message type
+  bool IsDuplicateKey (uint64_t key, uint32_t type);
 };
 
 }
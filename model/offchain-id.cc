@@ -1,5 +1,4 @@
 #include "offchain-id.h"
-#include <algorithm>
 
 namespace ns3
 {
@@ -7,22 +6,29 @@ namespace offchain
 {
 bool
 IdCache::IsDuplicate (Ipv4Address addr, uint32_t id)
+{
+  return IsDuplicate (Key (addr, id));
+}
+
+bool
+IdCache::IsDuplicate (uint64_t key)
 {
   Purge ();
-  for (std::vector<UniqueId>::const_iterator i = m_idCache.begin ();
-       i != m_idCache.end (); ++i)
-    if (i->m_context == addr && i->m_id == id)
-      return true;
-  struct UniqueId uniqueId =
-  { addr, id, m_lifetime + Simulator::Now () };
-  m_idCache.push_back (uniqueId);
+  Time expire = m_lifetime + Simulator::Now ();
+  // after Purge every record in the map is live
+  if (!m_idCache.insert (std::make_pair (key, expire)).second)
+    return true;
+  m_expiry.push (std::make_pair (expire, key));
   return false;
 }
 void
 IdCache::Purge ()
 {
-  m_idCache.erase (remove_if (m_idCache.begin (), m_idCache.end (),
-                              IsExpired ()), m_idCache.end ());
+  while (!m_expiry.empty () && m_expiry.top ().first < Simulator::Now ())
+    {
+      m_idCache.erase (m_expiry.top ().second);
+      m_expiry.pop ();
+    }
 }
 
 uint32_t
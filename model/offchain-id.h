@@ -3,7 +3,10 @@
 
 #include "ns3/ipv4-address.h"
 #include "ns3/simulator.h"
+#include <queue>
 #include <vector>
+#include <functional>
+#include <unordered_map>
 
 namespace ns3
 {
@@ -11,6 +14,15 @@ namespace offchain
 {
 
 
+/**
+ * \brief Seen (address, id) pairs, kept for a lifetime
+ *
+ * Records live in a hash map keyed on (context address, id) with their expiry
+ * time, and in a min-heap of expiry times. Purge only pops expired records from
+ * the top, so the map holds live records only and GetSize is exact, also after
+ * SetLifetime shortened the lifetime. With a fixed lifetime records arrive in
+ * expiry order and a push does not move up the heap.
+ */
 class IdCache
 {
 public:
@@ -18,6 +30,8 @@ public:
   IdCache (Time lifetime) : m_lifetime (lifetime) {}
   /// Check that entry (addr, id) exists in cache. Add entry, if it doesn't exist.
   bool IsDuplicate (Ipv4Address addr, uint32_t id);
+  /// Same for a 64 bit key built by the caller
+  bool IsDuplicate (uint64_t key);
   /// Remove all expired entries
   void Purge ();
   /// Return number of entries in cache
@@ -27,25 +41,16 @@ public:
   /// Return lifetime for existing entries in cache
   Time GetLifeTime () const { return m_lifetime; }
 private:
-  /// Unique packet ID
-  struct UniqueId
+  /// Unique packet ID: the id is supposed to be unique in single address context (e.g. sender address)
+  static uint64_t Key (Ipv4Address addr, uint32_t id)
   {
-    /// ID is supposed to be unique in single address context (e.g. sender address)
-    Ipv4Address m_context;
-    /// The id
-    uint32_t m_id;
-    /// When record will expire
-    Time m_expire;
-  };
-  struct IsExpired
-  {
-    bool operator() (const struct UniqueId & u) const
-    {
-      return (u.m_expire < Simulator::Now ());
-    }
-  };
-  /// Already seen IDs
-  std::vector<UniqueId> m_idCache;
+    return (uint64_t (addr.Get ()) << 32) | id;
+  }
+  /// Already seen IDs -> when the record will expire
+  std::unordered_map<uint64_t, Time> m_idCache;
+  /// (expire time, ID), earliest first
+  typedef std::pair<Time, uint64_t> ExpiryRecord;
+  std::priority_queue<ExpiryRecord, std::vector<ExpiryRecord>, std::greater<ExpiryRecord> > m_expiry;
   /// Default lifetime for ID records
   Time m_lifetime;
 };
@@ -2,6 +2,8 @@
 #include "offchain-routing.h"
 #include "ns3/log.h"
 #include "ns3/boolean.h"
+#include "ns3/enum.h"
+#include "ns3/double.h"
 #include "ns3/random-variable-stream.h"
 #include "ns3/inet-socket-address.h"
 #include "ns3/trace-source-accessor.h"
@@ -97,6 +99,7 @@ RoutingProtocol::RoutingProtocol () :
   MyRouteTimeout (Time (2 * std::max (PathDiscoveryTime, ActiveRouteTimeout))),
   HelloInterval (Seconds (60)),
   AllowedHelloLoss (2),
+  HelloKeepalive (Seconds (60)),
   DeletePeriod (Time (5 * std::max (ActiveRouteTimeout, HelloInterval))),
   NextHopWait (NodeTraversalTime + MilliSeconds (10)),
   TimeoutBuffer (2),
@@ -106,6 +109,9 @@ RoutingProtocol::RoutingProtocol () :
   DestinationOnly (false),
   GratuitousReply (true),
   EnableHello (true),
+  CompactEncoding (false),
+  RreqBatchWindow (Seconds (0)),
+  RreqBatchSize (32),
   m_routingTable (DeletePeriod),
   m_queue (MaxQueueLen, MaxQueueTime),
   m_requestId (0),
@@ -113,6 +119,8 @@ RoutingProtocol::RoutingProtocol () :
   m_rreqIdCache (PathDiscoveryTime),
   m_dpd (PathDiscoveryTime),
   m_nb (HelloInterval),
+  m_routeCache (64, Seconds (10)),
+  m_nextPresenceHello (Seconds (0)),
   m_rreqCount (0),
   m_rerrCount (0),
   m_htimer (Timer::CANCEL_ON_DESTROY),
@@ -123,6 +131,19 @@ RoutingProtocol::RoutingProtocol () :
     {
       m_nb.SetCallback (MakeCallback (&RoutingProtocol::ClosePaymentChannelToNextHop, this));
     }
+  m_nb.SetBalanceChangeCallback (MakeCallback (&RoutingProtocol::NotifyBalanceChange, this));
+}
+
+void
+RoutingProtocol::SetNeighborTable (Neighbors t)
+{
+  m_nb = t;
+  // the copy carries the callbacks of its previous owner
+  if (EnableHello)
+    {
+      m_nb.SetCallback (MakeCallback (&RoutingProtocol::ClosePaymentChannelToNextHop, this));
+    }
+  m_nb.SetBalanceChangeCallback (MakeCallback (&RoutingProtocol::NotifyBalanceChange, this));
 }
 
 TypeId
@@ -143,6 +164,15 @@ RoutingProtocol::GetTypeId (void)
                    UintegerValue (10),
                    MakeUintegerAccessor (&RoutingProtocol::RreqRateLimit),
                    MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("RreqBatchWindow", "Time route requests wait to be sent together in one batched RREQ. "
+                   "Zero sends one RREQ per destination right away.",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&RoutingProtocol::RreqBatchWindow),
+                   MakeTimeChecker ())
+    .AddAttribute ("RreqBatchSize", "Maximum number of destinations in one batched RREQ, small enough to fit the MTU.",
+                   UintegerValue (32),
+                   MakeUintegerAccessor (&RoutingProtocol::RreqBatchSize),
+                   MakeUintegerChecker<uint32_t> (1, 100))
     .AddAttribute ("RerrRateLimit", "Maximum number of RERR per second.",
                    UintegerValue (10),
                    MakeUintegerAccessor (&RoutingProtocol::RerrRateLimit),
@@ -196,6 +226,61 @@ RoutingProtocol::GetTypeId (void)
                    MakeUintegerAccessor (&RoutingProtocol::SetMaxQueueLen,
                                          &RoutingProtocol::GetMaxQueueLen),
                    MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("QueuePolicy", "Order in which payments waiting for a route are released, and dropped when the queue is full. "
+                   "Deadline and FeePerByte rank payments by the PaymentTag they carry.",
+                   EnumValue (RequestQueue::FIFO),
+                   MakeEnumAccessor (&RoutingProtocol::SetQueuePolicy,
+                                     &RoutingProtocol::GetQueuePolicy),
+                   MakeEnumChecker (RequestQueue::FIFO, "Fifo",
+                                    RequestQueue::DEADLINE, "Deadline",
+                                    RequestQueue::VALUE, "FeePerByte"))
+    .AddAttribute ("MaxPaths", "Maximum number of paths kept per destination, used to split large payments.",
+                   UintegerValue (3),
+                   MakeUintegerAccessor (&RoutingProtocol::SetMaxPaths,
+                                         &RoutingProtocol::GetMaxPaths),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("RouteCacheSize", "Maximum number of (destination, amount bucket) paths cached.",
+                   UintegerValue (64),
+                   MakeUintegerAccessor (&RoutingProtocol::SetRouteCacheSize,
+                                         &RoutingProtocol::GetRouteCacheSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("RouteCacheTimeout", "Time a cached payment path is trusted without being used again.",
+                   TimeValue (Seconds (10)),
+                   MakeTimeAccessor (&RoutingProtocol::SetRouteCacheTimeout,
+                                     &RoutingProtocol::GetRouteCacheTimeout),
+                   MakeTimeChecker ())
+    .AddAttribute ("DpdKey", "What identifies a packet in duplicate broadcast packet detection.",
+                   EnumValue (DuplicatePacketDetection::PACKET_UID),
+                   MakeEnumAccessor (&RoutingProtocol::SetDpdKey,
+                                     &RoutingProtocol::GetDpdKey),
+                   MakeEnumChecker (DuplicatePacketDetection::PACKET_UID, "PacketUid",
+                                    DuplicatePacketDetection::CONTENT, "Content"))
+    .AddAttribute ("DpdMode", "Record keeping of duplicate broadcast packet detection.",
+                   EnumValue (DuplicatePacketDetection::EXACT),
+                   MakeEnumAccessor (&RoutingProtocol::SetDpdMode,
+                                     &RoutingProtocol::GetDpdMode),
+                   MakeEnumChecker (DuplicatePacketDetection::EXACT, "Exact",
+                                    DuplicatePacketDetection::BLOOM, "Bloom"))
+    .AddAttribute ("BloomGenerations", "Number of rotating Bloom filters in Bloom duplicate detection.",
+                   UintegerValue (2),
+                   MakeUintegerAccessor (&RoutingProtocol::SetBloomGenerations,
+                                         &RoutingProtocol::GetBloomGenerations),
+                   MakeUintegerChecker<uint32_t> (2))
+    .AddAttribute ("BloomCapacity", "Packets per filter window the Bloom filters are sized for.",
+                   UintegerValue (10000),
+                   MakeUintegerAccessor (&RoutingProtocol::SetBloomCapacity,
+                                         &RoutingProtocol::GetBloomCapacity),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("BloomFalsePositiveRate", "Target rate of new packets taken for duplicates in Bloom duplicate detection.",
+                   DoubleValue (0.001),
+                   MakeDoubleAccessor (&RoutingProtocol::SetBloomFalsePositiveRate,
+                                       &RoutingProtocol::GetBloomFalsePositiveRate),
+                   MakeDoubleChecker<double> (0, 0.5))
+    .AddAttribute ("BloomCheck", "Keep exact duplicate records too, to count Bloom filter false positives.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&RoutingProtocol::SetBloomCheck,
+                                        &RoutingProtocol::GetBloomCheck),
+                   MakeBooleanChecker ())
     .AddAttribute ("MaxQueueTime", "Maximum time packets can be queued (in seconds)",
                    TimeValue (Seconds (30)),
                    MakeTimeAccessor (&RoutingProtocol::SetMaxQueueTime,
@@ -205,6 +290,10 @@ RoutingProtocol::GetTypeId (void)
                    UintegerValue (2),
                    MakeUintegerAccessor (&RoutingProtocol::AllowedHelloLoss),
                    MakeUintegerChecker<uint16_t> ())
+    .AddAttribute ("HelloKeepalive", "Longest time a channel whose balance did not change goes without a HELLO.",
+                   TimeValue (Seconds (60)),
+                   MakeTimeAccessor (&RoutingProtocol::HelloKeepalive),
+                   MakeTimeChecker ())
     .AddAttribute ("GratuitousReply", "Indicates whether a gratuitous RREP should be unicast to the node originated route discovery.",
                    BooleanValue (true),
                    MakeBooleanAccessor (&RoutingProtocol::SetGratuitousReplyFlag,
@@ -225,20 +314,54 @@ RoutingProtocol::GetTypeId (void)
                    MakeBooleanAccessor (&RoutingProtocol::SetBroadcastEnable,
                                         &RoutingProtocol::GetBroadcastEnable),
                    MakeBooleanChecker ())
+    .AddAttribute ("CompactEncoding", "Send control messages this node originates with varint fields. Forwarded RREQs keep the "
+                   "encoding they arrived in, both encodings are always accepted.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&RoutingProtocol::SetCompactEncoding,
+                                        &RoutingProtocol::GetCompactEncoding),
+                   MakeBooleanChecker ())
     .AddAttribute ("UniformRv",
                    "Access to the underlying UniformRandomVariable",
                    StringValue ("ns3::UniformRandomVariable"),
                    MakePointerAccessor (&RoutingProtocol::m_uniformRandomVariable),
                    MakePointerChecker<UniformRandomVariable> ())
+    .AddTraceSource ("QueueFlush", "Packets queued for a destination forwarded once its route arrived.",
+                     MakeTraceSourceAccessor (&RoutingProtocol::m_queueFlushTrace),
+                     "ns3::offchain::RoutingProtocol::QueueFlushTracedCallback")
   ;
   return tid;
 }
 
 
+void
+RoutingProtocol::SetBloomGenerations (uint32_t n)
+{
+  RotatingBloomFilter & bloom = m_dpd.GetBloomFilter ();
+  bloom.Configure (n, bloom.GetCapacity (), bloom.GetFalsePositiveRate ());
+}
+
+void
+RoutingProtocol::SetBloomCapacity (uint32_t n)
+{
+  RotatingBloomFilter & bloom = m_dpd.GetBloomFilter ();
+  bloom.Configure (bloom.GetGenerations (), n, bloom.GetFalsePositiveRate ());
+}
+
+void
+RoutingProtocol::SetBloomFalsePositiveRate (double rate)
+{
+  RotatingBloomFilter & bloom = m_dpd.GetBloomFilter ();
+  bloom.Configure (bloom.GetGenerations (), bloom.GetCapacity (), rate);
+}
+
 void
 RoutingProtocol::ClosePaymentChannelToNextHop (Ipv4Address nextHop)
 {
   NS_LOG_FUNCTION (this << nextHop);
+  std::map<Ipv4Address, uint32_t> unreachable;
+  m_routingTable.InvalidateRoutesWithNextHop (nextHop, unreachable);
+  m_routeCache.InvalidateNextHop (nextHop);
+  NS_LOG_LOGIC (unreachable.size () << " routes through " << nextHop << " invalidated");
   // record balance proof to the main chain
 }
 
@@ -252,8 +375,9 @@ RoutingProtocol::SendHello ()
   Ptr<Ipv4> ipv4 = node->GetObject<Ipv4>();
   Ipv4Address thisIpv4Address = ipv4->GetAddress(1,0).GetLocal(); //the first argument is the interface index
                                        //index = 0 returns the loopback address 127.0.0.7
-  HelloHeader HelloHeader(/*dst=*/ dst, /*dst seqno=*/ m_seqNo, /*origin=*/ thisIpv4Address, 
+  HelloHeader helloHeader(/*dst=*/ dst, /*dst seqno=*/ m_seqNo, /*origin=*/ thisIpv4Address, 
                                         /*lifetime=*/ Time (AllowedHelloLoss * HelloInterval), 0);                                       
+  helloHeader.SetCompact (CompactEncoding);
   Ptr<Packet> packet = Create<Packet> ();
   packet->AddHeader (helloHeader);
   TypeHeader tHeader (OFFCHAIN_TYPE_HELLO);
@@ -281,14 +405,21 @@ RoutingProtocol::SendHello (Ipv4Address dst, bool acked)
   Ptr<Ipv4> ipv4 = node->GetObject<Ipv4>();
   Ipv4Address thisIpv4Address = ipv4->GetAddress(1,0).GetLocal(); //the first argument is the interface index
                                        //index = 0 returns the loopback address 127.0.0.7
-  uint32_t  curDeposit = m_nb.GetChAvailDeposit();
-  if(curDeposit < 0)
-    curDeposit = m_nb.GetDefaultDeposit();
+  uint32_t curDeposit = m_nb.GetDefaultDeposit();
+  uint32_t version = 0;
+  if (m_nb.IsNeighbor (dst))
+    {
+      // reservations come and go without a new version, so they are not announced
+      curDeposit = m_nb.GetChMyBalance (dst);
+      version = m_nb.GetVersion (dst);
+    }
 
-  HelloHeader HelloHeader(/*dst=*/ dst, /*dst seqno=*/ m_seqNo, /*origin=*/ thisIpv4Address, 
-                                        /*lifetime=*/ Time (AllowedHelloLoss * HelloInterval), curDeposit);                                      
+  HelloHeader helloHeader(/*dst=*/ dst, /*dst seqno=*/ m_seqNo, /*origin=*/ thisIpv4Address, 
+                                        /*lifetime=*/ Time (AllowedHelloLoss * std::max (HelloInterval, HelloKeepalive)),
+                                        curDeposit, version);
+  helloHeader.SetCompact (CompactEncoding);
   if(acked)
-    HelloHeader.SetAckRequired(true); //set ack for requesting channel open
+    helloHeader.SetAckRequired(true); //set ack for requesting channel open
   Ptr<Packet> packet = Create<Packet> ();
   packet->AddHeader (helloHeader);
   TypeHeader tHeader (OFFCHAIN_TYPE_HELLO);
@@ -303,8 +434,13 @@ void
 RoutingProtocol::RecvHello (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address sender) 
 {
   NS_LOG_FUNCTION (this);
-  HelloHeader helloHeader;
-  p->RemoveHeader (helloHeader);
+  uint8_t buf[HelloView::MAX_SIZE];
+  HelloView helloView (buf, p->CopyData (buf, HelloView::MAX_SIZE));
+  if (!helloView.IsValid ())
+    {
+      NS_LOG_DEBUG ("Ignoring truncated HELLO");
+      return;
+    }
   Ptr<Node> node = GetNode();
   Ptr<Ipv4> ipv4 = node->GetObject<Ipv4>();
   Ipv4Address thisIpv4Address = ipv4->GetAddress(1,0).GetLocal(); //the first argument is the interface index
@@ -313,29 +449,273 @@ RoutingProtocol::RecvHello (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address sen
   if(receiver != thisIpv4Address && !m_nb.IsNeighbor (sender)) //case 1. send req to open a channel
   {
     SendHello(sender, true);
+    NotifyHelloConsistency (false);
   }
-  else if (receiver == thisIpv4Address && helloHeader.GetAckRequired()) // case 3. add it to neighbor table
+  else if (receiver == thisIpv4Address && helloView.GetAckRequired()) // case 3. add it to neighbor table
   {
-    m_nb.update(sender, helloHeader.GetAvailableDeposit(), Time (AllowedHelloLoss * HelloInterval), true);
+    m_nb.Update(sender, helloView.GetAvailableDeposit(), helloView.GetLifeTime (), true, helloView.GetVersion ());
     SendHello(sender, true);
+    NotifyHelloConsistency (false);
   }
   else if (receiver == thisIpv4Address && m_nb.IsNeighbor (sender)) //case 2
   {
-    m_nb.update(sender, helloHeader.GetAvailableDeposit(), Time (AllowedHelloLoss * HelloInterval), false); 
+    int changed = m_nb.Update(sender, helloView.GetAvailableDeposit(), helloView.GetLifeTime (), false,
+                              helloView.GetVersion ());
+    NotifyHelloConsistency (changed == 0);
   }
   
 }
 
+void
+RoutingProtocol::SendAggregatedHello ()
+{
+  NS_LOG_FUNCTION (this);
+  m_nb.Purge ();
+  // peers keep a channel alive across the keepalive gap of an idle balance
+  Time lifetime = Time (AllowedHelloLoss * std::max (HelloInterval, HelloKeepalive));
+  // balances that changed, or went unannounced for too long, decided once for all interfaces
+  std::vector<AggregatedHelloHeader::Channel> due;
+  for (uint32_t i = 0; i < m_nb.GetSize (); ++i)
+    {
+      uint32_t version;
+      if (m_nb.Announce (i, HelloKeepalive, version))
+        {
+          Ipv4Address peer = m_nb.GetNgbIPaddrByIndex (i);
+          due.push_back (AggregatedHelloHeader::Channel (peer, m_nb.GetChMyBalance (peer), version));
+        }
+    }
+  // with nothing to report a node still announces itself now and then so that peers can open channels
+  if (due.empty () && Simulator::Now () < m_nextPresenceHello)
+    return;
+  m_nextPresenceHello = Simulator::Now () + HelloKeepalive;
+
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j =
+         m_socketAddresses.begin (); j != m_socketAddresses.end (); ++j)
+    {
+      Ptr<Socket> socket = j->first;
+      Ipv4InterfaceAddress iface = j->second;
+      // room left in one datagram after the IPv4, UDP and type headers
+      uint32_t mtu = m_ipv4->GetMtu (m_ipv4->GetInterfaceForAddress (iface.GetLocal ()));
+      uint32_t budget = mtu - 20 - 8 - TypeHeader ().GetSerializedSize ();
+      Ipv4Address destination;
+      if (iface.GetMask () == Ipv4Mask::GetOnes ())
+        {
+          destination = Ipv4Address ("255.255.255.255");
+        }
+      else
+        {
+          destination = iface.GetBroadcast ();
+        }
+
+      AggregatedHelloHeader helloHeader (/*origin=*/ iface.GetLocal (), /*lifetime=*/ lifetime, /*fragment=*/ 0);
+      helloHeader.SetCompact (CompactEncoding);
+      for (uint32_t i = 0; i <= due.size (); ++i)
+        {
+          if (i < due.size ())
+            {
+              helloHeader.AddChannel (due[i].m_peer, due[i].m_availDeposit, due[i].m_version);
+              if (helloHeader.GetSerializedSize () <= budget)
+                continue;
+              helloHeader.RemoveLastChannel ();
+            }
+          Ptr<Packet> packet = Create<Packet> ();
+          packet->AddHeader (helloHeader);
+          packet->AddHeader (TypeHeader (OFFCHAIN_TYPE_HELLO_AGG));
+          NS_LOG_DEBUG ("Send aggregated HELLO fragment " << uint32_t (helloHeader.GetFragment ())
+                        << " with " << helloHeader.GetChannelCount () << " channels");
+          socket->SendTo (packet, 0, InetSocketAddress (destination, OFFCHAIN_PORT));
+          if (i < due.size ())
+            {
+              // start the next fragment with the channel that did not fit
+              helloHeader.ClearChannels ();
+              helloHeader.SetFragment (helloHeader.GetFragment () + 1);
+              helloHeader.AddChannel (due[i].m_peer, due[i].m_availDeposit, due[i].m_version);
+            }
+        }
+    }
+}
 
 void
-RoutingProtocol::SendRequest (Ipv4Address dst)
+RoutingProtocol::RecvAggregatedHello (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address sender)
 {
-  NS_LOG_FUNCTION ( this << dst);
+  NS_LOG_FUNCTION (this << receiver << sender);
+  AggregatedHelloHeader helloHeader;
+  p->RemoveHeader (helloHeader);
+
+  AggregatedHelloHeader::Channel channel (Ipv4Address (), 0, 0);
+  if (helloHeader.FindChannel (receiver, channel))
+    {
+      if (!m_nb.IsNeighbor (sender))
+        {
+          // the sender still lists a channel this node no longer has
+          NotifyHelloConsistency (false);
+          return;
+        }
+      int changed = m_nb.Update (sender, channel.m_availDeposit, helloHeader.GetLifeTime (), false, channel.m_version);
+      if (changed < 0)
+        {
+          // out of sync: send my side of the channel right away
+          SendHello (sender, false);
+        }
+      NotifyHelloConsistency (changed == 0);
+      return;
+    }
+  // no channel with the sender yet, ask to open one once per round
+  if (helloHeader.GetFragment () == 0 && !m_nb.IsNeighbor (sender))
+    {
+      SendHello (sender, true);
+      NotifyHelloConsistency (false);
+      return;
+    }
+  NotifyHelloConsistency (true);
+}
+
+void
+RoutingProtocol::NotifyHelloConsistency (bool consistent)
+{
+  if (!m_helloConsistencyCallback.IsNull ())
+    m_helloConsistencyCallback (consistent);
+}
+
+void
+RoutingProtocol::NotifyBalanceChange (Ipv4Address peer)
+{
+  NS_LOG_FUNCTION (this << peer);
+  NotifyHelloConsistency (false);
+}
+
+
+void
+RoutingProtocol::SendPacketFromQueue (Ipv4Address dst, Ptr<Ipv4Route> route)
+{
+  NS_LOG_FUNCTION (this << dst);
+  std::vector<QueueEntry> burst;
+  if (m_queue.DequeueAll (dst, burst) == 0)
+    return;
+  int32_t oif = m_ipv4->GetInterfaceForDevice (route->GetOutputDevice ());
+  uint32_t sent = 0;
+  Time oldest = Simulator::Now ();
+  for (std::vector<QueueEntry>::const_iterator i = burst.begin (); i != burst.end (); ++i)
+    {
+      DeferredRouteOutputTag tag;
+      Ptr<Packet> p = ConstCast<Packet> (i->GetPacket ());
+      if (p->RemovePacketTag (tag) &&
+          tag.GetInterface () != -1 &&
+          tag.GetInterface () != oif)
+        {
+          NS_LOG_DEBUG ("Output device doesn't match. Dropped.");
+          continue;
+        }
+      UnicastForwardCallback ucb = i->GetUnicastForwardCallback ();
+      Ipv4Header header = i->GetIpv4Header ();
+      header.SetSource (route->GetSource ());
+      header.SetTtl (header.GetTtl () + 1); // compensate extra TTL decrement by fake loopback routing
+      ucb (route, p, header);
+      sent++;
+      oldest = std::min (oldest, i->GetQueuedTime ());
+    }
+  NS_LOG_LOGIC ("Forwarded " << sent << " of " << burst.size () << " queued packets to " << dst);
+  m_queueFlushTrace (dst, sent, Simulator::Now () - oldest);
+}
+
+void
+RoutingProtocol::DeferredRouteOutput (Ptr<const Packet> p, const Ipv4Header & header,
+                                      UnicastForwardCallback ucb, ErrorCallback ecb)
+{
+  NS_LOG_FUNCTION (this << p << header);
+  NS_ASSERT (p != 0 && p != Ptr<Packet> ());
+
+  QueueEntry newEntry (p, header, ucb, ecb);
+  // fee and deadline rank the payment in the queue, the amount sizes the route search
+  PaymentTag payment;
+  p->PeekPacketTag (payment);
+  newEntry.SetFee (payment.GetFee ());
+  newEntry.SetDeadline (payment.GetDeadline ());
+  if (!m_queue.Enqueue (newEntry))
+    return;
+  NS_LOG_LOGIC ("Add packet " << p->GetUid () << " to queue. Protocol " << (uint16_t) header.GetProtocol ());
+  RoutingTableEntry const * rt = m_routingTable.FindRoute (header.GetDestination ());
+  if (rt == 0 || rt->GetFlag () != IN_SEARCH)
+    {
+      NS_LOG_LOGIC ("Send new RREQ for outbound packet to " << header.GetDestination ());
+      SendRequest (header.GetDestination (), payment.GetAmount ());
+    }
+}
+
+void
+RoutingProtocol::NotifyPaymentDelivered (Ipv4Address dst, uint32_t amount)
+{
+  NS_LOG_FUNCTION (this << dst << amount);
+  // a payment split over several paths leaves nothing to cache
+  RoutePath path;
+  if (m_routingTable.SelectPath (dst, amount, path))
+    m_routeCache.Insert (dst, amount, path);
+}
+
+bool
+RoutingProtocol::UseCachedRoute (Ipv4Address dst, uint32_t amount)
+{
+  RoutePath path;
+  if (!m_routeCache.Lookup (dst, amount, path))
+    return false;
+  Time lifetime = path.m_expire - Simulator::Now ();
+  // a valid route keeps its state and gains the cached path
+  if (m_routingTable.AddPath (dst, path.m_nextHop, path.m_hops, path.m_capacity, lifetime))
+    return true;
+  RoutingTableEntry * rt = m_routingTable.FindRoute (dst);
+  if (rt != 0 && rt->GetFlag () == VALID)
+    {
+      // the paths of a valid route are kept, even when the cached one found no room among them
+      NS_LOG_LOGIC ("No room for the cached path to " << dst << " next to the valid route");
+      return false;
+    }
+  // channels run over the first non-loopback interface, as in SendHello
+  Ptr<NetDevice> dev = m_ipv4->GetNetDevice (1);
+  if (rt == 0)
+    {
+      RoutingTableEntry newEntry (/*device=*/ dev, /*dst=*/ dst, /*validSeqNo=*/ false, /*seqno=*/ 0,
+                                  /*iface=*/ m_ipv4->GetAddress (1, 0), /*hop=*/ path.m_hops,
+                                  /*transAmount=*/ path.m_capacity, /*nextHop=*/ path.m_nextHop, /*lifeTime=*/ lifetime);
+      return m_routingTable.AddRoute (newEntry);
+    }
+  // an IN_SEARCH placeholder from SendRequest has neither device nor interface
+  rt->SetOutputDevice (dev);
+  rt->SetInterface (m_ipv4->GetAddress (1, 0));
+  rt->SetNextHop (path.m_nextHop);
+  rt->SetHop (path.m_hops);
+  rt->SetTransAmount (path.m_capacity);
+  rt->SetLifeTime (lifetime);
+  rt->SetFlag (VALID);
+  m_routingTable.UpdateInPlace (rt);
+  return true;
+}
+
+void
+RoutingProtocol::SendRequest (Ipv4Address dst, uint32_t amount)
+{
+  NS_LOG_FUNCTION ( this << dst << amount);
+  // a payment too large for any single path goes out in shares over several
+  std::vector<std::pair<Ipv4Address, uint32_t> > shares;
+  if (amount > 0 && m_routingTable.SplitAmount (dst, amount, shares))
+    {
+      NS_LOG_DEBUG ("Paths to " << dst << " carry " << amount << " in " << shares.size () << " shares, no RREQ");
+      return;
+    }
+  if (amount > 0 && UseCachedRoute (dst, amount))
+    {
+      NS_LOG_DEBUG ("Cached path to " << dst << " carries " << amount << ", no RREQ");
+      return;
+    }
+  if (RreqBatchWindow > Seconds (0))
+    {
+      QueueRequest (dst, amount);
+      return;
+    }
   // A node SHOULD NOT originate more than RREQ_RATELIMIT RREQ messages per second.
   if (m_rreqCount == RreqRateLimit)
     {
       Simulator::Schedule (m_rreqRateLimitTimer.GetDelayLeft () + MicroSeconds (100),
-                           &RoutingProtocol::SendRequest, this, dst);
+                           &RoutingProtocol::SendRequest, this, dst, amount);
       return;
     }
   else
@@ -343,28 +723,13 @@ RoutingProtocol::SendRequest (Ipv4Address dst)
   // Create RREQ header
   RreqHeader rreqHeader;
   rreqHeader.SetDst (dst);
+  rreqHeader.SetTransAmount (amount);
 
-  RoutingTableEntry rt;
-  if (m_routingTable.LookupRoute (dst, rt))
-    {
-      rreqHeader.SetHopCount (rt.GetHop ());
-      if (rt.GetValidSeqNo ())
-        rreqHeader.SetDstSeqno (rt.GetSeqNo ());
-      else
-        rreqHeader.SetUnknownSeqno (true);
-      rt.SetFlag (IN_SEARCH);
-      m_routingTable.Update (rt);
-    }
+  uint32_t dstSeqNo = 0;
+  if (StartRouteSearch (dst, dstSeqNo))
+    rreqHeader.SetDstSeqno (dstSeqNo);
   else
-    {
-      rreqHeader.SetUnknownSeqno (true);
-      Ptr<NetDevice> dev = 0;
-      RoutingTableEntry newEntry (/*device=*/ dev, /*dst=*/ dst, /*validSeqNo=*/ false, /*seqno=*/ 0,
-                                              /*iface=*/ Ipv4InterfaceAddress (),/*hop=*/ 0,
-                                              /*nextHop=*/ Ipv4Address (), /*lifeTime=*/ Seconds (0));
-      newEntry.SetFlag (IN_SEARCH);
-      m_routingTable.AddRoute (newEntry);
-    }
+    rreqHeader.SetUnknownSeqno (true);
 
   if (GratuitousReply)
     rreqHeader.SetGratiousRrep (true);
@@ -376,6 +741,7 @@ RoutingProtocol::SendRequest (Ipv4Address dst)
   m_requestId++;
   rreqHeader.SetId (m_requestId);
   rreqHeader.SetHopCount (0);
+  rreqHeader.SetCompact (CompactEncoding);
 
   // Send RREQ as subnet directed broadcast from each interface used by aodv
   for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j =
@@ -415,44 +781,130 @@ RoutingProtocol::SendRequest (Ipv4Address dst)
     }
 }
 
+bool
+RoutingProtocol::StartRouteSearch (Ipv4Address dst, uint32_t & dstSeqNo)
+{
+  RoutingTableEntry * rt = m_routingTable.FindRoute (dst);
+  if (rt == 0)
+    {
+      Ptr<NetDevice> dev = 0;
+      RoutingTableEntry newEntry (/*device=*/ dev, /*dst=*/ dst, /*validSeqNo=*/ false, /*seqno=*/ 0,
+                                              /*iface=*/ Ipv4InterfaceAddress (),/*hop=*/ 0, /*transAmount=*/ 0,
+                                              /*nextHop=*/ Ipv4Address (), /*lifeTime=*/ Seconds (0));
+      newEntry.SetFlag (IN_SEARCH);
+      m_routingTable.AddRoute (newEntry);
+      return false;
+    }
+  rt->SetFlag (IN_SEARCH);
+  m_routingTable.UpdateInPlace (rt);
+  if (!rt->GetValidSeqNo ())
+    return false;
+  dstSeqNo = rt->GetSeqNo ();
+  return true;
+}
 
 void
-RoutingProtocol::RecvRReq (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src)
+RoutingProtocol::QueueRequest (Ipv4Address dst, uint32_t amount)
 {
-  NS_LOG_FUNCTION (this);
-  RreqHeader rreqHeader;
-  p->RemoveHeader (rreqHeader);
+  NS_LOG_FUNCTION (this << dst << amount);
+  std::map<Ipv4Address, uint32_t>::iterator i = m_rreqBatch.find (dst);
+  if (i != m_rreqBatch.end ())
+    {
+      // one route must carry the largest payment waiting for it
+      i->second = std::max (i->second, amount);
+      return;
+    }
+  m_rreqBatch.insert (std::make_pair (dst, amount));
+  if (m_rreqBatch.size () >= RreqBatchSize)
+    {
+      m_rreqBatchEvent.Cancel ();
+      SendBatchedRequest ();
+    }
+  else if (!m_rreqBatchEvent.IsRunning ())
+    m_rreqBatchEvent = Simulator::Schedule (RreqBatchWindow, &RoutingProtocol::SendBatchedRequest, this);
+}
 
-  // A node ignores all RREQs received from any node in its blacklist
-  RoutingTableEntry toPrev;
-  if (m_routingTable.LookupRoute (src, toPrev))
+void
+RoutingProtocol::SendBatchedRequest ()
+{
+  NS_LOG_FUNCTION (this << m_rreqBatch.size ());
+  while (!m_rreqBatch.empty ())
     {
-      if (toPrev.IsUnidirectional ())
+      // a batch counts as one RREQ against the rate limit
+      if (m_rreqCount == RreqRateLimit)
         {
-          NS_LOG_DEBUG ("Ignoring RREQ from node in blacklist");
+          m_rreqBatchEvent = Simulator::Schedule (m_rreqRateLimitTimer.GetDelayLeft () + MicroSeconds (100),
+                                                  &RoutingProtocol::SendBatchedRequest, this);
           return;
         }
-    }
+      m_rreqCount++;
 
-  uint32_t id = rreqHeader.GetId ();
-  Ipv4Address origin = rreqHeader.GetOrigin ();
+      BatchedRreqHeader rreqHeader;
+      std::vector<Ipv4Address> searched;
+      std::map<Ipv4Address, uint32_t>::iterator i = m_rreqBatch.begin ();
+      while (i != m_rreqBatch.end () && searched.size () < RreqBatchSize)
+        {
+          uint32_t dstSeqNo = 0;
+          bool known = StartRouteSearch (i->first, dstSeqNo);
+          rreqHeader.AddDestination (i->first, dstSeqNo, i->second, !known);
+          searched.push_back (i->first);
+          m_rreqBatch.erase (i++);
+        }
+      if (GratuitousReply)
+        rreqHeader.SetGratiousRrep (true);
+      if (DestinationOnly)
+        rreqHeader.SetDestinationOnly (true);
 
-  /*
-   *  Node checks to determine whether it has received a RREQ with the same Originator IP Address and RREQ ID.
-   *  If such a RREQ has been received, the node silently discards the newly received RREQ.
-   */
-  if (m_rreqIdCache.IsDuplicate (origin, id))
+      m_seqNo++;
+      rreqHeader.SetOriginSeqno (m_seqNo);
+      m_requestId++;
+      rreqHeader.SetId (m_requestId);
+      rreqHeader.SetCompact (CompactEncoding);
+
+      for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j =
+             m_socketAddresses.begin (); j != m_socketAddresses.end (); ++j)
+        {
+          Ptr<Socket> socket = j->first;
+          Ipv4InterfaceAddress iface = j->second;
+
+          rreqHeader.SetOrigin (iface.GetLocal ());
+          m_rreqIdCache.IsDuplicate (iface.GetLocal (), m_requestId);
+
+          Ptr<Packet> packet = Create<Packet> ();
+          packet->AddHeader (rreqHeader);
+          packet->AddHeader (TypeHeader (OFFCHAIN_TYPE_RREQ_BATCH));
+          // Send to all-hosts broadcast if on /32 addr, subnet-directed otherwise
+          Ipv4Address destination;
+          if (iface.GetMask () == Ipv4Mask::GetOnes ())
+            {
+              destination = Ipv4Address ("255.255.255.255");
+            }
+          else
+            {
+              destination = iface.GetBroadcast ();
+            }
+          NS_LOG_DEBUG ("Send batched RREQ with id " << rreqHeader.GetId () << " for "
+                        << rreqHeader.GetDestinationCount () << " destinations to socket");
+          socket->SendTo (packet, 0, InetSocketAddress (destination, OFFCHAIN_PORT));
+        }
+      // retries go through SendRequest and batch again with other expiring searches
+      for (std::vector<Ipv4Address>::const_iterator d = searched.begin (); d != searched.end (); ++d)
+        ScheduleRreqRetry (*d);
+    }
+  if (EnableHello)
     {
-      NS_LOG_DEBUG ("Ignoring RREQ due to duplicate");
-      return;
+      if (!m_htimer.IsRunning ())
+        {
+          m_htimer.Cancel ();
+          m_htimer.Schedule (HelloInterval - Time (0.01 * MilliSeconds (m_uniformRandomVariable->GetInteger (0, 10))));
+        }
     }
+}
 
-  // Increment RREQ hop count
-  uint8_t hop = rreqHeader.GetHopCount () + 1;
-  rreqHeader.SetHopCount (hop);
-
-  // transaction amount
-  uint32_t amount = rreqHeader.GetTransAmount ();
+RoutingTableEntry *
+RoutingProtocol::UpdateReverseRoute (Ipv4Address origin, uint32_t originSeqNo, uint8_t hop, uint32_t amount,
+                                     Ipv4Address receiver, Ipv4Address src)
+{
   /*
    *  When the reverse route is created or updated, the following actions on the route are also carried out:
    *  1. the Originator Sequence Number from the RREQ is compared to the corresponding destination sequence number
@@ -463,61 +915,115 @@ RoutingProtocol::RecvRReq (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src)
    *  5. the Lifetime is set to be the maximum of (ExistingLifetime, MinimalLifetime), where
    *     MinimalLifetime = current time + 2*NetTraversalTime - 2*HopCount*NodeTraversalTime
    */
-  RoutingTableEntry toOrigin;
-  if (!m_routingTable.LookupRoute (origin, toOrigin))
+  RoutingTableEntry * toOrigin = m_routingTable.FindRoute (origin);
+  if (toOrigin == 0)
     {
-      RoutingTableEntry newEntry (/*dst=*/ origin, /*validSeno=*/ true, /*seqNo=*/ rreqHeader.GetOriginSeqno (),
+      Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (receiver));
+      RoutingTableEntry newEntry (/*device=*/ dev, /*dst=*/ origin, /*validSeno=*/ true, /*seqNo=*/ originSeqNo,
                                               /*iface=*/ m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0), /*hops=*/ hop,
                                               /*transaction*/ amount, /*nextHop*/ src, /*timeLife=*/ Time ((2 * NetTraversalTime - 2 * hop * NodeTraversalTime)));
       m_routingTable.AddRoute (newEntry);
+      return m_routingTable.FindRoute (origin);
+    }
+  if (toOrigin->GetValidSeqNo ())
+    {
+      if (int32_t (originSeqNo) - int32_t (toOrigin->GetSeqNo ()) > 0)
+        toOrigin->SetSeqNo (originSeqNo);
     }
   else
+    toOrigin->SetSeqNo (originSeqNo);
+  toOrigin->SetValidSeqNo (true);
+  toOrigin->SetNextHop (src);
+  toOrigin->SetOutputDevice (m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (receiver)));
+  toOrigin->SetInterface (m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0));
+  toOrigin->SetHop (hop);
+  toOrigin->SetTransAmount (amount);
+  toOrigin->SetLifeTime (std::max (Time (2 * NetTraversalTime - 2 * hop * NodeTraversalTime),
+                                   toOrigin->GetLifeTime ()));
+  m_routingTable.UpdateInPlace (toOrigin);
+  return toOrigin;
+}
+
+void
+RoutingProtocol::RecvRReq (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src)
+{
+  NS_LOG_FUNCTION (this);
+
+  // A node ignores all RREQs received from any node in its blacklist
+  RoutingTableEntry const * toPrev = m_routingTable.FindRoute (src);
+  if (toPrev != 0 && toPrev->IsUnidirectional ())
     {
-      if (toOrigin.GetValidSeqNo ())
-        {
-          if (int32_t (rreqHeader.GetOriginSeqno ()) - int32_t (toOrigin.GetSeqNo ()) > 0)
-            toOrigin.SetSeqNo (rreqHeader.GetOriginSeqno ());
-        }
-      else
-        toOrigin.SetSeqNo (rreqHeader.GetOriginSeqno ());
-      toOrigin.SetValidSeqNo (true);
-      toOrigin.SetNextHop (src);
-      toOrigin.SetOutputDevice (m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (receiver)));
-      toOrigin.SetInterface (m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0));
-      toOrigin.SetHop (hop);
-      toOrigin.SetTransAmount (amount);
-      toOrigin.SetLifeTime (std::max (Time (2 * NetTraversalTime - 2 * hop * NodeTraversalTime),
-                                      toOrigin.GetLifeTime ()));
-      m_routingTable.Update (toOrigin);
-    }
-  NS_LOG_LOGIC (receiver << " receive RREQ with hop count " << static_cast<uint32_t>(rreqHeader.GetHopCount ()) 
-                         << " ID " << rreqHeader.GetId ()
-                         << " to destination " << rreqHeader.GetDst ()
-                         << " Transaction amount " << rreqHeader.GetTransAmount ());
+      NS_LOG_DEBUG ("Ignoring RREQ from node in blacklist");
+      return;
+    }
+
+  // Serialized RREQ behind a type byte, as it is forwarded. The header is
+  // read through a view in the layout it arrived in and only deserialized
+  // when a reply is sent.
+  uint8_t buf[1 + RreqView::MAX_SIZE];
+  RreqView rreqView (buf + 1, p->CopyData (buf + 1, RreqView::MAX_SIZE));
+  if (!rreqView.IsValid ())
+    {
+      NS_LOG_DEBUG ("Ignoring truncated RREQ");
+      return;
+    }
+
+  uint32_t id = rreqView.GetId ();
+  Ipv4Address origin = rreqView.GetOrigin ();
+  if (m_dpd.IsDuplicate (OFFCHAIN_TYPE_RREQ, origin, id, rreqView.GetDstSeqno (), src, p->GetUid ()))
+    {
+      NS_LOG_DEBUG ("Ignoring RREQ copy found by duplicate packet detection");
+      return;
+    }
+
+  /*
+   *  Node checks to determine whether it has received a RREQ with the same Originator IP Address and RREQ ID.
+   *  If such a RREQ has been received, the node silently discards the newly received RREQ.
+   */
+  if (m_rreqIdCache.IsDuplicate (origin, id))
+    {
+      NS_LOG_DEBUG ("Ignoring RREQ due to duplicate");
+      return;
+    }
+
+  // Increment RREQ hop count
+  uint8_t hop = rreqView.GetHopCount () + 1;
+  RreqView::SetHopCount (buf + 1, hop);
+
+  // transaction amount
+  uint32_t amount = rreqView.GetTransAmount ();
+  RoutingTableEntry * toOrigin = UpdateReverseRoute (origin, rreqView.GetOriginSeqno (), hop, amount,
+                                                     receiver, src);
+  NS_LOG_LOGIC (receiver << " receive RREQ with hop count " << static_cast<uint32_t>(hop)
+                         << " ID " << id
+                         << " to destination " << rreqView.GetDst ()
+                         << " Transaction amount " << amount);
 
   //  A node generates a RREP if either:
   //  (i)  it is itself the destination,
-  if (IsMyOwnAddress (rreqHeader.GetDst ()))
+  if (IsMyOwnAddress (rreqView.GetDst ()))
     {
-      m_routingTable.LookupRoute (origin, toOrigin);
       NS_LOG_DEBUG ("Send reply since I am the destination");
-      SendReply (rreqHeader, toOrigin);
+      RreqHeader rreqHeader;
+      p->RemoveHeader (rreqHeader);
+      rreqHeader.SetHopCount (hop);
+      SendReply (rreqHeader, *toOrigin);
       return;
     }
   /*
    * (ii) or it has an active route to the destination, the destination sequence number in the node's existing route table entry for the destination
    *      is valid and greater than or equal to the Destination Sequence Number of the RREQ, and the "destination only" flag is NOT set.
    */
-  RoutingTableEntry toDst;
-  Ipv4Address dst = rreqHeader.GetDst ();
-  if (m_routingTable.LookupRoute (dst, toDst))
+  Ipv4Address dst = rreqView.GetDst ();
+  RoutingTableEntry * toDst = m_routingTable.FindRoute (dst);
+  if (toDst != 0)
     {
       /*
        * Drop RREQ, This node RREP wil make a loop.
        */
-      if (toDst.GetNextHop () == src)
+      if (toDst->GetNextHop () == src)
         {
-          NS_LOG_DEBUG ("Drop RREQ from " << src << ", dest next hop " << toDst.GetNextHop ());
+          NS_LOG_DEBUG ("Drop RREQ from " << src << ", dest next hop " << toDst->GetNextHop ());
           return;
         }
       /*
@@ -526,29 +1032,42 @@ RoutingProtocol::RecvRReq (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src)
        * However, the forwarding node MUST NOT modify its maintained value for the destination sequence number, even if the value
        * received in the incoming RREQ is larger than the value currently maintained by the forwarding node.
        */
-      if ((rreqHeader.GetUnknownSeqno () || (int32_t (toDst.GetSeqNo ()) - int32_t (rreqHeader.GetDstSeqno ()) >= 0))
-          && toDst.GetValidSeqNo () )
+      if ((rreqView.GetUnknownSeqno () || (int32_t (toDst->GetSeqNo ()) - int32_t (rreqView.GetDstSeqno ()) >= 0))
+          && toDst->GetValidSeqNo () )
         {
-          if (!rreqHeader.GetDestinationOnly () && toDst.GetFlag () == VALID)
+          if (!rreqView.GetDestinationOnly () && toDst->GetFlag () == VALID)
             {
-              m_routingTable.LookupRoute (origin, toOrigin);
-              SendReplyByIntermediateNode (toDst, toOrigin, rreqHeader.GetGratiousRrep ());
+              SendReplyByIntermediateNode (*toDst, *toOrigin, rreqView.GetGratiousRrep ());
               return;
             }
-          rreqHeader.SetDstSeqno (toDst.GetSeqNo ());
-          rreqHeader.SetUnknownSeqno (false);
+          if (RreqView::IsCompact (buf + 1))
+            {
+              // a compact sequence number may change size, re-encode the header
+              RreqHeader rreqHeader;
+              Ptr<Packet> compact = Create<Packet> (buf + 1, rreqView.GetSerializedSize ());
+              compact->RemoveHeader (rreqHeader);
+              rreqHeader.SetDstSeqno (toDst->GetSeqNo ());
+              rreqHeader.SetUnknownSeqno (false);
+              compact->AddHeader (rreqHeader);
+              rreqView = RreqView (buf + 1, compact->CopyData (buf + 1, RreqView::MAX_SIZE));
+            }
+          else
+            {
+              RreqView::SetDstSeqno (buf + 1, toDst->GetSeqNo ());
+              RreqView::SetUnknownSeqno (buf + 1, false);
+            }
         }
     }
 
+  // forward the received bytes with the updated fields, in the encoding the originator chose
+  buf[0] = OFFCHAIN_TYPE_RREQ;
+  Ptr<Packet> forward = Create<Packet> (buf, 1 + rreqView.GetSerializedSize ());
   for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j =
          m_socketAddresses.begin (); j != m_socketAddresses.end (); ++j)
     {
       Ptr<Socket> socket = j->first;
       Ipv4InterfaceAddress iface = j->second;
-      Ptr<Packet> packet = Create<Packet> ();
-      packet->AddHeader (rreqHeader);
-      TypeHeader tHeader (AODVTYPE_RREQ);
-      packet->AddHeader (tHeader);
+      Ptr<Packet> packet = forward->Copy ();
       // Send to all-hosts broadcast if on /32 addr, subnet-directed otherwise
       Ipv4Address destination;
       if (iface.GetMask () == Ipv4Mask::GetOnes ())
@@ -559,7 +1078,7 @@ RoutingProtocol::RecvRReq (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src)
         { 
           destination = iface.GetBroadcast ();
         }
-      socket->SendTo (packet, 0, InetSocketAddress (destination, AODV_PORT));
+      socket->SendTo (packet, 0, InetSocketAddress (destination, OFFCHAIN_PORT));
     }
 
   if (EnableHello)
@@ -573,6 +1092,238 @@ RoutingProtocol::RecvRReq (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src)
 }
 
 
+void
+RoutingProtocol::RecvRRep (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address sender)
+{
+  NS_LOG_FUNCTION (this << " src " << sender);
+  // a compact header is at least as long as one whose varints are all zero
+  uint8_t flags = 0;
+  p->CopyData (&flags, 1);
+  RrepHeader rrepHeader;
+  rrepHeader.SetCompact (RreqView::IsCompact (&flags));
+  if (p->GetSize () < rrepHeader.GetSerializedSize ())
+    {
+      NS_LOG_DEBUG ("Ignoring truncated RREP");
+      return;
+    }
+  p->RemoveHeader (rrepHeader);
+  Ipv4Address dst = rrepHeader.GetDst ();
+  NS_LOG_LOGIC ("RREP destination " << dst << " RREP origin " << rrepHeader.GetOrigin ());
+
+  // payments follow the reply back, a reply from a peer without a channel leads nowhere
+  if (!m_nb.IsNeighbor (sender))
+    {
+      NS_LOG_DEBUG ("Ignoring RREP from " << sender << ", no payment channel");
+      return;
+    }
+  uint8_t hop = rrepHeader.GetHopCount () + 1;
+  rrepHeader.SetHopCount (hop);
+  // the channel to the sender is the first hop of the path from here
+  uint32_t capacity = std::min (m_nb.GetChMyAvailDeposit (sender), rrepHeader.GetCapacity ());
+  rrepHeader.SetCapacity (capacity);
+
+  /*
+   * The forward route is created or updated if (i) there is none, (ii) its sequence number is unknown or
+   * older than the one of the RREP, (iii) it is not valid, or (iv) the sequence numbers match and the
+   * RREP comes over fewer hops. An existing entry is updated in place, it keeps its precursors and
+   * alternative paths.
+   */
+  Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (receiver));
+  Ipv4InterfaceAddress iface = m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0);
+  RoutingTableEntry * toDst = m_routingTable.FindRoute (dst);
+  if (toDst == 0)
+    {
+      RoutingTableEntry newEntry (/*device=*/ dev, /*dst=*/ dst, /*validSeqNo=*/ true, /*seqno=*/ rrepHeader.GetDstSeqno (),
+                                  /*iface=*/ iface, /*hop=*/ hop, /*transAmount=*/ capacity, /*nextHop=*/ sender,
+                                  /*lifeTime=*/ rrepHeader.GetLifeTime ());
+      m_routingTable.AddRoute (newEntry);
+    }
+  else if (!toDst->GetValidSeqNo ()
+           || int32_t (rrepHeader.GetDstSeqno ()) - int32_t (toDst->GetSeqNo ()) > 0
+           || toDst->GetFlag () != VALID
+           || (rrepHeader.GetDstSeqno () == toDst->GetSeqNo () && hop < toDst->GetHop ()))
+    {
+      // the sender becomes the primary next hop, it is no alternative any more
+      toDst->DeleteAlternatePaths (sender);
+      toDst->SetValidSeqNo (true);
+      toDst->SetSeqNo (rrepHeader.GetDstSeqno ());
+      toDst->SetOutputDevice (dev);
+      toDst->SetInterface (iface);
+      toDst->SetNextHop (sender);
+      toDst->SetHop (hop);
+      toDst->SetTransAmount (capacity);
+      toDst->SetLifeTime (rrepHeader.GetLifeTime ());
+      toDst->SetFlag (VALID);
+      m_routingTable.UpdateInPlace (toDst);
+    }
+  else if (sender != toDst->GetNextHop ())
+    {
+      // a reply over another channel gives payments to dst an alternative path
+      m_routingTable.AddPath (dst, sender, hop, capacity, rrepHeader.GetLifeTime ());
+    }
+  std::map<Ipv4Address, Timer>::iterator timer = m_addressReqTimer.find (dst);
+  if (timer != m_addressReqTimer.end ())
+    {
+      timer->second.Cancel ();
+      m_addressReqTimer.erase (timer);
+    }
+  toDst = m_routingTable.FindRoute (dst);
+
+  if (IsMyOwnAddress (rrepHeader.GetOrigin ()))
+    {
+      // later payments to dst within the bottleneck reuse the path without a RREQ,
+      // also once the route itself has expired
+      m_routeCache.Insert (dst, capacity, RoutePath (sender, hop, capacity));
+      // the route is established, release the payments waiting for it
+      SendPacketFromQueue (dst, toDst->GetRoute ());
+      return;
+    }
+
+  RoutingTableEntry * toOrigin = m_routingTable.FindRoute (rrepHeader.GetOrigin ());
+  if (toOrigin == 0 || toOrigin->GetFlag () == IN_SEARCH)
+    {
+      return; // Impossible! drop.
+    }
+  toOrigin->SetLifeTime (std::max (ActiveRouteTimeout, toOrigin->GetLifeTime ()));
+  m_routingTable.UpdateInPlace (toOrigin);
+
+  // Update information about precursors
+  toDst->InsertPrecursor (toOrigin->GetNextHop ());
+  toOrigin->InsertPrecursor (toDst->GetNextHop ());
+
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (rrepHeader);
+  TypeHeader tHeader (OFFCHAIN_TYPE_RREP);
+  packet->AddHeader (tHeader);
+  Ptr<Socket> socket = FindSocketWithInterfaceAddress (toOrigin->GetInterface ());
+  NS_ASSERT (socket);
+  socket->SendTo (packet, 0, InetSocketAddress (toOrigin->GetNextHop (), OFFCHAIN_PORT));
+}
+
+
+
+void
+RoutingProtocol::RecvBatchedRReq (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src)
+{
+  NS_LOG_FUNCTION (this);
+
+  // A node ignores all RREQs received from any node in its blacklist
+  RoutingTableEntry const * toPrev = m_routingTable.FindRoute (src);
+  if (toPrev != 0 && toPrev->IsUnidirectional ())
+    {
+      NS_LOG_DEBUG ("Ignoring RREQ from node in blacklist");
+      return;
+    }
+
+  BatchedRreqHeader rreqHeader;
+  p->RemoveHeader (rreqHeader);
+  uint32_t id = rreqHeader.GetId ();
+  Ipv4Address origin = rreqHeader.GetOrigin ();
+  // copies of one flood may carry different subsets of the destinations, the content key ignores them
+  if (m_dpd.IsDuplicate (OFFCHAIN_TYPE_RREQ_BATCH, origin, id, 0, src, p->GetUid ()))
+    {
+      NS_LOG_DEBUG ("Ignoring RREQ copy found by duplicate packet detection");
+      return;
+    }
+  if (m_rreqIdCache.IsDuplicate (origin, id))
+    {
+      NS_LOG_DEBUG ("Ignoring RREQ due to duplicate");
+      return;
+    }
+
+  uint8_t hop = rreqHeader.GetHopCount () + 1;
+  rreqHeader.SetHopCount (hop);
+  // the reverse route must carry the largest payment searched for
+  uint32_t amount = 0;
+  for (uint32_t n = 0; n < rreqHeader.GetDestinationCount (); ++n)
+    amount = std::max (amount, rreqHeader.GetDestination (n).m_transAmount);
+  UpdateReverseRoute (origin, rreqHeader.GetOriginSeqno (), hop, amount, receiver, src);
+  NS_LOG_LOGIC (receiver << " receive batched RREQ with hop count " << static_cast<uint32_t>(hop)
+                         << " ID " << id
+                         << " for " << rreqHeader.GetDestinationCount () << " destinations");
+
+  // reply for the destinations this node can answer for, as RecvRReq does, forward the rest
+  BatchedRreqHeader forward (hop, id, origin, rreqHeader.GetOriginSeqno ());
+  forward.SetGratiousRrep (rreqHeader.GetGratiousRrep ());
+  forward.SetDestinationOnly (rreqHeader.GetDestinationOnly ());
+  for (uint32_t n = 0; n < rreqHeader.GetDestinationCount (); ++n)
+    {
+      BatchedRreqHeader::Destination d = rreqHeader.GetDestination (n);
+      // looked up again for every reply, a reply may add routes
+      RoutingTableEntry * toOrigin = m_routingTable.FindRoute (origin);
+      if (toOrigin == 0)
+        {
+          // expired or purged meanwhile, no reply could reach the origin
+          NS_LOG_DEBUG ("No reverse route to " << origin << ", dropping RREQ " << id);
+          return;
+        }
+      if (IsMyOwnAddress (d.m_dst))
+        {
+          NS_LOG_DEBUG ("Send reply since I am the destination");
+          SendReply (rreqHeader.GetRequest (n), *toOrigin);
+          continue;
+        }
+      RoutingTableEntry * toDst = m_routingTable.FindRoute (d.m_dst);
+      if (toDst != 0)
+        {
+          if (toDst->GetNextHop () == src)
+            {
+              NS_LOG_DEBUG ("Drop " << d.m_dst << " from RREQ of " << src << ", dest next hop " << toDst->GetNextHop ());
+              continue;
+            }
+          if ((d.m_unknownSeqNo || (int32_t (toDst->GetSeqNo ()) - int32_t (d.m_dstSeqNo) >= 0))
+              && toDst->GetValidSeqNo ())
+            {
+              if (!rreqHeader.GetDestinationOnly () && toDst->GetFlag () == VALID)
+                {
+                  SendReplyByIntermediateNode (*toDst, *toOrigin, rreqHeader.GetGratiousRrep ());
+                  continue;
+                }
+              d.m_dstSeqNo = toDst->GetSeqNo ();
+              d.m_unknownSeqNo = false;
+            }
+        }
+      forward.AddDestination (d.m_dst, d.m_dstSeqNo, d.m_transAmount, d.m_unknownSeqNo);
+    }
+  if (forward.GetDestinationCount () == 0)
+    {
+      NS_LOG_DEBUG ("Answered for every destination of RREQ " << id);
+      return;
+    }
+
+  // forwarded in the encoding the originator chose, as RecvRReq does
+  forward.SetCompact (rreqHeader.IsCompact ());
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (forward);
+  packet->AddHeader (TypeHeader (OFFCHAIN_TYPE_RREQ_BATCH));
+  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j =
+         m_socketAddresses.begin (); j != m_socketAddresses.end (); ++j)
+    {
+      Ptr<Socket> socket = j->first;
+      Ipv4InterfaceAddress iface = j->second;
+      // Send to all-hosts broadcast if on /32 addr, subnet-directed otherwise
+      Ipv4Address destination;
+      if (iface.GetMask () == Ipv4Mask::GetOnes ())
+        {
+          destination = Ipv4Address ("255.255.255.255");
+        }
+      else
+        {
+          destination = iface.GetBroadcast ();
+        }
+      socket->SendTo (packet->Copy (), 0, InetSocketAddress (destination, OFFCHAIN_PORT));
+    }
+
+  if (EnableHello)
+    {
+      if (!m_htimer.IsRunning ())
+        {
+          m_htimer.Cancel ();
+          m_htimer.Schedule (HelloInterval - Time (0.1 * MilliSeconds (m_uniformRandomVariable->GetInteger (0, 10))));
+        }
+    }
+}
+
 
 } /*offchain*/
 } /*ns3*/
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include "ns3/ipv4-routing-protocol.h"
 #include "ns3/ipv4-interface.h"
 #include "ns3/ipv4-l3-protocol.h"
+#include "ns3/traced-callback.h"
 #include <map>
 
 namespace ns3
@@ -50,6 +51,8 @@ public:
   void SetMaxQueueTime (Time t);
   uint32_t GetMaxQueueLen () const { return MaxQueueLen; }
   void SetMaxQueueLen (uint32_t len);
+  RequestQueue::Policy GetQueuePolicy () const { return m_queue.GetPolicy (); }
+  void SetQueuePolicy (RequestQueue::Policy policy) { m_queue.SetPolicy (policy); }
   bool GetDesinationOnlyFlag () const { return DestinationOnly; }
   void SetDesinationOnlyFlag (bool f) { DestinationOnly = f; }
   bool GetGratuitousReplyFlag () const { return GratuitousReply; }
@@ -58,7 +61,29 @@ public:
   bool GetHelloEnable () const { return EnableHello; }
   void SetBroadcastEnable (bool f) { EnableBroadcast = f; }
   bool GetBroadcastEnable () const { return EnableBroadcast; }
-  void SetNeighborTable(Neighbors t) {m_nb =t; }
+  void SetCompactEncoding (bool f) { CompactEncoding = f; }
+  bool GetCompactEncoding () const { return CompactEncoding; }
+  void SetNeighborTable (Neighbors t);
+  uint32_t GetMaxPaths () const { return m_routingTable.GetMaxPaths (); }
+  void SetMaxPaths (uint32_t n) { m_routingTable.SetMaxPaths (n); }
+  uint32_t GetRouteCacheSize () const { return m_routeCache.GetMaxEntries (); }
+  void SetRouteCacheSize (uint32_t n) { m_routeCache.SetMaxEntries (n); }
+  Time GetRouteCacheTimeout () const { return m_routeCache.GetTimeout (); }
+  void SetRouteCacheTimeout (Time t) { m_routeCache.SetTimeout (t); }
+  RouteCache const & GetRouteCache () const { return m_routeCache; }
+  DuplicatePacketDetection::Key GetDpdKey () const { return m_dpd.GetKey (); }
+  void SetDpdKey (DuplicatePacketDetection::Key key) { m_dpd.SetKey (key); }
+  DuplicatePacketDetection::Mode GetDpdMode () const { return m_dpd.GetMode (); }
+  void SetDpdMode (DuplicatePacketDetection::Mode mode) { m_dpd.SetMode (mode); }
+  uint32_t GetBloomGenerations () const { return m_dpd.GetBloomFilter ().GetGenerations (); }
+  void SetBloomGenerations (uint32_t n);
+  uint32_t GetBloomCapacity () const { return m_dpd.GetBloomFilter ().GetCapacity (); }
+  void SetBloomCapacity (uint32_t n);
+  double GetBloomFalsePositiveRate () const { return m_dpd.GetBloomFilter ().GetFalsePositiveRate (); }
+  void SetBloomFalsePositiveRate (double rate);
+  bool GetBloomCheck () const { return m_dpd.GetBloomCheck (); }
+  void SetBloomCheck (bool f) { m_dpd.SetBloomCheck (f); }
+  DuplicatePacketDetection const & GetDuplicatePacketDetection () const { return m_dpd; }
   //\}
 
  /**
@@ -71,6 +96,51 @@ public:
   */
   int64_t AssignStreams (int64_t stream);
 
+  /**
+   * Record that a payment of amount to dst went through, so that later
+   * payments to dst that fit the route skip route discovery. Paths found
+   * by a route reply are cached when the reply arrives; a delivery
+   * refreshes the path it took.
+   */
+  void NotifyPaymentDelivered (Ipv4Address dst, uint32_t amount);
+
+  ///\name Control messages received and sent by the payment network application
+  //\{
+  /// Receive RREQ
+  void RecvRReq (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src);
+  /// Receive RREP, install the forward route and release the payments queued for it at the origin
+  void RecvRRep (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address sender);
+  /// Receive batched RREQ, reply for the destinations known here and forward the rest
+  void RecvBatchedRReq (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src);
+  /// Receive HELLO
+  void RecvHello (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address sender);
+  /// Pick the tuple for receiver out of an aggregated HELLO
+  void RecvAggregatedHello (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address sender);
+  /// Unicast HELLO to dst, requesting to open a channel if acked is set
+  void SendHello (Ipv4Address dst, bool acked);
+  /**
+   * Broadcast the state of all payment channels in one aggregated HELLO,
+   * split over several packets only when it does not fit the interface MTU
+   */
+  void SendAggregatedHello ();
+  /**
+   * Set the function told whether each received HELLO agreed with the
+   * channel table (true) or changed it (false), e.g. to drive a Trickle timer.
+   * A change of my own balance is reported as inconsistent too, so that it
+   * is announced without waiting for a long Trickle interval.
+   */
+  void SetHelloConsistencyCallback (Callback<void, bool> cb) { m_helloConsistencyCallback = cb; }
+  //\}
+
+  /**
+   * TracedCallback signature for a flush of the packets queued for a destination
+   *
+   * \param [in] dst destination whose route arrived
+   * \param [in] count number of packets forwarded in the burst
+   * \param [in] latency time the longest waiting of the forwarded packets spent in the queue
+   */
+  typedef void (* QueueFlushTracedCallback)(Ipv4Address dst, uint32_t count, Time latency);
+
 private:
   ///\name Protocol parameters.
   //\{
@@ -93,6 +163,7 @@ private:
    */
   Time HelloInterval;
   uint32_t AllowedHelloLoss;         ///< Number of hello messages which may be loss for valid link
+  Time HelloKeepalive;               ///< Longest time an unchanged channel balance goes unannounced
   /**
    * DeletePeriod is intended to provide an upper bound on the time for which an upstream node A
    * can have a neighbor B as an active next hop for destination D, while B has invalidated the route to D.
@@ -111,6 +182,9 @@ private:
   bool GratuitousReply;              ///< Indicates whether a gratuitous RREP should be unicast to the node originated route discovery.
   bool EnableHello;                  ///< Indicates whether a hello messages enable
   bool EnableBroadcast;              ///< Indicates whether a a broadcast data packets forwarding enable
+  bool CompactEncoding;              ///< Indicates whether control messages are sent in the compact encoding
+  Time RreqBatchWindow;              ///< Time route requests wait to be batched, zero to send them one by one
+  uint32_t RreqBatchSize;            ///< Maximum number of destinations in one batched RREQ
   //\}
 
   /// IP protocol
@@ -134,6 +208,16 @@ private:
   DuplicatePacketDetection m_dpd;
   /// Handle neighbors payment channel
   Neighbors m_nb;
+  /// Paths that carried recent payments, by destination and amount
+  RouteCache m_routeCache;
+  /// An aggregated HELLO goes out by then even if no channel balance changed
+  Time m_nextPresenceHello;
+  /// See SetHelloConsistencyCallback
+  Callback<void, bool> m_helloConsistencyCallback;
+  /// Destinations waiting for the next batched RREQ and the largest amount for each
+  std::map<Ipv4Address, uint32_t> m_rreqBatch;
+  /// Sends the batched RREQ at the end of the batching window
+  EventId m_rreqBatchEvent;
   /// Number of RREQs used for RREQ rate control
   uint16_t m_rreqCount;
   /// Number of RERRs used for RERR rate control
@@ -142,7 +226,7 @@ private:
 private:
   /// Start protocol operation
   void Start ();
-  /// Queue packet and send route request
+  /// Queue packet, ranked by its PaymentTag, and send a route request for its amount
   void DeferredRouteOutput (Ptr<const Packet> p, const Ipv4Header & header, UnicastForwardCallback ucb, ErrorCallback ecb);
   /// If route exists and valid, forward packet.
   bool Forwarding (Ptr<const Packet> p, const Ipv4Header & header, UnicastForwardCallback ucb, ErrorCallback ecb);
@@ -158,18 +242,30 @@ private:
    * \return true if route to destination address addr exist
    */
   bool UpdateRouteLifeTime (Ipv4Address addr, Time lt);
+  /**
+   * Create or update the reverse route to the originator of a RREQ
+   * \return the routing table entry to origin
+   */
+  RoutingTableEntry * UpdateReverseRoute (Ipv4Address origin, uint32_t originSeqNo, uint8_t hop, uint32_t amount,
+                                          Ipv4Address receiver, Ipv4Address src);
   /**
    * Update neighbor record.
    * \param receiver is supposed to be my interface
    * \param sender is supposed to be IP address of my neighbor.
    */
   void UpdateRouteToNeighbor (Ipv4Address sender, Ipv4Address receiver);
+  /// Invalidate all routes through nextHop once the payment channel to it is closed
+  void ClosePaymentChannelToNextHop (Ipv4Address nextHop);
   /// Check that packet is send from own interface
   bool IsMyOwnAddress (Ipv4Address src);
   /// Find socket with local interface address iface
   Ptr<Socket> FindSocketWithInterfaceAddress (Ipv4InterfaceAddress iface) const;
   /// Process hello message
   void ProcessHello (RrepHeader const & rrepHeader, Ipv4Address receiverIfaceAddr);
+  /// Report a received HELLO to the consistency callback, if set
+  void NotifyHelloConsistency (bool consistent);
+  /// A payment changed my balance on the channel to peer, it has to be announced
+  void NotifyBalanceChange (Ipv4Address peer);
   /// Create loopback route for given header
   Ptr<Ipv4Route> LoopbackRoute (const Ipv4Header & header, Ptr<NetDevice> oif) const;
 
@@ -179,8 +275,6 @@ private:
   void RecvPaymentMsg (Ptr<Socket> socket);
   /// Receive RREQ
   void RecvRequest (Ptr<Packet> p, Ipv4Address receiver, Ipv4Address src);
-  /// Receive RREP
-  void RecvReply (Ptr<Packet> p, Ipv4Address my,Ipv4Address src);
   /// Receive RREP_ACK
   void RecvReplyAck (Ipv4Address neighbor);
   /// Receive RERR from node with address src
@@ -189,12 +283,28 @@ private:
 
   ///\name Send
   //\{
-  /// Forward packet from route request queue
+  /// Forward all packets queued for dst along route in one burst
   void SendPacketFromQueue (Ipv4Address dst, Ptr<Ipv4Route> route);
   /// Send hello
   void SendHello ();
-  /// Send RREQ
-  void SendRequest (Ipv4Address dst);
+  /// Send RREQ for a payment of amount to dst, unless the known paths, split if need be, or a cached path carry it
+  void SendRequest (Ipv4Address dst, uint32_t amount = 0);
+  /**
+   * Mark the route to dst as in search, adding an entry if there is none
+   * \return true if dstSeqNo was set to a valid destination sequence number
+   */
+  bool StartRouteSearch (Ipv4Address dst, uint32_t & dstSeqNo);
+  /// Add dst to the next batched RREQ, sent when the window closes or the batch is full
+  void QueueRequest (Ipv4Address dst, uint32_t amount);
+  /// Flood the queued destinations, RreqBatchSize per batched RREQ
+  void SendBatchedRequest ();
+  /**
+   * Install a cached path to dst able to carry amount in the routing table.
+   * A valid route only gains it as an alternative path, a missing or
+   * invalid one takes it as its primary path.
+   * \return true if there was one and it was installed
+   */
+  bool UseCachedRoute (Ipv4Address dst, uint32_t amount);
   /// Send RREP
   void SendReply (RreqHeader const & rreqHeader, RoutingTableEntry const & toOrigin);
   /** Send RREP by intermediate node
@@ -239,6 +349,8 @@ private:
 
   /// Provides uniform random variables.
   Ptr<UniformRandomVariable> m_uniformRandomVariable;  
+  /// Packets queued for a destination flushed once its route arrived
+  TracedCallback<Ipv4Address, uint32_t, Time> m_queueFlushTrace;
 };
 
 }
@@ -0,0 +1,100 @@
+#include "offchain-trickle.h"
+#include "ns3/log.h"
+#include <algorithm>
+
+NS_LOG_COMPONENT_DEFINE ("OffchainTrickle");
+
+namespace ns3
+{
+namespace offchain
+{
+
+TrickleTimer::TrickleTimer (Time imin, uint32_t doublings, uint32_t redundancy) :
+  m_imin (imin),
+  m_doublings (doublings),
+  m_redundancy (redundancy),
+  m_interval (imin),
+  m_counter (0),
+  m_transmissions (0),
+  m_suppressions (0)
+{
+  m_uniformRandomVariable = CreateObject<UniformRandomVariable> ();
+}
+
+void
+TrickleTimer::Configure (Time imin, uint32_t doublings, uint32_t redundancy)
+{
+  m_imin = imin;
+  m_doublings = doublings;
+  m_redundancy = redundancy;
+}
+
+Time
+TrickleTimer::GetMaxInterval () const
+{
+  return m_imin * (int64_t (1) << m_doublings);
+}
+
+void
+TrickleTimer::Start ()
+{
+  Stop ();
+  m_interval = m_imin;
+  StartInterval ();
+}
+
+void
+TrickleTimer::Stop ()
+{
+  m_fireEvent.Cancel ();
+  m_endEvent.Cancel ();
+}
+
+void
+TrickleTimer::Inconsistent ()
+{
+  // already at Imin: nothing to speed up
+  if (m_interval == m_imin && m_endEvent.IsRunning ())
+    return;
+  NS_LOG_LOGIC ("Inconsistency, interval back to " << m_imin.GetSeconds () << " s");
+  Start ();
+}
+
+void
+TrickleTimer::StartInterval ()
+{
+  m_counter = 0;
+  Time t = Seconds (m_interval.GetSeconds () * m_uniformRandomVariable->GetValue (0.5, 1));
+  m_fireEvent = Simulator::Schedule (t, &TrickleTimer::Fire, this);
+  m_endEvent = Simulator::Schedule (m_interval, &TrickleTimer::EndInterval, this);
+}
+
+void
+TrickleTimer::Fire ()
+{
+  if (m_redundancy != 0 && m_counter >= m_redundancy)
+    {
+      m_suppressions++;
+      return;
+    }
+  m_transmissions++;
+  if (!m_transmit.IsNull ())
+    m_transmit ();
+}
+
+void
+TrickleTimer::EndInterval ()
+{
+  m_interval = std::min (m_interval * 2, GetMaxInterval ());
+  StartInterval ();
+}
+
+int64_t
+TrickleTimer::AssignStreams (int64_t stream)
+{
+  m_uniformRandomVariable->SetStream (stream);
+  return 1;
+}
+
+}
+}
@@ -0,0 +1,74 @@
+#ifndef OFFCHAIN_TRICKLE_H
+#define OFFCHAIN_TRICKLE_H
+
+#include "ns3/simulator.h"
+#include "ns3/event-id.h"
+#include "ns3/callback.h"
+#include "ns3/random-variable-stream.h"
+
+namespace ns3
+{
+namespace offchain
+{
+
+/**
+ * \brief Trickle timer (RFC 6206) driving periodic maintenance messages
+ *
+ * Intervals start at Imin and double up to Imax = Imin * 2^doublings while
+ * what is heard agrees with local state. In every interval the transmit
+ * function runs once, at a random point of its second half, unless the
+ * redundancy constant k is not 0 and k consistent messages were heard first.
+ * An inconsistency starts over at Imin. Only two events are pending at any
+ * time, whatever the run length.
+ */
+class TrickleTimer
+{
+public:
+  /// c-tor
+  TrickleTimer (Time imin = Seconds (10), uint32_t doublings = 2, uint32_t redundancy = 0);
+  /// Set the parameters, taking effect from the next interval
+  void Configure (Time imin, uint32_t doublings, uint32_t redundancy);
+  /// Set the function run when a message is due
+  void SetFunction (Callback<void> transmit) { m_transmit = transmit; }
+  /// Start with an interval of Imin
+  void Start ();
+  /// Cancel the pending events
+  void Stop ();
+  /// A message that agrees with local state was heard
+  void Consistent () { m_counter++; }
+  /// A message that disagrees with local state was heard, or local state changed
+  void Inconsistent ();
+  /// Current interval length
+  Time GetInterval () const { return m_interval; }
+  /// Largest interval length
+  Time GetMaxInterval () const;
+  /// Number of times the transmit function ran
+  uint32_t GetTransmissions () const { return m_transmissions; }
+  /// Number of transmissions dropped because k consistent messages were heard
+  uint32_t GetSuppressions () const { return m_suppressions; }
+  /// Use a fixed random stream, see RoutingProtocol::AssignStreams
+  int64_t AssignStreams (int64_t stream);
+private:
+  /// Begin an interval of m_interval and pick its transmission time
+  void StartInterval ();
+  /// Transmission point of the interval
+  void Fire ();
+  /// End of the interval: double it, up to Imax
+  void EndInterval ();
+
+  Time m_imin;
+  uint32_t m_doublings;
+  uint32_t m_redundancy;  ///< k, 0 never suppresses
+  Time m_interval;  ///< I
+  uint32_t m_counter;  ///< c, consistent messages heard in this interval
+  uint32_t m_transmissions;
+  uint32_t m_suppressions;
+  Callback<void> m_transmit;
+  EventId m_fireEvent;
+  EventId m_endEvent;
+  Ptr<UniformRandomVariable> m_uniformRandomVariable;
+};
+
+}
+}
+#endif /* OFFCHAIN_TRICKLE_H */
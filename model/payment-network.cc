@@ -104,6 +104,7 @@ PaymentNetwork::StopApplication ()
     }
 
     Simulator::Cancel (m_sendEvent);
+    m_helloTrickle.Stop ();
 }
 
 
@@ -153,14 +154,17 @@ PaymentNetwork::StartApplication (void)
 
     m_socket->SetRecvCallback (MakeCallback (&PaymentNetwork::HandleRead, this));
     
-    ScheduleTransmitPayChannelPackets(1000);
+    // one self-rescheduling timer per node: maintenance rounds start every
+    // 10 s and stretch out while the channel table stays consistent
+    m_helloTrickle.SetFunction (MakeCallback (&PaymentNetwork::SendChMaintain, this));
+    m_routingProtocol->SetHelloConsistencyCallback (MakeCallback (&PaymentNetwork::HelloConsistency, this));
+    m_helloTrickle.Start ();
 }
 
 bool
 PaymentNetwork::LookupRoute(Ipv4Address dst)
 {
-  RoutingTableEntry toNeighbor;
-  return m_routingTable.LookupRoute (dst, toNeighbor);
+  return m_routingTable.FindRoute (dst) != 0;
 
 }
 
@@ -211,52 +215,45 @@ PaymentNetwork::HandleOffchainMsg (Ptr<Socket> socket)
         m_routingProtocol->RecvHello (packet, receiver, sender);
         break;
       }
+    case OFFCHAIN_TYPE_HELLO_AGG:
+      {
+        m_routingProtocol->RecvAggregatedHello (packet, receiver, sender);
+        break;
+      }
+    case OFFCHAIN_TYPE_RREQ_BATCH:
+      {
+        m_routingProtocol->RecvBatchedRReq (packet, receiver, sender);
+        break;
+      }
 
     }
 }
 
-/*
- Schedule to transmit hello packets every TIME_INTERVAL=10s,
- starting at the initial value of time_elapsed.
-*/
 void
-PaymentNetwork::ScheduleTransmitPayChannelPackets(int numberOfEvents)
+PaymentNetwork::SetHelloTrickle (Time imin, uint32_t doublings, uint32_t redundancy)
 {
-    uint16_t event_counter = 0;
-    double time_elapsed = Simulator::Now ().GetSeconds () + 
-            static_cast <double> (rand()) / static_cast <double> (RAND_MAX);
-    /*
-    There are 2 components for time_elapsed:
-    - Simulator::Now ().GetSeconds () => so that a new node joins will not send a packet at time already in the past
-               For example: If it joins at time 2 second, it does not make sense to transmit at time 0 second.
-    - static_cast <double> (RAND_MAX) => ensure that 2 nodes join at the same time, will not transmit at the same time
-                                         which results in packet collision => No node receives the HELLO packet.
-    */
-    const double TIME_INTERVAL = 10; // 10 seconds
-    
-    while (event_counter < numberOfEvents)
-    {
-        time_elapsed += TIME_INTERVAL;
-        Simulator::Schedule (Seconds(time_elapsed), &PaymentNetwork::SendChMaintain, this);
-        event_counter++;
-    }
+    m_helloTrickle.Configure (imin, doublings, redundancy);
+}
+
+void
+PaymentNetwork::HelloConsistency (bool consistent)
+{
+    if (consistent)
+        m_helloTrickle.Consistent ();
+    else
+        m_helloTrickle.Inconsistent ();
 }
 
 
 void 
 PaymentNetwork::SendChMaintain ()
 {
-    //broadcast once
-    m_routingProtocol->SendHello();
-    //unicast
-    for(int i=0; i < m_ngbChTable.size(); i++)
-    {
-        m_routingProtocol->SendHello(m_ngbChTable.GetNgbIPaddrByIndex(i), 
-    }   
+    //one broadcast carries the state of every channel
+    m_routingProtocol->SendAggregatedHello();
 
     NS_LOG_INFO("");
     NS_LOG_INFO ("At time " << Simulator::Now ().GetSeconds () << "s node "<< GetNodeAddress() <<
-                 " broadcasts HELLO on port ");
+                 " broadcasts aggregated HELLO for " << m_ngbChTable.GetSize () << " channels");
 }
 
 
@@ -11,6 +11,7 @@
 #include "ns3/offchain-routing.h"
 #include "ns3/payroute-packet.h"
 #include "ns3/neighbors.h"
+#include "ns3/offchain-trickle.h"
 
 using namespace std;
 
@@ -75,6 +76,13 @@ public:
     void Setup (uint16_t port);
     // Set content requestor
     void RequestContent (Ipv4Address content);
+    /**
+     * Set the Trickle timer of channel maintenance rounds
+     * \param imin shortest interval between rounds
+     * \param doublings the longest interval is imin * 2^doublings
+     * \param redundancy skip a round after hearing this many consistent HELLOs, 0 never skips
+     */
+    void SetHelloTrickle (Time imin, uint32_t doublings, uint32_t redundancy);
 
 protected:
     virtual void DoDispose (void);
@@ -86,7 +94,8 @@ private:
     // negibhor payment channel maintain
     void SendChMaintain ();
     void SendPacket(PktHeader header);
-    void ScheduleTransmitPayChannelPackets (int num);
+    // Feed a received HELLO to the maintenance Trickle timer
+    void HelloConsistency (bool consistent);
     Ipv4Address GetNodeAddress(void);
     
     void HandleRead (Ptr<Socket> socket);
@@ -148,6 +157,8 @@ private:
     Ptr<offchain::RoutingProtocol> m_routingProtocol;
       /// Handle neighbors payment channel
     Neighbors m_ngbChTable;
+    /// Schedules SendChMaintain
+    offchain::TrickleTimer m_helloTrickle;
     
 };
 
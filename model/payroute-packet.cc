@@ -1,6 +1,7 @@
 #include "payroute-packet.h"
 #include "ns3/address-utils.h"
 #include "ns3/packet.h"
+#include <algorithm>
 
 namespace ns3
 {
@@ -9,6 +10,98 @@ namespace offchain
 
 
 
+/// Flags bit set in the first byte of a header in the compact encoding
+static const uint8_t COMPACT_FLAG = 1;
+
+/// Bytes taken by v as a base 128 varint
+static uint32_t
+VarintSize (uint32_t v)
+{
+  uint32_t n = 1;
+  while (v >= 0x80)
+    {
+      v >>= 7;
+      n++;
+    }
+  return n;
+}
+
+/// Write v as a base 128 varint, low groups first
+static void
+WriteVarint (Buffer::Iterator & i, uint32_t v)
+{
+  while (v >= 0x80)
+    {
+      i.WriteU8 (uint8_t (v) | 0x80);
+      v >>= 7;
+    }
+  i.WriteU8 (uint8_t (v));
+}
+
+/// Read a varint written by WriteVarint, at most 5 bytes and never past the end of the buffer
+static uint32_t
+ReadVarint (Buffer::Iterator & i)
+{
+  uint32_t v = 0;
+  for (uint32_t shift = 0; shift < 35 && i.GetRemainingSize () > 0; shift += 7)
+    {
+      uint8_t b = i.ReadU8 ();
+      v |= uint32_t (b & 0x7f) << shift;
+      if (!(b & 0x80))
+        break;
+    }
+  return v;
+}
+
+/// Map a signed delta to an unsigned value, small magnitudes to small values
+static uint32_t
+ZigZag (int32_t v)
+{
+  return (uint32_t (v) << 1) ^ uint32_t (v >> 31);
+}
+
+static int32_t
+UnZigZag (uint32_t v)
+{
+  return int32_t (v >> 1) ^ -int32_t (v & 1);
+}
+
+/// ReadFrom, leaving the any address when a truncated compact header has less than 4 bytes left
+static void
+ReadAddress (Buffer::Iterator & i, Ipv4Address & address)
+{
+  if (i.GetRemainingSize () < 4)
+    {
+      i.Next (i.GetRemainingSize ());
+      address = Ipv4Address ();
+      return;
+    }
+  ReadFrom (i, address);
+}
+
+/**
+ * Find the fields of a serialized header in a buffer of len bytes.
+ * Fields start at offset at, width[f] is the size of field f or 0 for a varint.
+ * 
+eturn the header size, 0 if the buffer is truncated
+ */
+static uint32_t
+ScanFields (uint8_t const * buf, uint32_t len, uint32_t at, uint8_t const * width,
+            uint32_t fields, uint8_t * offset)
+{
+  for (uint32_t f = 0; f < fields; ++f)
+    {
+      if (at >= len)
+        return 0;
+      uint32_t n = width[f] ? width[f] : RreqView::VarintLength (buf + at, len - at);
+      if (n == 0 || n > len - at)
+        return 0;
+      offset[f] = at;
+      at += n;
+    }
+  return at;
+}
+
 NS_OBJECT_ENSURE_REGISTERED (TypeHeader);
 
 TypeHeader::TypeHeader (MessageType t) :
@@ -54,6 +147,9 @@ TypeHeader::Deserialize (Buffer::Iterator start)
     {
     case OFFCHAIN_TYPE_RREQ:
     case OFFCHAIN_TYPE_RREP:
+    case OFFCHAIN_TYPE_HELLO:
+    case OFFCHAIN_TYPE_HELLO_AGG:
+    case OFFCHAIN_TYPE_RREQ_BATCH:
       {
         m_type = (MessageType) type;
         break;
@@ -81,6 +177,21 @@ TypeHeader::Print (std::ostream &os) const
         os << "RREP";
         break;
       }
+    case OFFCHAIN_TYPE_HELLO:
+      {
+        os << "HELLO";
+        break;
+      }
+    case OFFCHAIN_TYPE_HELLO_AGG:
+      {
+        os << "HELLO_AGG";
+        break;
+      }
+    case OFFCHAIN_TYPE_RREQ_BATCH:
+      {
+        os << "RREQ_BATCH";
+        break;
+      }
     default:
       os << "UNKNOWN_TYPE";
     }
@@ -130,12 +241,31 @@ RreqHeader::GetInstanceTypeId () const
 uint32_t
 RreqHeader::GetSerializedSize () const
 {
+  if (IsCompact ())
+    {
+      return 10 + VarintSize (m_requestID) + VarintSize (m_dstSeqNo)
+             + VarintSize (ZigZag (int32_t (m_originSeqNo - m_requestID)))
+             + VarintSize (m_transactionAmount);
+    }
   return 27;
 }
 
 void
 RreqHeader::Serialize (Buffer::Iterator i) const
 {
+  if (IsCompact ())
+    {
+      // origin seqno and request id both advance once per discovery
+      i.WriteU8 (m_flags);
+      i.WriteU8 (m_hopCount);
+      WriteVarint (i, m_requestID);
+      WriteTo (i, m_dst);
+      WriteVarint (i, m_dstSeqNo);
+      WriteTo (i, m_origin);
+      WriteVarint (i, ZigZag (int32_t (m_originSeqNo - m_requestID)));
+      WriteVarint (i, m_transactionAmount);
+      return;
+    }
   i.WriteU8 (m_flags);
   i.WriteU8 (m_reserved);
   i.WriteU8 (m_hopCount);
@@ -152,6 +282,18 @@ RreqHeader::Deserialize (Buffer::Iterator start)
 {
   Buffer::Iterator i = start;
   m_flags = i.ReadU8 ();
+  if (IsCompact ())
+    {
+      m_reserved = 0;
+      m_hopCount = i.ReadU8 ();
+      m_requestID = ReadVarint (i);
+      ReadAddress (i, m_dst);
+      m_dstSeqNo = ReadVarint (i);
+      ReadAddress (i, m_origin);
+      m_originSeqNo = m_requestID + UnZigZag (ReadVarint (i));
+      m_transactionAmount = ReadVarint (i);
+      return i.GetDistanceFrom (start);
+    }
   m_reserved = i.ReadU8 ();
   m_hopCount = i.ReadU8 ();
   m_requestID = i.ReadNtohU32 ();
@@ -229,6 +371,21 @@ RreqHeader::GetUnknownSeqno () const
   return (m_flags & (1 << 3));
 }
 
+void
+RreqHeader::SetCompact (bool f)
+{
+  if (f)
+    m_flags |= COMPACT_FLAG;
+  else
+    m_flags &= ~COMPACT_FLAG;
+}
+
+bool
+RreqHeader::IsCompact () const
+{
+  return (m_flags & COMPACT_FLAG);
+}
+
 bool
 RreqHeader::operator== (RreqHeader const & o) const
 {
@@ -245,7 +402,7 @@ RreqHeader::operator== (RreqHeader const & o) const
 RrepHeader::RrepHeader (uint8_t prefixSize, uint8_t hopCount, Ipv4Address dst,
                         uint32_t dstSeqNo, Ipv4Address origin, Time lifeTime, uint32_t reward) :
   m_flags (0), m_prefixSize (prefixSize), m_hopCount (hopCount),
-  m_dst (dst), m_dstSeqNo (dstSeqNo), m_origin (origin), m_accRewards(reward)
+  m_dst (dst), m_dstSeqNo (dstSeqNo), m_origin (origin), m_accRewards(reward), m_capacity (0)
 {
   m_lifeTime = uint32_t (lifeTime.GetMilliSeconds ());
 }
@@ -271,12 +428,28 @@ RrepHeader::GetInstanceTypeId () const
 uint32_t
 RrepHeader::GetSerializedSize () const
 {
-  return 23;
+  if (IsCompact ())
+    return 11 + VarintSize (m_dstSeqNo) + VarintSize (m_lifeTime) + VarintSize (m_accRewards)
+           + VarintSize (m_capacity);
+  return 27;
 }
 
 void
 RrepHeader::Serialize (Buffer::Iterator i) const
 {
+  if (IsCompact ())
+    {
+      i.WriteU8 (m_flags);
+      i.WriteU8 (m_prefixSize);
+      i.WriteU8 (m_hopCount);
+      WriteTo (i, m_dst);
+      WriteVarint (i, m_dstSeqNo);
+      WriteTo (i, m_origin);
+      WriteVarint (i, m_lifeTime);
+      WriteVarint (i, m_accRewards);
+      WriteVarint (i, m_capacity);
+      return;
+    }
   i.WriteU8 (m_flags);
   i.WriteU8 (m_prefixSize);
   i.WriteU8 (m_hopCount);
@@ -285,6 +458,7 @@ RrepHeader::Serialize (Buffer::Iterator i) const
   WriteTo (i, m_origin);
   i.WriteHtonU32 (m_lifeTime);
   i.WriteHtonU32 (m_accRewards);
+  i.WriteHtonU32 (m_capacity);
 }
 
 uint32_t
@@ -296,10 +470,20 @@ RrepHeader::Deserialize (Buffer::Iterator start)
   m_prefixSize = i.ReadU8 ();
   m_hopCount = i.ReadU8 ();
   ReadFrom (i, m_dst);
+  if (IsCompact ())
+    {
+      m_dstSeqNo = ReadVarint (i);
+      ReadAddress (i, m_origin);
+      m_lifeTime = ReadVarint (i);
+      m_accRewards = ReadVarint (i);
+      m_capacity = ReadVarint (i);
+      return i.GetDistanceFrom (start);
+    }
   m_dstSeqNo = i.ReadNtohU32 ();
   ReadFrom (i, m_origin);
   m_lifeTime = i.ReadNtohU32 ();
   m_accRewards = i.ReadNtohU32 ();
+  m_capacity = i.ReadNtohU32 ();
 
   uint32_t dist = i.GetDistanceFrom (start);
   NS_ASSERT (dist == GetSerializedSize ());
@@ -315,7 +499,7 @@ RrepHeader::Print (std::ostream &os) const
       os << " prefix size " << m_prefixSize;
     }
   os << " source ipv4 " << m_origin << " lifetime " << m_lifeTime << " rewards " << m_accRewards
-     << " acknowledgment required flag " << (*this).GetAckRequired ();
+     << " capacity " << m_capacity << " acknowledgment required flag " << (*this).GetAckRequired ();
 }
 
 void
@@ -358,12 +542,28 @@ RrepHeader::GetPrefixSize () const
   return m_prefixSize;
 }
 
+void
+RrepHeader::SetCompact (bool f)
+{
+  if (f)
+    m_flags |= COMPACT_FLAG;
+  else
+    m_flags &= ~COMPACT_FLAG;
+}
+
+bool
+RrepHeader::IsCompact () const
+{
+  return (m_flags & COMPACT_FLAG);
+}
+
 bool
 RrepHeader::operator== (RrepHeader const & o) const
 {
   return (m_flags == o.m_flags && m_prefixSize == o.m_prefixSize &&
           m_hopCount == o.m_hopCount && m_dst == o.m_dst && m_dstSeqNo == o.m_dstSeqNo &&
-          m_origin == o.m_origin && m_lifeTime == o.m_lifeTime && m_accRewards == o.m_accRewards);
+          m_origin == o.m_origin && m_lifeTime == o.m_lifeTime && m_accRewards == o.m_accRewards &&
+          m_capacity == o.m_capacity);
 }
 
 
@@ -378,8 +578,9 @@ operator<< (std::ostream & os, RrepHeader const & h)
 // HELLO
 //-----------------------------------------------------------------------------
 
-HelloHeader::HelloHeader (Ipv4Address dst, uint32_t dstSeqNo, Ipv4Address origin, Time lifeTime, uint32_t deposit) :
-  m_dst (dst), m_dstSeqNo (dstSeqNo), m_origin (origin), m_chAvailDeposit(deposit)
+HelloHeader::HelloHeader (Ipv4Address dst, uint32_t dstSeqNo, Ipv4Address origin, Time lifeTime, uint32_t deposit,
+                          uint32_t version) :
+  m_flags (0), m_dst (dst), m_dstSeqNo (dstSeqNo), m_origin (origin), m_chAvailDeposit(deposit), m_version (version)
 {
   m_lifeTime = uint32_t (lifeTime.GetMilliSeconds ());
 }
@@ -405,17 +606,33 @@ HelloHeader::GetInstanceTypeId () const
 uint32_t
 HelloHeader::GetSerializedSize () const
 {
-  return 20;
+  if (IsCompact ())
+    return 9 + VarintSize (m_dstSeqNo) + VarintSize (m_lifeTime) + VarintSize (m_chAvailDeposit)
+           + VarintSize (m_version);
+  return 25;
 }
 
 void
 HelloHeader::Serialize (Buffer::Iterator i) const
 {
+  if (IsCompact ())
+    {
+      i.WriteU8 (m_flags);
+      WriteTo (i, m_dst);
+      WriteVarint (i, m_dstSeqNo);
+      WriteTo (i, m_origin);
+      WriteVarint (i, m_lifeTime);
+      WriteVarint (i, m_chAvailDeposit);
+      WriteVarint (i, m_version);
+      return;
+    }
+  i.WriteU8 (m_flags);
   WriteTo (i, m_dst);
   i.WriteHtonU32 (m_dstSeqNo);
   WriteTo (i, m_origin);
   i.WriteHtonU32 (m_lifeTime);
   i.WriteHtonU32 (m_chAvailDeposit);
+  i.WriteHtonU32 (m_version);
 }
 
 uint32_t
@@ -423,11 +640,22 @@ HelloHeader::Deserialize (Buffer::Iterator start)
 {
   Buffer::Iterator i = start;
 
+  m_flags = i.ReadU8 ();
   ReadFrom (i, m_dst);
+  if (IsCompact ())
+    {
+      m_dstSeqNo = ReadVarint (i);
+      ReadAddress (i, m_origin);
+      m_lifeTime = ReadVarint (i);
+      m_chAvailDeposit = ReadVarint (i);
+      m_version = ReadVarint (i);
+      return i.GetDistanceFrom (start);
+    }
   m_dstSeqNo = i.ReadNtohU32 ();
   ReadFrom (i, m_origin);
   m_lifeTime = i.ReadNtohU32 ();
   m_chAvailDeposit = i.ReadNtohU32 ();
+  m_version = i.ReadNtohU32 ();
 
   uint32_t dist = i.GetDistanceFrom (start);
   NS_ASSERT (dist == GetSerializedSize ());
@@ -438,7 +666,8 @@ void
 HelloHeader::Print (std::ostream &os) const
 {
   os << "destination: ipv4 " << m_dst << " sequence number " << m_dstSeqNo;
-  os << " source ipv4 " << m_origin << " lifetime " << m_lifeTime << " deposit " << m_chAvailDeposit;
+  os << " source ipv4 " << m_origin << " lifetime " << m_lifeTime << " deposit " << m_chAvailDeposit
+     << " version " << m_version;
 }
 
 void
@@ -470,12 +699,27 @@ HelloHeader::GetAckRequired () const
 }
 
 
+void
+HelloHeader::SetCompact (bool f)
+{
+  if (f)
+    m_flags |= COMPACT_FLAG;
+  else
+    m_flags &= ~COMPACT_FLAG;
+}
+
+bool
+HelloHeader::IsCompact () const
+{
+  return (m_flags & COMPACT_FLAG);
+}
+
 bool
 HelloHeader::operator== (HelloHeader const & o) const
 {
-  return (m_flags == o.m_flags && m_prefixSize == o.m_prefixSize &&
-          m_hopCount == o.m_hopCount && m_dst == o.m_dst && m_dstSeqNo == o.m_dstSeqNo &&
-          m_origin == o.m_origin && m_lifeTime == o.m_lifeTime && m_chAvailDeposit == o.m_chAvailDeposit);
+  return (m_flags == o.m_flags && m_dst == o.m_dst && m_dstSeqNo == o.m_dstSeqNo &&
+          m_origin == o.m_origin && m_lifeTime == o.m_lifeTime && m_chAvailDeposit == o.m_chAvailDeposit
+          && m_version == o.m_version);
 }
 
 
@@ -486,5 +730,510 @@ operator<< (std::ostream & os, HelloHeader const & h)
   return os;
 }
 
+//-----------------------------------------------------------------------------
+// Aggregated HELLO
+//-----------------------------------------------------------------------------
+
+AggregatedHelloHeader::AggregatedHelloHeader (Ipv4Address origin, Time lifeTime, uint8_t fragment) :
+  m_flags (0), m_fragment (fragment), m_origin (origin), m_compactBytes (0)
+{
+  m_lifeTime = uint32_t (lifeTime.GetMilliSeconds ());
+}
+
+NS_OBJECT_ENSURE_REGISTERED (AggregatedHelloHeader);
+
+TypeId
+AggregatedHelloHeader::GetTypeId ()
+{
+  static TypeId tid = TypeId ("ns3::offchain::AggregatedHelloHeader")
+    .SetParent<Header> ()
+    .AddConstructor<AggregatedHelloHeader> ()
+  ;
+  return tid;
+}
+
+TypeId
+AggregatedHelloHeader::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+uint32_t
+AggregatedHelloHeader::GetSerializedSize () const
+{
+  if (IsCompact ())
+    return 6 + VarintSize (m_lifeTime) + VarintSize (m_channels.size ()) + m_compactBytes;
+  return 12 + 12 * m_channels.size ();
+}
+
+void
+AggregatedHelloHeader::Serialize (Buffer::Iterator i) const
+{
+  i.WriteU8 (m_flags);
+  i.WriteU8 (m_fragment);
+  WriteTo (i, m_origin);
+  if (IsCompact ())
+    {
+      WriteVarint (i, m_lifeTime);
+      WriteVarint (i, m_channels.size ());
+      for (std::vector<Channel>::const_iterator c = m_channels.begin (); c != m_channels.end (); ++c)
+        {
+          WriteTo (i, c->m_peer);
+          WriteVarint (i, c->m_availDeposit);
+          WriteVarint (i, c->m_version);
+        }
+      return;
+    }
+  i.WriteHtonU32 (m_lifeTime);
+  i.WriteHtonU16 (m_channels.size ());
+  for (std::vector<Channel>::const_iterator c = m_channels.begin (); c != m_channels.end (); ++c)
+    {
+      WriteTo (i, c->m_peer);
+      i.WriteHtonU32 (c->m_availDeposit);
+      i.WriteHtonU32 (c->m_version);
+    }
+}
+
+uint32_t
+AggregatedHelloHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+
+  m_flags = i.ReadU8 ();
+  m_fragment = i.ReadU8 ();
+  ReadFrom (i, m_origin);
+  ClearChannels ();
+  uint32_t count;
+  // smallest tuple in the encoding, a count beyond the bytes left is truncated
+  uint32_t minTuple;
+  if (IsCompact ())
+    {
+      m_lifeTime = ReadVarint (i);
+      count = ReadVarint (i);
+      minTuple = 6;
+    }
+  else
+    {
+      m_lifeTime = i.ReadNtohU32 ();
+      count = i.ReadNtohU16 ();
+      minTuple = 12;
+    }
+  count = std::min (count, i.GetRemainingSize () / minTuple);
+  // compact tuples may be longer than minTuple, stop where the bytes run out
+  for (uint32_t n = 0; n < count && i.GetRemainingSize () >= minTuple; ++n)
+    {
+      Ipv4Address peer;
+      ReadFrom (i, peer);
+      if (IsCompact ())
+        {
+          uint32_t deposit = ReadVarint (i);
+          AddChannel (peer, deposit, ReadVarint (i));
+        }
+      else
+        {
+          uint32_t deposit = i.ReadNtohU32 ();
+          AddChannel (peer, deposit, i.ReadNtohU32 ());
+        }
+    }
+  return i.GetDistanceFrom (start);
+}
+
+void
+AggregatedHelloHeader::Print (std::ostream &os) const
+{
+  os << "source ipv4 " << m_origin << " lifetime " << m_lifeTime << " fragment " << uint32_t (m_fragment)
+     << " channels";
+  for (std::vector<Channel>::const_iterator c = m_channels.begin (); c != m_channels.end (); ++c)
+    os << " (" << c->m_peer << " deposit " << c->m_availDeposit << " version " << c->m_version << ")";
+}
+
+void
+AggregatedHelloHeader::SetLifeTime (Time t)
+{
+  m_lifeTime = t.GetMilliSeconds ();
+}
+
+Time
+AggregatedHelloHeader::GetLifeTime () const
+{
+  Time t (MilliSeconds (m_lifeTime));
+  return t;
+}
+
+void
+AggregatedHelloHeader::AddChannel (Ipv4Address peer, uint32_t deposit, uint32_t version)
+{
+  m_channels.push_back (Channel (peer, deposit, version));
+  m_compactBytes += 4 + VarintSize (deposit) + VarintSize (version);
+}
+
+void
+AggregatedHelloHeader::RemoveLastChannel ()
+{
+  NS_ASSERT (!m_channels.empty ());
+  Channel const & c = m_channels.back ();
+  m_compactBytes -= 4 + VarintSize (c.m_availDeposit) + VarintSize (c.m_version);
+  m_channels.pop_back ();
+}
+
+void
+AggregatedHelloHeader::ClearChannels ()
+{
+  m_channels.clear ();
+  m_compactBytes = 0;
+}
+
+bool
+AggregatedHelloHeader::FindChannel (Ipv4Address peer, Channel & out) const
+{
+  for (std::vector<Channel>::const_iterator c = m_channels.begin (); c != m_channels.end (); ++c)
+    {
+      if (c->m_peer == peer)
+        {
+          out = *c;
+          return true;
+        }
+    }
+  return false;
+}
+
+void
+AggregatedHelloHeader::SetCompact (bool f)
+{
+  if (f)
+    m_flags |= COMPACT_FLAG;
+  else
+    m_flags &= ~COMPACT_FLAG;
+}
+
+bool
+AggregatedHelloHeader::IsCompact () const
+{
+  return (m_flags & COMPACT_FLAG);
+}
+
+bool
+AggregatedHelloHeader::operator== (AggregatedHelloHeader const & o) const
+{
+  if (m_flags != o.m_flags || m_fragment != o.m_fragment || m_origin != o.m_origin
+      || m_lifeTime != o.m_lifeTime || m_channels.size () != o.m_channels.size ())
+    return false;
+  for (uint32_t n = 0; n < m_channels.size (); ++n)
+    {
+      if (m_channels[n].m_peer != o.m_channels[n].m_peer
+          || m_channels[n].m_availDeposit != o.m_channels[n].m_availDeposit
+          || m_channels[n].m_version != o.m_channels[n].m_version)
+        return false;
+    }
+  return true;
+}
+
+std::ostream &
+operator<< (std::ostream & os, AggregatedHelloHeader const & h)
+{
+  h.Print (os);
+  return os;
+}
+
+//-----------------------------------------------------------------------------
+// Batched RREQ
+//-----------------------------------------------------------------------------
+
+BatchedRreqHeader::BatchedRreqHeader (uint8_t hopCount, uint32_t requestID, Ipv4Address origin,
+                                      uint32_t originSeqNo) :
+  m_flags (0), m_hopCount (hopCount), m_requestID (requestID), m_origin (origin),
+  m_originSeqNo (originSeqNo), m_compactBytes (0)
+{
+}
+
+NS_OBJECT_ENSURE_REGISTERED (BatchedRreqHeader);
+
+TypeId
+BatchedRreqHeader::GetTypeId ()
+{
+  static TypeId tid = TypeId ("ns3::offchain::BatchedRreqHeader")
+    .SetParent<Header> ()
+    .AddConstructor<BatchedRreqHeader> ()
+  ;
+  return tid;
+}
+
+TypeId
+BatchedRreqHeader::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+uint32_t
+BatchedRreqHeader::GetSerializedSize () const
+{
+  if (IsCompact ())
+    {
+      return 6 + VarintSize (m_requestID) + VarintSize (ZigZag (int32_t (m_originSeqNo - m_requestID)))
+             + VarintSize (m_destinations.size ()) + m_compactBytes;
+    }
+  return 15 + 13 * m_destinations.size ();
+}
+
+void
+BatchedRreqHeader::Serialize (Buffer::Iterator i) const
+{
+  i.WriteU8 (m_flags);
+  i.WriteU8 (m_hopCount);
+  if (IsCompact ())
+    {
+      WriteVarint (i, m_requestID);
+      WriteTo (i, m_origin);
+      WriteVarint (i, ZigZag (int32_t (m_originSeqNo - m_requestID)));
+      WriteVarint (i, m_destinations.size ());
+      for (std::vector<Destination>::const_iterator d = m_destinations.begin (); d != m_destinations.end (); ++d)
+        {
+          WriteTo (i, d->m_dst);
+          i.WriteU8 (d->m_unknownSeqNo);
+          WriteVarint (i, d->m_dstSeqNo);
+          WriteVarint (i, d->m_transAmount);
+        }
+      return;
+    }
+  i.WriteHtonU32 (m_requestID);
+  WriteTo (i, m_origin);
+  i.WriteHtonU32 (m_originSeqNo);
+  i.WriteU8 (m_destinations.size ());
+  for (std::vector<Destination>::const_iterator d = m_destinations.begin (); d != m_destinations.end (); ++d)
+    {
+      WriteTo (i, d->m_dst);
+      i.WriteU8 (d->m_unknownSeqNo);
+      i.WriteHtonU32 (d->m_dstSeqNo);
+      i.WriteHtonU32 (d->m_transAmount);
+    }
+}
+
+uint32_t
+BatchedRreqHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+
+  m_flags = i.ReadU8 ();
+  m_hopCount = i.ReadU8 ();
+  ClearDestinations ();
+  uint32_t count;
+  // smallest tuple in the encoding, a count beyond the bytes left is truncated
+  uint32_t minTuple;
+  if (IsCompact ())
+    {
+      m_requestID = ReadVarint (i);
+      ReadAddress (i, m_origin);
+      m_originSeqNo = m_requestID + UnZigZag (ReadVarint (i));
+      count = ReadVarint (i);
+      minTuple = 7;
+    }
+  else
+    {
+      m_requestID = i.ReadNtohU32 ();
+      ReadFrom (i, m_origin);
+      m_originSeqNo = i.ReadNtohU32 ();
+      count = i.ReadU8 ();
+      minTuple = 13;
+    }
+  count = std::min (count, i.GetRemainingSize () / minTuple);
+  // compact tuples may be longer than minTuple, stop where the bytes run out
+  for (uint32_t n = 0; n < count && i.GetRemainingSize () >= minTuple; ++n)
+    {
+      Ipv4Address dst;
+      ReadFrom (i, dst);
+      bool unknownSeqNo = i.ReadU8 ();
+      if (IsCompact ())
+        {
+          uint32_t dstSeqNo = ReadVarint (i);
+          AddDestination (dst, dstSeqNo, ReadVarint (i), unknownSeqNo);
+        }
+      else
+        {
+          uint32_t dstSeqNo = i.ReadNtohU32 ();
+          AddDestination (dst, dstSeqNo, i.ReadNtohU32 (), unknownSeqNo);
+        }
+    }
+  return i.GetDistanceFrom (start);
+}
+
+void
+BatchedRreqHeader::Print (std::ostream &os) const
+{
+  os << "RREQ ID " << m_requestID << " source: ipv4 " << m_origin << " sequence number " << m_originSeqNo
+     << " flags:" << " Gratuitous RREP " << GetGratiousRrep ()
+     << " Destination only " << GetDestinationOnly () << " destinations";
+  for (std::vector<Destination>::const_iterator d = m_destinations.begin (); d != m_destinations.end (); ++d)
+    {
+      os << " (" << d->m_dst << " sequence number " << d->m_dstSeqNo << " unknown " << d->m_unknownSeqNo
+         << " transaction amount " << d->m_transAmount << ")";
+    }
+}
+
+void
+BatchedRreqHeader::SetGratiousRrep (bool f)
+{
+  if (f)
+    m_flags |= (1 << 5);
+  else
+    m_flags &= ~(1 << 5);
+}
+
+bool
+BatchedRreqHeader::GetGratiousRrep () const
+{
+  return (m_flags & (1 << 5));
+}
+
+void
+BatchedRreqHeader::SetDestinationOnly (bool f)
+{
+  if (f)
+    m_flags |= (1 << 4);
+  else
+    m_flags &= ~(1 << 4);
+}
+
+bool
+BatchedRreqHeader::GetDestinationOnly () const
+{
+  return (m_flags & (1 << 4));
+}
+
+void
+BatchedRreqHeader::AddDestination (Ipv4Address dst, uint32_t dstSeqNo, uint32_t amount, bool unknownSeqNo)
+{
+  NS_ASSERT (m_destinations.size () < 255);
+  m_destinations.push_back (Destination (dst, dstSeqNo, amount, unknownSeqNo));
+  m_compactBytes += 5 + VarintSize (dstSeqNo) + VarintSize (amount);
+}
+
+void
+BatchedRreqHeader::ClearDestinations ()
+{
+  m_destinations.clear ();
+  m_compactBytes = 0;
+}
+
+RreqHeader
+BatchedRreqHeader::GetRequest (uint32_t i) const
+{
+  Destination const & d = m_destinations[i];
+  RreqHeader rreqHeader (/*flags=*/ 0, /*reserved=*/ 0, /*hopCount=*/ m_hopCount, /*requestID=*/ m_requestID,
+                         /*dst=*/ d.m_dst, /*dstSeqNo=*/ d.m_dstSeqNo, /*origin=*/ m_origin,
+                         /*originSeqNo=*/ m_originSeqNo, /*trAmount=*/ d.m_transAmount);
+  rreqHeader.SetGratiousRrep (GetGratiousRrep ());
+  rreqHeader.SetDestinationOnly (GetDestinationOnly ());
+  rreqHeader.SetUnknownSeqno (d.m_unknownSeqNo);
+  return rreqHeader;
+}
+
+void
+BatchedRreqHeader::SetCompact (bool f)
+{
+  if (f)
+    m_flags |= COMPACT_FLAG;
+  else
+    m_flags &= ~COMPACT_FLAG;
+}
+
+bool
+BatchedRreqHeader::IsCompact () const
+{
+  return (m_flags & COMPACT_FLAG);
+}
+
+bool
+BatchedRreqHeader::operator== (BatchedRreqHeader const & o) const
+{
+  if (m_flags != o.m_flags || m_hopCount != o.m_hopCount || m_requestID != o.m_requestID
+      || m_origin != o.m_origin || m_originSeqNo != o.m_originSeqNo
+      || m_destinations.size () != o.m_destinations.size ())
+    return false;
+  for (uint32_t n = 0; n < m_destinations.size (); ++n)
+    {
+      if (m_destinations[n].m_dst != o.m_destinations[n].m_dst
+          || m_destinations[n].m_dstSeqNo != o.m_destinations[n].m_dstSeqNo
+          || m_destinations[n].m_transAmount != o.m_destinations[n].m_transAmount
+          || m_destinations[n].m_unknownSeqNo != o.m_destinations[n].m_unknownSeqNo)
+        return false;
+    }
+  return true;
+}
+
+std::ostream &
+operator<< (std::ostream & os, BatchedRreqHeader const & h)
+{
+  h.Print (os);
+  return os;
+}
+
+/// Widths of the fields the views find, 0 for a varint; every field of the fixed layout has 4 bytes
+static const uint8_t FIXED_WIDTH[] = { 4, 4, 4, 4, 4, 4 };
+static const uint8_t RREQ_COMPACT_WIDTH[] = { 0, 4, 0, 4, 0, 0 };
+static const uint8_t HELLO_COMPACT_WIDTH[] = { 4, 0, 4, 0, 0, 0 };
+
+RreqView::RreqView (uint8_t const * buf, uint32_t len) :
+  m_buf (buf), m_size (0)
+{
+  if (len == 0)
+    return;
+  // fixed: flags, reserved, hop count; compact: flags, hop count
+  if (IsCompact (buf))
+    m_size = ScanFields (buf, len, 2, RREQ_COMPACT_WIDTH, FIELDS, m_offset);
+  else
+    m_size = ScanFields (buf, len, 3, FIXED_WIDTH, FIELDS, m_offset);
+}
+
+uint32_t
+RreqView::GetOriginSeqno () const
+{
+  if (IsCompact (m_buf))
+    return GetId () + UnZigZag (ReadVarint (m_buf + m_offset[ORIGIN_SEQNO]));
+  return ReadU32 (m_buf + m_offset[ORIGIN_SEQNO]);
+}
+
+void
+RreqView::SetDstSeqno (uint8_t * buf, uint32_t s)
+{
+  NS_ASSERT (!IsCompact (buf));
+  WriteU32 (buf + 11, s);
+}
+
+uint32_t
+RreqView::ReadVarint (uint8_t const * p)
+{
+  uint32_t v = 0;
+  for (uint32_t shift = 0; shift < 35; shift += 7)
+    {
+      uint8_t b = *p++;
+      v |= uint32_t (b & 0x7f) << shift;
+      if (!(b & 0x80))
+        break;
+    }
+  return v;
+}
+
+uint32_t
+RreqView::VarintLength (uint8_t const * p, uint32_t len)
+{
+  for (uint32_t n = 0; n < std::min<uint32_t> (len, 5); ++n)
+    {
+      if (!(p[n] & 0x80))
+        return n + 1;
+    }
+  return 0;
+}
+
+HelloView::HelloView (uint8_t const * buf, uint32_t len) :
+  m_buf (buf), m_size (0)
+{
+  if (len == 0)
+    return;
+  if (RreqView::IsCompact (buf))
+    m_size = ScanFields (buf, len, 1, HELLO_COMPACT_WIDTH, FIELDS, m_offset);
+  else
+    m_size = ScanFields (buf, len, 1, FIXED_WIDTH, FIELDS, m_offset);
+}
+
+}
 }
-}
\ No newline at end of file
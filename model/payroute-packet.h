@@ -6,6 +6,7 @@
 #include "ns3/enum.h"
 #include "ns3/ipv4-address.h"
 #include <map>
+#include <vector>
 #include "ns3/nstime.h"
 
 namespace ns3 {
@@ -16,7 +17,9 @@ enum MessageType
 {
   OFFCHAIN_TYPE_RREQ  = 1,
   OFFCHAIN_TYPE_RREP  = 2,
-  OFFCHAIN_TYPE_HELLO = 3
+  OFFCHAIN_TYPE_HELLO = 3,
+  OFFCHAIN_TYPE_HELLO_AGG = 4,
+  OFFCHAIN_TYPE_RREQ_BATCH = 5
 };
 
 class TypeHeader : public Header
@@ -54,7 +57,7 @@ public:
   RreqHeader (uint8_t flags = 0, uint8_t reserved = 0, uint8_t hopCount = 0,
               uint32_t requestID = 0, Ipv4Address dst = Ipv4Address (),
               uint32_t dstSeqNo = 0, Ipv4Address origin = Ipv4Address (),
-              uint32_t originSeqNo = 0);
+              uint32_t originSeqNo = 0, uint32_t trAmount = 0);
 
   ///\name Header serialization/deserialization
   //\{
@@ -94,9 +97,18 @@ public:
   bool GetUnknownSeqno () const;
   //\}
 
+  /**
+   * Use the compact encoding: seqnos, id, amount as varints and the origin
+   * seqno as a delta from the request id. The flags and hop count stay at
+   * their fixed offsets; the reserved byte is not sent. Deserialize detects
+   * the encoding from the flags byte.
+   */
+  void SetCompact (bool f);
+  bool IsCompact () const;
+
   bool operator== (RreqHeader const & o) const;
 private:
-  uint8_t        m_flags;          ///< |J|R|G|D|U| bit flags, see RFC
+  uint8_t        m_flags;          ///< |J|R|G|D|U| bit flags, see RFC, and the compact bit
   uint8_t        m_reserved;       ///< Not used
   uint8_t        m_hopCount;       ///< Hop Count
   uint32_t       m_requestID;      ///< RREQ ID
@@ -115,7 +127,7 @@ public:
   /// c-tor
   RrepHeader (uint8_t prefixSize = 0, uint8_t hopCount = 0, Ipv4Address dst =
                 Ipv4Address (), uint32_t dstSeqNo = 0, Ipv4Address origin =
-                Ipv4Address (), Time lifetime = MilliSeconds (0));
+                Ipv4Address (), Time lifetime = MilliSeconds (0), uint32_t reward = 0);
   ///\name Header serialization/deserialization
   //\{
   static TypeId GetTypeId ();
@@ -140,6 +152,13 @@ public:
   Time GetLifeTime () const;
   void SetAccRewards (uint32_t reward) { m_accRewards = reward; }
   uint32_t GetAccRewards () const {return m_accRewards; }
+  /**
+   * Smallest channel balance from the sender to the destination. The node that
+   * answers sets it, and each node on the way back lowers it to its own
+   * balance towards the node it got the reply from.
+   */
+  void SetCapacity (uint32_t capacity) { m_capacity = capacity; }
+  uint32_t GetCapacity () const { return m_capacity; }
 
   //\}
 
@@ -151,9 +170,13 @@ public:
   uint8_t GetPrefixSize () const;
   //\}
 
+  /// Use the compact encoding: seqno, lifetime, rewards and capacity as varints
+  void SetCompact (bool f);
+  bool IsCompact () const;
+
   bool operator== (RrepHeader const & o) const;
 private:
-  uint8_t       m_flags;                  ///< A - acknowledgment required flag
+  uint8_t       m_flags;                  ///< A - acknowledgment required flag, and the compact bit
   uint8_t       m_prefixSize;         ///< Prefix Size
   uint8_t             m_hopCount;         ///< Hop Count
   Ipv4Address   m_dst;              ///< Destination IP Address
@@ -161,6 +184,7 @@ private:
   Ipv4Address     m_origin;           ///< Source IP Address
   uint32_t      m_lifeTime;         ///< Lifetime (in milliseconds)
   uint32_t      m_accRewards;         ///< cumulative rewards
+  uint32_t      m_capacity;         ///< path bottleneck capacity
 };
 
 std::ostream & operator<< (std::ostream & os, RrepHeader const &);
@@ -171,7 +195,8 @@ class HelloHeader : public Header
 public:
   /// c-tor
   HelloHeader (Ipv4Address dst = Ipv4Address (), uint32_t dstSeqNo = 0, Ipv4Address origin =
-                Ipv4Address (), Time lifetime = MilliSeconds (0), uint32_t curDeposit);
+                Ipv4Address (), Time lifetime = MilliSeconds (0), uint32_t curDeposit = 0,
+                uint32_t version = 0);
   ///\name Header serialization/deserialization
   //\{
   static TypeId GetTypeId ();
@@ -195,23 +220,335 @@ public:
   Time GetLifeTime () const;
   void SetAvailableDeposit (uint32_t depo) { m_chAvailDeposit = depo; }
   uint32_t GetAvailableDeposit () const {return m_chAvailDeposit; }
+  void SetVersion (uint32_t v) { m_version = v; }
+  uint32_t GetVersion () const { return m_version; }
 
   //\}
   void SetAckRequired (bool f);
   bool GetAckRequired () const;
 
+  /// Use the compact encoding: seqno, lifetime, deposit and version as varints
+  void SetCompact (bool f);
+  bool IsCompact () const;
+
   bool operator== (HelloHeader const & o) const;
 private:
-  uint8_t       m_flags;                  ///< A - acknowledgment required flag
+  uint8_t       m_flags;                  ///< A - acknowledgment required flag, and the compact bit
   Ipv4Address   m_dst;              ///< Destination IP Address
   uint32_t      m_dstSeqNo;         ///< Destination Sequence Number
   Ipv4Address     m_origin;           ///< Source IP Address
   uint32_t      m_lifeTime;         ///< Lifetime (in milliseconds)
   uint32_t      m_chAvailDeposit;         ///< available deposit for payment
+  uint32_t      m_version;          ///< Version of the available deposit
 };
 
 std::ostream & operator<< (std::ostream & os, HelloHeader const &);
 
+/**
+ * \brief Broadcast hello carrying the state of the payment channels of a node
+ *
+ * One (peer, available deposit, version) tuple per channel replaces a unicast
+ * HELLO per neighbor. Only channels whose balance changed or whose keepalive
+ * is due are listed. A node with more channels than fit in one packet sends
+ * several fragments, numbered from 0.
+ */
+class AggregatedHelloHeader : public Header
+{
+public:
+  /// State of the channel to one peer
+  struct Channel
+  {
+    Ipv4Address m_peer;
+    uint32_t m_availDeposit;  ///< sender's available deposit on the channel
+    uint32_t m_version;  ///< version of m_availDeposit
+
+    Channel (Ipv4Address peer, uint32_t deposit, uint32_t version) :
+      m_peer (peer), m_availDeposit (deposit), m_version (version)
+    {
+    }
+  };
+
+  /// c-tor
+  AggregatedHelloHeader (Ipv4Address origin = Ipv4Address (), Time lifetime = MilliSeconds (0),
+                         uint8_t fragment = 0);
+  ///\name Header serialization/deserialization
+  //\{
+  static TypeId GetTypeId ();
+  TypeId GetInstanceTypeId () const;
+  uint32_t GetSerializedSize () const;
+  void Serialize (Buffer::Iterator start) const;
+  uint32_t Deserialize (Buffer::Iterator start);
+  void Print (std::ostream &os) const;
+  //\}
+
+  ///\name Fields
+  //\{
+  void SetOrigin (Ipv4Address a) { m_origin = a; }
+  Ipv4Address GetOrigin () const { return m_origin; }
+  void SetLifeTime (Time t);
+  Time GetLifeTime () const;
+  void SetFragment (uint8_t f) { m_fragment = f; }
+  uint8_t GetFragment () const { return m_fragment; }
+  //\}
+
+  ///\name Channel tuples
+  //\{
+  void AddChannel (Ipv4Address peer, uint32_t deposit, uint32_t version);
+  /// Remove the last tuple added
+  void RemoveLastChannel ();
+  /// Remove all tuples
+  void ClearChannels ();
+  uint32_t GetChannelCount () const { return m_channels.size (); }
+  Channel const & GetChannel (uint32_t i) const { return m_channels[i]; }
+  /// Find the tuple for peer, return false if there is none
+  bool FindChannel (Ipv4Address peer, Channel & out) const;
+  //\}
+
+  /// Use the compact encoding: lifetime, count, deposits and versions as varints
+  void SetCompact (bool f);
+  bool IsCompact () const;
+
+  bool operator== (AggregatedHelloHeader const & o) const;
+private:
+  uint8_t       m_flags;            ///< the compact bit
+  uint8_t       m_fragment;         ///< Fragment number within one round
+  Ipv4Address   m_origin;           ///< Source IP Address
+  uint32_t      m_lifeTime;         ///< Lifetime (in milliseconds)
+  std::vector<Channel> m_channels;  ///< One tuple per channel
+  uint32_t      m_compactBytes;     ///< Size of the tuples in the compact encoding
+};
+
+std::ostream & operator<< (std::ostream & os, AggregatedHelloHeader const &);
+
+/**
+ * \brief Route request for several destinations in one flood
+ *
+ * Carries one (destination, destination seqno, amount) tuple per route a
+ * node is looking for. A node that can answer for some of the destinations
+ * replies for those and forwards the request with the remaining tuples.
+ * Origin, request id and origin seqno are shared by all tuples, so the
+ * flood is detected as a duplicate like a single RREQ.
+ */
+class BatchedRreqHeader : public Header
+{
+public:
+  /// One destination searched for
+  struct Destination
+  {
+    Ipv4Address m_dst;
+    uint32_t m_dstSeqNo;
+    uint32_t m_transAmount;
+    bool m_unknownSeqNo;  ///< m_dstSeqNo is not known to the origin
+
+    Destination (Ipv4Address dst, uint32_t dstSeqNo, uint32_t amount, bool unknownSeqNo) :
+      m_dst (dst), m_dstSeqNo (dstSeqNo), m_transAmount (amount), m_unknownSeqNo (unknownSeqNo)
+    {
+    }
+  };
+
+  /// c-tor
+  BatchedRreqHeader (uint8_t hopCount = 0, uint32_t requestID = 0, Ipv4Address origin = Ipv4Address (),
+                     uint32_t originSeqNo = 0);
+  ///\name Header serialization/deserialization
+  //\{
+  static TypeId GetTypeId ();
+  TypeId GetInstanceTypeId () const;
+  uint32_t GetSerializedSize () const;
+  void Serialize (Buffer::Iterator start) const;
+  uint32_t Deserialize (Buffer::Iterator start);
+  void Print (std::ostream &os) const;
+  //\}
+
+  ///\name Fields
+  //\{
+  void SetHopCount (uint8_t count) { m_hopCount = count; }
+  uint8_t GetHopCount () const { return m_hopCount; }
+  void SetId (uint32_t id) { m_requestID = id; }
+  uint32_t GetId () const { return m_requestID; }
+  void SetOrigin (Ipv4Address a) { m_origin = a; }
+  Ipv4Address GetOrigin () const { return m_origin; }
+  void SetOriginSeqno (uint32_t s) { m_originSeqNo = s; }
+  uint32_t GetOriginSeqno () const { return m_originSeqNo; }
+  //\}
+
+  ///\name Flags, shared by all destinations
+  //\{
+  void SetGratiousRrep (bool f);
+  bool GetGratiousRrep () const;
+  void SetDestinationOnly (bool f);
+  bool GetDestinationOnly () const;
+  //\}
+
+  ///\name Destination tuples
+  //\{
+  void AddDestination (Ipv4Address dst, uint32_t dstSeqNo, uint32_t amount, bool unknownSeqNo);
+  /// Remove all tuples
+  void ClearDestinations ();
+  uint32_t GetDestinationCount () const { return m_destinations.size (); }
+  Destination const & GetDestination (uint32_t i) const { return m_destinations[i]; }
+  /// Single destination RREQ for tuple i, as replied to by SendReply
+  RreqHeader GetRequest (uint32_t i) const;
+  //\}
+
+  /// Use the compact encoding: id, seqnos, count and amounts as varints
+  void SetCompact (bool f);
+  bool IsCompact () const;
+
+  bool operator== (BatchedRreqHeader const & o) const;
+private:
+  uint8_t       m_flags;            ///< |G|D| flags as in a RREQ, and the compact bit
+  uint8_t       m_hopCount;         ///< Hop Count
+  uint32_t      m_requestID;        ///< RREQ ID
+  Ipv4Address   m_origin;           ///< Originator IP Address
+  uint32_t      m_originSeqNo;      ///< Source Sequence Number
+  std::vector<Destination> m_destinations;  ///< One tuple per destination
+  uint32_t      m_compactBytes;     ///< Size of the tuples in the compact encoding
+};
+
+std::ostream & operator<< (std::ostream & os, BatchedRreqHeader const &);
+
+/**
+ * \brief Read-only view of a serialized RREQ header
+ *
+ * Fields are read from the bytes on demand, so a node can decide to drop a
+ * RREQ without deserializing it. Both layouts are read: the compact one has
+ * the hop count at offset 1 rather than 2 and its varints are decoded when a
+ * field is asked for. The static setters patch a buffer holding a serialized
+ * RREQ in place before it is forwarded.
+ */
+class RreqView
+{
+public:
+  /// Serialized size in the fixed layout, as RreqHeader::GetSerializedSize
+  static const uint32_t SIZE = 27;
+  /// Largest serialized size, a compact header with 5 byte varints
+  static const uint32_t MAX_SIZE = 30;
+  /// c-tor, buf holds len bytes starting at the RREQ header
+  RreqView (uint8_t const * buf, uint32_t len);
+  /// Check that the buffer holds a whole header
+  bool IsValid () const { return m_size > 0; }
+  /// \return the bytes taken by the header, 0 if the buffer is truncated
+  uint32_t GetSerializedSize () const { return m_size; }
+  /// Check whether a serialized RREQ, HELLO or RREP uses the compact encoding
+  static bool IsCompact (uint8_t const * buf) { return (buf[0] & 1); }
+
+  ///\name Fields
+  //\{
+  uint8_t GetHopCount () const { return m_buf[HopCountOffset (m_buf)]; }
+  uint32_t GetId () const { return Read (ID); }
+  Ipv4Address GetDst () const { return Ipv4Address (ReadU32 (m_buf + m_offset[DST])); }
+  uint32_t GetDstSeqno () const { return Read (DST_SEQNO); }
+  Ipv4Address GetOrigin () const { return Ipv4Address (ReadU32 (m_buf + m_offset[ORIGIN])); }
+  uint32_t GetOriginSeqno () const;
+  uint32_t GetTransAmount () const { return Read (AMOUNT); }
+  bool GetGratiousRrep () const { return (m_buf[0] & (1 << 5)); }
+  bool GetDestinationOnly () const { return (m_buf[0] & (1 << 4)); }
+  bool GetUnknownSeqno () const { return (m_buf[0] & (1 << 3)); }
+  //\}
+
+  ///\name In place updates of a serialized RREQ
+  //\{
+  static void SetHopCount (uint8_t * buf, uint8_t count) { buf[HopCountOffset (buf)] = count; }
+  /// Fixed layout only, a compact sequence number may change size
+  static void SetDstSeqno (uint8_t * buf, uint32_t s);
+  static void SetUnknownSeqno (uint8_t * buf, bool f)
+  {
+    if (f)
+      buf[0] |= (1 << 3);
+    else
+      buf[0] &= ~(1 << 3);
+  }
+  //\}
+
+  /// Read a network order 32 bit value
+  static uint32_t ReadU32 (uint8_t const * p)
+  {
+    return (uint32_t (p[0]) << 24) | (uint32_t (p[1]) << 16) | (uint32_t (p[2]) << 8) | p[3];
+  }
+  /// Write a network order 32 bit value
+  static void WriteU32 (uint8_t * p, uint32_t v)
+  {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+  }
+  /// Read a varint of the compact encoding, its length checked by VarintLength
+  static uint32_t ReadVarint (uint8_t const * p);
+  /// \return the length of the varint at p, 0 if it runs past len bytes or 5 bytes
+  static uint32_t VarintLength (uint8_t const * p, uint32_t len);
+private:
+  /// Fields after the hop count, in RreqHeader::Serialize order
+  enum Field
+  {
+    ID,
+    DST,
+    DST_SEQNO,
+    ORIGIN,
+    ORIGIN_SEQNO,
+    AMOUNT,
+    FIELDS
+  };
+  static uint32_t HopCountOffset (uint8_t const * buf) { return IsCompact (buf) ? 1 : 2; }
+  /// Read a numeric field in the layout of the buffer
+  uint32_t Read (Field f) const
+  {
+    return IsCompact (m_buf) ? ReadVarint (m_buf + m_offset[f]) : ReadU32 (m_buf + m_offset[f]);
+  }
+  uint8_t const * m_buf;
+  uint32_t m_size;
+  uint8_t m_offset[FIELDS];
+};
+
+/**
+ * \brief Read-only view of a serialized HELLO header, in either layout
+ */
+class HelloView
+{
+public:
+  /// Serialized size in the fixed layout, as HelloHeader::GetSerializedSize
+  static const uint32_t SIZE = 25;
+  /// Largest serialized size, a compact header with 5 byte varints
+  static const uint32_t MAX_SIZE = 29;
+  /// c-tor, buf holds len bytes starting at the HELLO header
+  HelloView (uint8_t const * buf, uint32_t len);
+  /// Check that the buffer holds a whole header
+  bool IsValid () const { return m_size > 0; }
+  /// \return the bytes taken by the header, 0 if the buffer is truncated
+  uint32_t GetSerializedSize () const { return m_size; }
+
+  ///\name Fields
+  //\{
+  bool GetAckRequired () const { return (m_buf[0] & (1 << 6)); }
+  Ipv4Address GetDst () const { return Ipv4Address (RreqView::ReadU32 (m_buf + m_offset[DST])); }
+  uint32_t GetDstSeqno () const { return Read (DST_SEQNO); }
+  Ipv4Address GetOrigin () const { return Ipv4Address (RreqView::ReadU32 (m_buf + m_offset[ORIGIN])); }
+  Time GetLifeTime () const { return MilliSeconds (Read (LIFETIME)); }
+  uint32_t GetAvailableDeposit () const { return Read (DEPOSIT); }
+  uint32_t GetVersion () const { return Read (VERSION); }
+  //\}
+private:
+  /// Fields after the flags, in HelloHeader::Serialize order
+  enum Field
+  {
+    DST,
+    DST_SEQNO,
+    ORIGIN,
+    LIFETIME,
+    DEPOSIT,
+    VERSION,
+    FIELDS
+  };
+  /// Read a numeric field in the layout of the buffer
+  uint32_t Read (Field f) const
+  {
+    return RreqView::IsCompact (m_buf) ? RreqView::ReadVarint (m_buf + m_offset[f])
+                                       : RreqView::ReadU32 (m_buf + m_offset[f]);
+  }
+  uint8_t const * m_buf;
+  uint32_t m_size;
+  uint8_t m_offset[FIELDS];
+};
 
 }
 }
@@ -1,6 +1,5 @@
 #include "routemsg-queue.h"
 #include <algorithm>
-#include <functional>
 #include "ns3/ipv4-route.h"
 #include "ns3/socket.h"
 #include "ns3/log.h"
@@ -12,104 +11,347 @@ namespace ns3
 namespace offchain
 {
 
+NS_OBJECT_ENSURE_REGISTERED (PaymentTag);
+
+PaymentTag::PaymentTag (uint32_t amount, uint32_t fee, Time deadline) :
+  Tag (), m_amount (amount), m_fee (fee), m_deadline (deadline)
+{
+}
+
+TypeId
+PaymentTag::GetTypeId ()
+{
+  static TypeId tid = TypeId ("ns3::offchain::PaymentTag")
+    .SetParent<Tag> ()
+    .AddConstructor<PaymentTag> ()
+  ;
+  return tid;
+}
+
+TypeId
+PaymentTag::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+uint32_t
+PaymentTag::GetSerializedSize () const
+{
+  return 16;
+}
+
+void
+PaymentTag::Serialize (TagBuffer i) const
+{
+  i.WriteU32 (m_amount);
+  i.WriteU32 (m_fee);
+  i.WriteU64 (m_deadline.GetTimeStep ());
+}
+
+void
+PaymentTag::Deserialize (TagBuffer i)
+{
+  m_amount = i.ReadU32 ();
+  m_fee = i.ReadU32 ();
+  m_deadline = TimeStep (i.ReadU64 ());
+}
+
+void
+PaymentTag::Print (std::ostream &os) const
+{
+  os << "PaymentTag: amount " << m_amount << " fee " << m_fee << " deadline " << m_deadline;
+}
+
 
 uint32_t
 RequestQueue::GetSize ()
 {
   Purge ();
-  return m_queue.size ();
+  return m_size;
+}
+
+uint64_t
+RequestQueue::GetValue (QueueEntry const & entry)
+{
+  uint32_t size = std::max<uint32_t> (entry.GetPacket ()->GetSize (), 1);
+  return (uint64_t (entry.GetFee ()) << 10) / size;
+}
+
+/// Release order of the DEADLINE and VALUE policies, arrival order among equals
+struct ReleaseOrder
+{
+  RequestQueue::Policy m_policy;
+  bool
+  operator() (QueueEntry const & a, QueueEntry const & b) const
+  {
+    if (m_policy == RequestQueue::DEADLINE)
+      return a.GetDeadline () < b.GetDeadline ();
+    return RequestQueue::GetValue (a) > RequestQueue::GetValue (b);
+  }
+};
+
+void
+RequestQueue::SetPolicy (Policy policy)
+{
+  m_policy = policy;
+  m_byValue.clear ();
+  RebuildDeadlines ();
+  if (m_policy == FIFO)
+    return;
+  for (QueueMap::const_iterator q = m_queues.begin (); q != m_queues.end (); ++q)
+    {
+      for (DstQueue::const_iterator i = q->second.begin (); i != q->second.end (); ++i)
+        {
+          ValueKey key = { GetValue (i->m_entry), i->m_seq, q->first };
+          m_byValue.insert (key);
+        }
+    }
 }
 
 bool
 RequestQueue::Enqueue (QueueEntry & entry)
 {
   Purge ();
-  for (std::vector<QueueEntry>::const_iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  Ipv4Address dst = entry.GetIpv4Header ().GetDestination ();
+  QueuedId id = { entry.GetPacket ()->GetUid (), dst };
+  if (!m_ids.insert (id).second)
+    return false;
+  entry.SetExpireTime (m_queueTimeout);
+  entry.SetQueuedTime (Simulator::Now ());
+  while (m_size > 0 && m_size >= m_maxLen)
+    Evict ();
+  Slot slot = { m_nextSeq, entry };
+  m_queues[dst].push_back (slot);
+  m_age.push_back (std::make_pair (m_nextSeq, dst));
+  if (m_policy != FIFO)
     {
-      if ((i->GetPacket ()->GetUid () == entry.GetPacket ()->GetUid ())
-          && (i->GetIpv4Header ().GetDestination ()
-              == entry.GetIpv4Header ().GetDestination ()))
-        return false;
+      ValueKey key = { GetValue (entry), m_nextSeq, dst };
+      m_byValue.insert (key);
     }
-  entry.SetExpireTime (m_queueTimeout);
-  if (m_queue.size () == m_maxLen)
+  if (m_policy == DEADLINE && entry.GetDeadline () != Time::Max ())
+    {
+      DeadlineRecord record = { entry.GetDeadline (), m_nextSeq, dst };
+      m_deadlines.push (record);
+    }
+  m_nextSeq++;
+  m_size++;
+  if (m_age.size () > 2 * m_size + 64)
     {
-      Drop (m_queue.front (), "Drop the most aged packet"); // Drop the most aged packet
-      m_queue.erase (m_queue.begin ());
+      // too many records of dequeued entries, keep the live ones
+      std::deque<std::pair<uint64_t, Ipv4Address> > live;
+      for (std::deque<std::pair<uint64_t, Ipv4Address> >::const_iterator i = m_age.begin (); i != m_age.end (); ++i)
+        {
+          QueueMap::iterator q = m_queues.find (i->second);
+          if (q != m_queues.end () && Locate (q->second, i->first) != q->second.end ())
+            live.push_back (*i);
+        }
+      m_age.swap (live);
     }
-  m_queue.push_back (entry);
+  if (m_deadlines.size () > 2 * m_size + 64)
+    RebuildDeadlines ();
   return true;
 }
 
+void
+RequestQueue::Evict ()
+{
+  // after Purge the front record is live
+  QueueMap::iterator q;
+  DstQueue::iterator i;
+  if (m_policy == FIFO)
+    {
+      q = m_queues.find (m_age.front ().second);
+      i = q->second.begin ();
+      Drop (i->m_entry, "Drop the most aged packet"); // Drop the most aged packet
+    }
+  else
+    {
+      q = m_queues.find (m_byValue.begin ()->m_dst);
+      i = Locate (q->second, m_byValue.begin ()->m_seq);
+      Drop (i->m_entry, "Drop the lowest value packet");
+    }
+  Remove (q, i);
+  SkipStale ();
+}
+
 void
 RequestQueue::DropPacketWithDst (Ipv4Address dst)
 {
   NS_LOG_FUNCTION (this << dst);
   Purge ();
-  for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  QueueMap::iterator q = m_queues.find (dst);
+  if (q == m_queues.end ())
+    return;
+  for (DstQueue::const_iterator i = q->second.begin (); i != q->second.end (); ++i)
     {
-      if (IsEqual (*i, dst))
+      Drop (i->m_entry, "DropPacketWithDst ");
+      QueuedId id = { i->m_entry.GetPacket ()->GetUid (), dst };
+      m_ids.erase (id);
+      if (m_policy != FIFO)
         {
-          Drop (*i, "DropPacketWithDst ");
+          ValueKey key = { GetValue (i->m_entry), i->m_seq, dst };
+          m_byValue.erase (key);
         }
     }
-  m_queue.erase (std::remove_if (m_queue.begin (), m_queue.end (),
-                                 std::bind2nd (std::ptr_fun (RequestQueue::IsEqual), dst)), m_queue.end ());
+  m_size -= q->second.size ();
+  m_queues.erase (q);
+  SkipStale ();
 }
 
 bool
 RequestQueue::Dequeue (Ipv4Address dst, QueueEntry & entry)
 {
   Purge ();
-  for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i != m_queue.end (); ++i)
+  QueueMap::iterator q = m_queues.find (dst);
+  if (q == m_queues.end ())
+    return false;
+  DstQueue::iterator i = Select (q->second);
+  entry = i->m_entry;
+  Remove (q, i);
+  SkipStale ();
+  return true;
+}
+
+uint32_t
+RequestQueue::DequeueAll (Ipv4Address dst, std::vector<QueueEntry> & entries)
+{
+  Purge ();
+  QueueMap::iterator q = m_queues.find (dst);
+  if (q == m_queues.end ())
+    return 0;
+  uint32_t n = q->second.size ();
+  entries.reserve (entries.size () + n);
+  for (DstQueue::const_iterator i = q->second.begin (); i != q->second.end (); ++i)
     {
-      if (i->GetIpv4Header ().GetDestination () == dst)
+      entries.push_back (i->m_entry);
+      QueuedId id = { i->m_entry.GetPacket ()->GetUid (), dst };
+      m_ids.erase (id);
+      if (m_policy != FIFO)
         {
-          entry = *i;
-          m_queue.erase (i);
-          return true;
+          ValueKey key = { GetValue (i->m_entry), i->m_seq, dst };
+          m_byValue.erase (key);
         }
     }
-  return false;
+  if (m_policy != FIFO)
+    {
+      ReleaseOrder order = { m_policy };
+      std::stable_sort (entries.end () - n, entries.end (), order);
+    }
+  m_size -= n;
+  m_queues.erase (q);
+  SkipStale ();
+  return n;
 }
 
 bool
 RequestQueue::Find (Ipv4Address dst)
 {
-  for (std::vector<QueueEntry>::const_iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  return (m_queues.find (dst) != m_queues.end ());
+}
+
+void
+RequestQueue::Purge ()
+{
+  // a payment past its deadline can no longer be forwarded in time
+  while (!m_deadlines.empty () && m_deadlines.top ().m_deadline < Simulator::Now ())
+    {
+      DeadlineRecord const & record = m_deadlines.top ();
+      QueueMap::iterator q = m_queues.find (record.m_dst);
+      if (q != m_queues.end ())
+        {
+          DstQueue::iterator i = Locate (q->second, record.m_seq);
+          if (i != q->second.end ())
+            {
+              Drop (i->m_entry, "Drop packet past its deadline ");
+              Remove (q, i);
+            }
+        }
+      m_deadlines.pop ();
+    }
+  SkipStale ();
+  while (!m_age.empty ())
     {
-      if (i->GetIpv4Header ().GetDestination () == dst)
-        return true;
+      QueueMap::iterator q = m_queues.find (m_age.front ().second);
+      DstQueue::iterator oldest = Locate (q->second, m_age.front ().first);
+      if (oldest->m_entry.GetExpireTime () >= Seconds (0))
+        break;
+      Drop (oldest->m_entry, "Drop outdated packet ");
+      Remove (q, oldest);
+      m_age.pop_front ();
+      SkipStale ();
     }
-  return false;
 }
 
-struct IsExpired
+void
+RequestQueue::SkipStale ()
 {
-  bool
-  operator() (QueueEntry const & e) const
-  {
-    return (e.GetExpireTime () < Seconds (0));
-  }
-};
+  while (!m_age.empty ())
+    {
+      QueueMap::iterator q = m_queues.find (m_age.front ().second);
+      if (q != m_queues.end () && Locate (q->second, m_age.front ().first) != q->second.end ())
+        return;
+      m_age.pop_front ();
+    }
+}
 
 void
-RequestQueue::Purge ()
+RequestQueue::RebuildDeadlines ()
 {
-  IsExpired pred;
-  for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  m_deadlines = DeadlineHeap ();
+  if (m_policy != DEADLINE)
+    return;
+  for (QueueMap::const_iterator q = m_queues.begin (); q != m_queues.end (); ++q)
     {
-      if (pred (*i))
+      for (DstQueue::const_iterator i = q->second.begin (); i != q->second.end (); ++i)
         {
-          Drop (*i, "Drop outdated packet ");
+          if (i->m_entry.GetDeadline () != Time::Max ())
+            {
+              DeadlineRecord record = { i->m_entry.GetDeadline (), i->m_seq, q->first };
+              m_deadlines.push (record);
+            }
         }
     }
-  m_queue.erase (std::remove_if (m_queue.begin (), m_queue.end (), pred),
-                 m_queue.end ());
+}
+
+RequestQueue::DstQueue::iterator
+RequestQueue::Locate (DstQueue & q, uint64_t seq)
+{
+  // entries of a destination stay in arrival order
+  DstQueue::iterator i = std::lower_bound (q.begin (), q.end (), seq, SeqLess ());
+  if (i != q.end () && i->m_seq != seq)
+    return q.end ();
+  return i;
+}
+
+RequestQueue::DstQueue::iterator
+RequestQueue::Select (DstQueue & q) const
+{
+  DstQueue::iterator best = q.begin ();
+  if (m_policy == FIFO)
+    return best;
+  ReleaseOrder order = { m_policy };
+  for (DstQueue::iterator i = q.begin () + 1; i != q.end (); ++i)
+    {
+      if (order (i->m_entry, best->m_entry))
+        best = i;
+    }
+  return best;
+}
+
+void
+RequestQueue::Remove (QueueMap::iterator q, DstQueue::iterator i)
+{
+  QueuedId id = { i->m_entry.GetPacket ()->GetUid (), q->first };
+  m_ids.erase (id);
+  if (m_policy != FIFO)
+    {
+      ValueKey key = { GetValue (i->m_entry), i->m_seq, q->first };
+      m_byValue.erase (key);
+    }
+  q->second.erase (i);
+  m_size--;
+  if (q->second.empty ())
+    m_queues.erase (q);
 }
 
 void
@@ -2,12 +2,60 @@
 #define OFFCHAIN_RQUEUE_H
 
 #include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
+#include <queue>
+#include <functional>
 #include "ns3/ipv4-routing-protocol.h"
 #include "ns3/simulator.h"
+#include "ns3/tag.h"
 
 namespace ns3 {
 namespace offchain {
 
+/**
+ * \brief Amount, fee and deadline of a payment packet
+ *
+ * The sender tags a payment so that, while it waits for a route, the queue
+ * policy can rank it and route discovery looks for a path able to carry it.
+ */
+class PaymentTag : public Tag
+{
+public:
+  /// c-tor
+  PaymentTag (uint32_t amount = 0, uint32_t fee = 0, Time deadline = Time::Max ());
+
+  ///\name Tag serialization/deserialization
+  //\{
+  static TypeId GetTypeId ();
+  TypeId GetInstanceTypeId () const;
+  uint32_t GetSerializedSize () const;
+  void Serialize (TagBuffer i) const;
+  void Deserialize (TagBuffer i);
+  void Print (std::ostream &os) const;
+  //\}
+
+  ///\name Fields
+  //\{
+  uint32_t GetAmount () const { return m_amount; }
+  void SetAmount (uint32_t amount) { m_amount = amount; }
+  uint32_t GetFee () const { return m_fee; }
+  void SetFee (uint32_t fee) { m_fee = fee; }
+  /// Absolute time by which the payment must be forwarded, Time::Max () if none
+  Time GetDeadline () const { return m_deadline; }
+  void SetDeadline (Time deadline) { m_deadline = deadline; }
+  //\}
+private:
+  /// Payment amount
+  uint32_t m_amount;
+  /// Fee the payment pays to the forwarding node
+  uint32_t m_fee;
+  /// Forwarding deadline
+  Time m_deadline;
+};
+
 
 class QueueEntry
 {
@@ -19,7 +67,7 @@ public:
               UnicastForwardCallback ucb = UnicastForwardCallback (),
               ErrorCallback ecb = ErrorCallback (), Time exp = Simulator::Now ()) :
     m_packet (pa), m_header (h), m_ucb (ucb), m_ecb (ecb),
-    m_expire (exp + Simulator::Now ())
+    m_expire (exp + Simulator::Now ()), m_queued (Simulator::Now ()), m_fee (0), m_deadline (Time::Max ())
   {}
 
   /**
@@ -42,6 +90,14 @@ public:
   void SetIpv4Header (Ipv4Header h) { m_header = h; }
   void SetExpireTime (Time exp) { m_expire = exp + Simulator::Now (); }
   Time GetExpireTime () const { return m_expire - Simulator::Now (); }
+  /// Absolute time the entry entered the queue
+  Time GetQueuedTime () const { return m_queued; }
+  void SetQueuedTime (Time t) { m_queued = t; }
+  uint32_t GetFee () const { return m_fee; }
+  void SetFee (uint32_t fee) { m_fee = fee; }
+  /// Absolute time by which the payment must be forwarded, Time::Max () if none
+  Time GetDeadline () const { return m_deadline; }
+  void SetDeadline (Time deadline) { m_deadline = deadline; }
   //\}
 private:
   /// Data packet
@@ -54,21 +110,57 @@ private:
   ErrorCallback m_ecb;
   /// Expire time for queue entry
   Time m_expire;
+  /// Time the entry was queued
+  Time m_queued;
+  /// Fee the payment pays to this node
+  uint32_t m_fee;
+  /// Forwarding deadline of the payment
+  Time m_deadline;
 };
 
 
+/**
+ * \brief Packets waiting for a route, FIFO per destination
+ *
+ * Entries sit in one FIFO per destination. A global deque of (sequence number,
+ * destination) records the arrival order across destinations for timeouts and
+ * for dropping the most aged packet when the queue is full. Records of entries
+ * already dequeued are skipped when they reach its front. A hash set of
+ * (packet uid, destination) rejects duplicates.
+ *
+ * The policy decides which entry for a destination leaves first and which
+ * entry is dropped when the queue is full. FIFO keeps arrival order and drops
+ * the most aged packet. DEADLINE releases the earliest deadline first and
+ * VALUE the highest fee per byte first; both drop the lowest fee per byte,
+ * kept in an ordered set, when full. DEADLINE also drops entries whose
+ * deadline has passed, found through a min-heap of deadlines whose records
+ * of entries already dequeued are skipped when they reach its top.
+ */
 class RequestQueue
 {
 public:
+  /// Order of release and eviction
+  enum Policy
+  {
+    FIFO,
+    DEADLINE,
+    VALUE
+  };
+
   /// Default c-tor
   RequestQueue (uint32_t maxLen, Time routeToQueueTimeout) :
-    m_maxLen (maxLen), m_queueTimeout (routeToQueueTimeout)
+    m_size (0), m_nextSeq (0), m_policy (FIFO), m_maxLen (maxLen), m_queueTimeout (routeToQueueTimeout)
   {
   }
   /// Push entry in queue, if there is no entry with the same packet and destination address in queue.
   bool Enqueue (QueueEntry & entry);
-  /// Return first found (the earliest) entry for given destination
+  /// Return the entry for given destination that the policy releases first
   bool Dequeue (Ipv4Address dst, QueueEntry & entry);
+  /**
+   * Move every entry for dst, in policy order, to the end of entries
+   * \return the number of entries moved
+   */
+  uint32_t DequeueAll (Ipv4Address dst, std::vector<QueueEntry> & entries);
   /// Remove all packets with destination IP address dst
   void DropPacketWithDst (Ipv4Address dst);
   /// Finds whether a packet with destination dst exists in the queue
@@ -81,19 +173,99 @@ public:
   void SetMaxQueueLen (uint32_t len) { m_maxLen = len; }
   Time GetQueueTimeout () const { return m_queueTimeout; }
   void SetQueueTimeout (Time t) { m_queueTimeout = t; }
+  Policy GetPolicy () const { return m_policy; }
+  void SetPolicy (Policy policy);
   //\}
+  /// Fee per kilobyte of the entry, the value the VALUE policy ranks by
+  static uint64_t GetValue (QueueEntry const & entry);
 
 private:
-  std::vector<QueueEntry> m_queue;
+  /// Queued entry and its arrival sequence number
+  struct Slot
+  {
+    uint64_t m_seq;
+    QueueEntry m_entry;
+  };
+  struct SeqLess
+  {
+    bool operator() (Slot const & slot, uint64_t seq) const { return slot.m_seq < seq; }
+  };
+  typedef std::deque<Slot> DstQueue;
+  typedef std::unordered_map<Ipv4Address, DstQueue, Ipv4AddressHash> QueueMap;
+  /// destination -> its entries, oldest first; empty queues are erased
+  QueueMap m_queues;
+  /// (sequence number, destination) in arrival order, stale records included
+  std::deque<std::pair<uint64_t, Ipv4Address> > m_age;
+  /// Identity of a queued packet
+  struct QueuedId
+  {
+    uint64_t m_uid;
+    Ipv4Address m_dst;
+    bool operator== (QueuedId const & o) const { return m_uid == o.m_uid && m_dst == o.m_dst; }
+  };
+  struct QueuedIdHash
+  {
+    size_t operator() (QueuedId const & id) const
+    {
+      return std::hash<uint64_t> () (id.m_uid * 0x9e3779b97f4a7c15ULL ^ id.m_dst.Get ());
+    }
+  };
+  std::unordered_set<QueuedId, QueuedIdHash> m_ids;
+  /// Eviction order of the DEADLINE and VALUE policies
+  struct ValueKey
+  {
+    uint64_t m_value;
+    uint64_t m_seq;
+    Ipv4Address m_dst;
+    bool operator< (ValueKey const & o) const
+    {
+      return m_value < o.m_value || (m_value == o.m_value && m_seq < o.m_seq);
+    }
+  };
+  /// Entries by increasing value, oldest first among equals; empty under FIFO
+  std::set<ValueKey> m_byValue;
+  /// Deadline of a queued entry
+  struct DeadlineRecord
+  {
+    Time m_deadline;
+    uint64_t m_seq;
+    Ipv4Address m_dst;
+    bool operator> (DeadlineRecord const & o) const
+    {
+      return m_deadline > o.m_deadline || (m_deadline == o.m_deadline && m_seq > o.m_seq);
+    }
+  };
+  typedef std::priority_queue<DeadlineRecord, std::vector<DeadlineRecord>,
+                              std::greater<DeadlineRecord> > DeadlineHeap;
+  /// Entries with a deadline, earliest first, stale records included; empty unless DEADLINE
+  DeadlineHeap m_deadlines;
+  /// Number of queued entries
+  uint32_t m_size;
+  /// Sequence number of the next entry
+  uint64_t m_nextSeq;
+  /// Release and eviction policy
+  Policy m_policy;
+
   /// Remove all expired entries
   void Purge ();
+  /// Skip stale records at the front of m_age
+  void SkipStale ();
+  /// Rebuild m_deadlines from the queued entries
+  void RebuildDeadlines ();
+  /// Entry with sequence number seq in queue q, q.end () if it left
+  static DstQueue::iterator Locate (DstQueue & q, uint64_t seq);
+  /// Entry of queue q the policy releases first
+  DstQueue::iterator Select (DstQueue & q) const;
+  /// Remove entry i of queue q
+  void Remove (QueueMap::iterator q, DstQueue::iterator i);
+  /// Drop the entry the policy evicts first
+  void Evict ();
   /// Notify that packet is dropped from queue by timeout
   void Drop (QueueEntry en, std::string reason);
   /// The maximum number of packets that we allow a routing protocol to buffer.
   uint32_t m_maxLen;
   /// The maximum period of time that a routing protocol is allowed to buffer a packet for, seconds.
   Time m_queueTimeout;
-  static bool IsEqual (QueueEntry en, const Ipv4Address dst) { return (en.GetIpv4Header ().GetDestination () == dst); }
 };
 
 
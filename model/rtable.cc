@@ -1,4 +1,4 @@
-#include "aodv-rtable.h"
+#include "rtable.h"
 #include <algorithm>
 #include <iomanip>
 #include "ns3/simulator.h"
@@ -17,47 +17,111 @@ namespace offchain
 
 RoutingTableEntry::RoutingTableEntry (Ptr<NetDevice> dev, Ipv4Address dst, bool vSeqNo, uint32_t seqNo,
                                       Ipv4InterfaceAddress iface, uint16_t hops, uint32_t transAmount, Ipv4Address nextHop, Time lifetime) :
-  m_ackTimer (Timer::CANCEL_ON_DESTROY),
-  m_validSeqNo (vSeqNo), m_seqNo (seqNo), m_hops (hops), m_transAmount (transAmount),
-  m_lifeTime (lifetime + Simulator::Now ()), m_iface (iface), m_flag (VALID),
-  m_reqCount (0), m_blackListState (false), m_blackListTimeout (Simulator::Now ())
+  m_lifeTime (lifetime + Simulator::Now ()), m_blackListTimeout (Simulator::Now ()),
+  m_dev (dev), m_ackTimer (0), m_morePrecursors (0), m_altPaths (0),
+  m_dst (dst), m_nextHop (nextHop), m_ifaceLocal (iface.GetLocal ()), m_ifaceMask (iface.GetMask ()),
+  m_seqNo (seqNo), m_transAmount (transAmount), m_flag (VALID), m_hops (hops),
+  m_precursorCount (0), m_reqCount (0), m_validSeqNo (vSeqNo), m_blackListState (false)
 {
-  m_ipv4Route = Create<Ipv4Route> ();
-  m_ipv4Route->SetDestination (dst);
-  m_ipv4Route->SetGateway (nextHop);
-  m_ipv4Route->SetSource (m_iface.GetLocal ());
-  m_ipv4Route->SetOutputDevice (dev);
+}
+
+RoutingTableEntry::RoutingTableEntry (RoutingTableEntry const & o) :
+  m_ackTimer (0), m_morePrecursors (0), m_altPaths (0)
+{
+  *this = o;
+}
+
+RoutingTableEntry &
+RoutingTableEntry::operator= (RoutingTableEntry const & o)
+{
+  if (this == &o)
+    return *this;
+  delete m_ackTimer;
+  delete m_morePrecursors;
+  delete m_altPaths;
+  m_lifeTime = o.m_lifeTime;
+  m_blackListTimeout = o.m_blackListTimeout;
+  m_dev = o.m_dev;
+  m_ackTimer = o.m_ackTimer ? new Timer (*o.m_ackTimer) : 0;
+  m_morePrecursors = o.m_morePrecursors ? new std::vector<Ipv4Address> (*o.m_morePrecursors) : 0;
+  m_altPaths = o.m_altPaths ? new std::vector<RoutePath> (*o.m_altPaths) : 0;
+  m_dst = o.m_dst;
+  m_nextHop = o.m_nextHop;
+  m_ifaceLocal = o.m_ifaceLocal;
+  m_ifaceMask = o.m_ifaceMask;
+  std::copy (o.m_precursors, o.m_precursors + INLINE_PRECURSORS, m_precursors);
+  m_seqNo = o.m_seqNo;
+  m_transAmount = o.m_transAmount;
+  m_flag = o.m_flag;
+  m_hops = o.m_hops;
+  m_precursorCount = o.m_precursorCount;
+  m_reqCount = o.m_reqCount;
+  m_validSeqNo = o.m_validSeqNo;
+  m_blackListState = o.m_blackListState;
+  return *this;
 }
 
 RoutingTableEntry::~RoutingTableEntry ()
 {
+  delete m_ackTimer;
+  delete m_morePrecursors;
+  delete m_altPaths;
+}
+
+Ptr<Ipv4Route>
+RoutingTableEntry::GetRoute () const
+{
+  Ptr<Ipv4Route> route = Create<Ipv4Route> ();
+  route->SetDestination (m_dst);
+  route->SetGateway (m_nextHop);
+  route->SetSource (m_ifaceLocal);
+  route->SetOutputDevice (m_dev);
+  return route;
+}
+
+void
+RoutingTableEntry::SetRoute (Ptr<Ipv4Route> r)
+{
+  m_dst = r->GetDestination ();
+  m_nextHop = r->GetGateway ();
+  m_dev = r->GetOutputDevice ();
+}
+
+Timer &
+RoutingTableEntry::GetAckTimer ()
+{
+  if (m_ackTimer == 0)
+    m_ackTimer = new Timer (Timer::CANCEL_ON_DESTROY);
+  return *m_ackTimer;
 }
 
 bool
 RoutingTableEntry::InsertPrecursor (Ipv4Address id)
 {
   NS_LOG_FUNCTION (this << id);
-  if (!LookupPrecursor (id))
+  if (LookupPrecursor (id))
+    return false;
+  if (m_precursorCount < INLINE_PRECURSORS)
     {
-      m_precursorList.push_back (id);
+      m_precursors[m_precursorCount++] = id;
       return true;
     }
-  else
-    return false;
+  if (m_morePrecursors == 0)
+    m_morePrecursors = new std::vector<Ipv4Address>;
+  m_morePrecursors->push_back (id);
+  return true;
 }
 
 bool
 RoutingTableEntry::LookupPrecursor (Ipv4Address id)
 {
   NS_LOG_FUNCTION (this << id);
-  for (std::vector<Ipv4Address>::const_iterator i = m_precursorList.begin (); i
-       != m_precursorList.end (); ++i)
+  if (std::find (m_precursors, m_precursors + m_precursorCount, id) != m_precursors + m_precursorCount
+      || (m_morePrecursors != 0
+          && std::find (m_morePrecursors->begin (), m_morePrecursors->end (), id) != m_morePrecursors->end ()))
     {
-      if (*i == id)
-        {
-          NS_LOG_LOGIC ("Precursor " << id << " found");
-          return true;
-        }
+      NS_LOG_LOGIC ("Precursor " << id << " found");
+      return true;
     }
   NS_LOG_LOGIC ("Precursor " << id << " not found");
   return false;
@@ -67,32 +131,58 @@ bool
 RoutingTableEntry::DeletePrecursor (Ipv4Address id)
 {
   NS_LOG_FUNCTION (this << id);
-  std::vector<Ipv4Address>::iterator i = std::remove (m_precursorList.begin (),
-                                                      m_precursorList.end (), id);
-  if (i == m_precursorList.end ())
+  Ipv4Address * i = std::find (m_precursors, m_precursors + m_precursorCount, id);
+  if (i != m_precursors + m_precursorCount)
     {
-      NS_LOG_LOGIC ("Precursor " << id << " not found");
-      return false;
+      // keep insertion order: shift the inline tail, refill from the overflow
+      std::copy (i + 1, m_precursors + m_precursorCount, i);
+      m_precursorCount--;
+      if (m_morePrecursors != 0)
+        {
+          m_precursors[m_precursorCount++] = m_morePrecursors->front ();
+          m_morePrecursors->erase (m_morePrecursors->begin ());
+          if (m_morePrecursors->empty ())
+            {
+              delete m_morePrecursors;
+              m_morePrecursors = 0;
+            }
+        }
+      NS_LOG_LOGIC ("Precursor " << id << " found");
+      return true;
     }
-  else
+  if (m_morePrecursors != 0)
     {
-      NS_LOG_LOGIC ("Precursor " << id << " found");
-      m_precursorList.erase (i, m_precursorList.end ());
+      std::vector<Ipv4Address>::iterator j = std::find (m_morePrecursors->begin (),
+                                                        m_morePrecursors->end (), id);
+      if (j != m_morePrecursors->end ())
+        {
+          m_morePrecursors->erase (j);
+          if (m_morePrecursors->empty ())
+            {
+              delete m_morePrecursors;
+              m_morePrecursors = 0;
+            }
+          NS_LOG_LOGIC ("Precursor " << id << " found");
+          return true;
+        }
     }
-  return true;
+  NS_LOG_LOGIC ("Precursor " << id << " not found");
+  return false;
 }
 
 void
 RoutingTableEntry::DeleteAllPrecursors ()
 {
   NS_LOG_FUNCTION (this);
-  m_precursorList.clear ();
+  m_precursorCount = 0;
+  delete m_morePrecursors;
+  m_morePrecursors = 0;
 }
 
 bool
 RoutingTableEntry::IsPrecursorListEmpty () const
 {
-  return m_precursorList.empty ();
+  return m_precursorCount == 0;
 }
 
 void
@@ -101,19 +191,143 @@ RoutingTableEntry::GetPrecursors (std::vector<Ipv4Address> & prec) const
   NS_LOG_FUNCTION (this);
   if (IsPrecursorListEmpty ())
     return;
-  for (std::vector<Ipv4Address>::const_iterator i = m_precursorList.begin (); i
-       != m_precursorList.end (); ++i)
+  for (uint8_t i = 0; i < m_precursorCount; ++i)
     {
-      bool result = true;
-      for (std::vector<Ipv4Address>::const_iterator j = prec.begin (); j
-           != prec.end (); ++j)
+      if (std::find (prec.begin (), prec.end (), m_precursors[i]) == prec.end ())
+        prec.push_back (m_precursors[i]);
+    }
+  if (m_morePrecursors == 0)
+    return;
+  for (std::vector<Ipv4Address>::const_iterator i = m_morePrecursors->begin (); i
+       != m_morePrecursors->end (); ++i)
+    {
+      if (std::find (prec.begin (), prec.end (), *i) == prec.end ())
+        prec.push_back (*i);
+    }
+}
+
+bool
+RoutingTableEntry::AddPath (RoutePath const & path, uint32_t maxPaths)
+{
+  NS_LOG_FUNCTION (this << path.m_nextHop << path.m_hops << path.m_capacity);
+  if (path.m_nextHop == m_nextHop)
+    {
+      m_hops = path.m_hops;
+      m_transAmount = path.m_capacity;
+      m_lifeTime = std::max (m_lifeTime, path.m_expire);
+      return true;
+    }
+  if (maxPaths < 2)
+    return false;
+  if (m_altPaths == 0)
+    m_altPaths = new std::vector<RoutePath>;
+
+  Time now = Simulator::Now ();
+  std::vector<RoutePath>::iterator worst = m_altPaths->end ();
+  for (std::vector<RoutePath>::iterator i = m_altPaths->begin (); i != m_altPaths->end (); )
+    {
+      if (i->m_expire < now)
         {
-          if (*j == *i)
-            result = false;
+          i = m_altPaths->erase (i);
+          continue;
         }
-      if (result)
-        prec.push_back (*i);
+      if (i->m_nextHop == path.m_nextHop)
+        {
+          *i = path;
+          return true;
+        }
+      if (worst == m_altPaths->end () || i->m_capacity < worst->m_capacity)
+        worst = i;
+      ++i;
+    }
+  if (m_altPaths->size () + 1 < maxPaths)
+    {
+      m_altPaths->push_back (path);
+      return true;
+    }
+  if (worst != m_altPaths->end () && worst->m_capacity < path.m_capacity)
+    {
+      NS_LOG_LOGIC ("Path through " << path.m_nextHop << " replaces " << worst->m_nextHop);
+      *worst = path;
+      return true;
+    }
+  return false;
+}
+
+void
+RoutingTableEntry::GetPaths (std::vector<RoutePath> & paths) const
+{
+  paths.clear ();
+  paths.push_back (RoutePath (m_nextHop, m_hops, m_transAmount, m_lifeTime));
+  if (m_altPaths == 0)
+    return;
+  Time now = Simulator::Now ();
+  for (std::vector<RoutePath>::const_iterator i = m_altPaths->begin (); i != m_altPaths->end (); ++i)
+    {
+      if (i->m_expire >= now)
+        paths.push_back (*i);
+    }
+}
+
+bool
+RoutingTableEntry::UsesNextHop (Ipv4Address nextHop) const
+{
+  if (m_nextHop == nextHop)
+    return true;
+  if (m_altPaths == 0)
+    return false;
+  for (std::vector<RoutePath>::const_iterator i = m_altPaths->begin (); i != m_altPaths->end (); ++i)
+    {
+      if (i->m_nextHop == nextHop)
+        return true;
     }
+  return false;
+}
+
+void
+RoutingTableEntry::DeleteAlternatePaths (Ipv4Address nextHop)
+{
+  if (m_altPaths == 0)
+    return;
+  std::vector<RoutePath>::iterator i = m_altPaths->begin ();
+  while (i != m_altPaths->end ())
+    {
+      if (i->m_nextHop == nextHop)
+        i = m_altPaths->erase (i);
+      else
+        ++i;
+    }
+}
+
+bool
+RoutingTableEntry::PromoteAlternatePath ()
+{
+  NS_LOG_FUNCTION (this);
+  if (m_altPaths == 0)
+    return false;
+  Time now = Simulator::Now ();
+  std::vector<RoutePath>::iterator best = m_altPaths->end ();
+  for (std::vector<RoutePath>::iterator i = m_altPaths->begin (); i != m_altPaths->end (); ++i)
+    {
+      if (i->m_expire < now)
+        continue;
+      if (best == m_altPaths->end () || i->m_capacity > best->m_capacity
+          || (i->m_capacity == best->m_capacity && i->m_hops < best->m_hops))
+        best = i;
+    }
+  if (best == m_altPaths->end ())
+    {
+      delete m_altPaths;
+      m_altPaths = 0;
+      return false;
+    }
+  NS_LOG_LOGIC ("Route to " << m_dst << " switches from " << m_nextHop << " to " << best->m_nextHop);
+  m_nextHop = best->m_nextHop;
+  m_hops = best->m_hops;
+  m_transAmount = best->m_capacity;
+  m_lifeTime = best->m_expire;
+  m_altPaths->erase (best);
+  return true;
 }
 
 void
@@ -131,8 +345,8 @@ void
 RoutingTableEntry::Print (Ptr<OutputStreamWrapper> stream) const
 {
   std::ostream* os = stream->GetStream ();
-  *os << m_ipv4Route->GetDestination () << "\t" << m_ipv4Route->GetGateway ()
-      << "\t" << m_iface.GetLocal () << "\t";
+  *os << m_dst << "\t" << m_nextHop
+      << "\t" << m_ifaceLocal << "\t";
   switch (m_flag)
     {
     case VALID:
@@ -158,12 +372,181 @@ RoutingTableEntry::Print (Ptr<OutputStreamWrapper> stream) const
   *os << "\t" << m_hops << "\n";
 }
 
+/*
+ The route entry map
+ */
+
+RouteEntryMap::RouteEntryMap () :
+  m_size (0)
+{
+  Bucket empty = { 0, NONE };
+  m_buckets.assign (16, empty);
+}
+
+uint32_t
+RouteEntryMap::Hash (uint32_t key)
+{
+  key ^= key >> 16;
+  key *= 0x85ebca6b;
+  key ^= key >> 13;
+  key *= 0xc2b2ae35;
+  key ^= key >> 16;
+  return key;
+}
+
+uint32_t
+RouteEntryMap::FindBucket (uint32_t key) const
+{
+  uint32_t mask = m_buckets.size () - 1;
+  for (uint32_t i = Hash (key) & mask;; i = (i + 1) & mask)
+    {
+      if (m_buckets[i].m_handle == NONE)
+        return NONE;
+      if (m_buckets[i].m_key == key)
+        return i;
+    }
+}
+
+RouteEntryMap::Handle
+RouteEntryMap::Find (Ipv4Address dst) const
+{
+  uint32_t b = FindBucket (dst.Get ());
+  return (b == NONE) ? NONE : m_buckets[b].m_handle;
+}
+
+void
+RouteEntryMap::Grow ()
+{
+  std::vector<Bucket> old;
+  old.swap (m_buckets);
+  Bucket empty = { 0, NONE };
+  m_buckets.assign (old.size () * 2, empty);
+  uint32_t mask = m_buckets.size () - 1;
+  for (std::vector<Bucket>::const_iterator j = old.begin (); j != old.end (); ++j)
+    {
+      if (j->m_handle == NONE)
+        continue;
+      uint32_t i = Hash (j->m_key) & mask;
+      while (m_buckets[i].m_handle != NONE)
+        i = (i + 1) & mask;
+      m_buckets[i] = *j;
+    }
+}
+
+std::pair<RouteEntryMap::Handle, bool>
+RouteEntryMap::Insert (RoutingTableEntry const & rt)
+{
+  uint32_t key = rt.GetDestination ().Get ();
+  uint32_t b = FindBucket (key);
+  if (b != NONE)
+    return std::make_pair (m_buckets[b].m_handle, false);
+  // keep load factor below 0.7
+  if ((m_size + 1) * 10 > m_buckets.size () * 7)
+    Grow ();
+
+  Handle h;
+  if (m_free.empty ())
+    {
+      h = m_slab.size ();
+      m_slab.push_back (rt);
+      m_live.push_back (1);
+    }
+  else
+    {
+      h = m_free.back ();
+      m_free.pop_back ();
+      m_slab[h] = rt;
+      m_live[h] = 1;
+    }
+
+  uint32_t mask = m_buckets.size () - 1;
+  uint32_t i = Hash (key) & mask;
+  while (m_buckets[i].m_handle != NONE)
+    i = (i + 1) & mask;
+  m_buckets[i].m_key = key;
+  m_buckets[i].m_handle = h;
+  m_size++;
+  return std::make_pair (h, true);
+}
+
+bool
+RouteEntryMap::Erase (Ipv4Address dst)
+{
+  uint32_t b = FindBucket (dst.Get ());
+  if (b == NONE)
+    return false;
+  EraseHandle (m_buckets[b].m_handle);
+  return true;
+}
+
+void
+RouteEntryMap::EraseHandle (Handle h)
+{
+  uint32_t i = FindBucket (m_slab[h].GetDestination ().Get ());
+  NS_ASSERT (i != NONE && m_buckets[i].m_handle == h);
+  // backward-shift deletion: pull later members of the probe run into the hole
+  uint32_t mask = m_buckets.size () - 1;
+  for (uint32_t j = (i + 1) & mask; m_buckets[j].m_handle != NONE; j = (j + 1) & mask)
+    {
+      uint32_t k = Hash (m_buckets[j].m_key) & mask;
+      bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+      if (stays)
+        continue;
+      m_buckets[i] = m_buckets[j];
+      i = j;
+    }
+  m_buckets[i].m_handle = NONE;
+
+  m_slab[h] = RoutingTableEntry ();
+  m_live[h] = 0;
+  m_free.push_back (h);
+  m_size--;
+}
+
+RouteEntryMap::Handle
+RouteEntryMap::GetHandle (RoutingTableEntry const * rt) const
+{
+  NS_ASSERT (!m_slab.empty () && rt >= &m_slab.front () && rt <= &m_slab.back ());
+  return rt - &m_slab.front ();
+}
+
+RouteEntryMap::Handle
+RouteEntryMap::First () const
+{
+  return Next (NONE);
+}
+
+RouteEntryMap::Handle
+RouteEntryMap::Next (Handle h) const
+{
+  // NONE + 1 wraps to 0
+  for (Handle i = h + 1; i < m_live.size (); ++i)
+    {
+      if (m_live[i])
+        return i;
+    }
+  return NONE;
+}
+
+void
+RouteEntryMap::Clear ()
+{
+  Bucket empty = { 0, NONE };
+  m_buckets.assign (16, empty);
+  m_slab.clear ();
+  m_live.clear ();
+  m_free.clear ();
+  m_size = 0;
+}
+
 /*
  The Routing Table
  */
 
 RoutingTable::RoutingTable (Time t) : 
-  m_badLinkLifetime (t)
+  m_badLinkLifetime (t),
+  m_nextHopIndexSize (0),
+  m_maxPaths (3)
 {
 }
 
@@ -172,19 +555,18 @@ RoutingTable::LookupRoute (Ipv4Address id, RoutingTableEntry & rt)
 {
   NS_LOG_FUNCTION (this << id);
   Purge ();
-  if (m_ipv4AddressEntry.empty ())
+  if (m_ipv4AddressEntry.IsEmpty ())
     {
       NS_LOG_LOGIC ("Route to " << id << " not found; m_ipv4AddressEntry is empty");
       return false;
     }
-  std::map<Ipv4Address, RoutingTableEntry>::const_iterator i =
-    m_ipv4AddressEntry.find (id);
-  if (i == m_ipv4AddressEntry.end ())
+  RouteEntryMap::Handle i = m_ipv4AddressEntry.Find (id);
+  if (i == RouteEntryMap::NONE)
     {
       NS_LOG_LOGIC ("Route to " << id << " not found");
       return false;
     }
-  rt = i->second;
+  rt = m_ipv4AddressEntry.Get (i);
   NS_LOG_LOGIC ("Route to " << id << " found");
   return true;
 }
@@ -202,13 +584,40 @@ RoutingTable::LookupValidRoute (Ipv4Address id, RoutingTableEntry & rt)
   return (rt.GetFlag () == VALID);
 }
 
+RoutingTableEntry *
+RoutingTable::FindRoute (Ipv4Address id)
+{
+  NS_LOG_FUNCTION (this << id);
+  Purge ();
+  RouteEntryMap::Handle i = m_ipv4AddressEntry.Find (id);
+  if (i == RouteEntryMap::NONE)
+    {
+      NS_LOG_LOGIC ("Route to " << id << " not found");
+      return 0;
+    }
+  NS_LOG_LOGIC ("Route to " << id << " found");
+  return &m_ipv4AddressEntry.Get (i);
+}
+
+RoutingTableEntry *
+RoutingTable::FindValidRoute (Ipv4Address id)
+{
+  NS_LOG_FUNCTION (this << id);
+  RoutingTableEntry * rt = FindRoute (id);
+  if (rt == 0 || rt->GetFlag () != VALID)
+    return 0;
+  return rt;
+}
+
 bool
 RoutingTable::DeleteRoute (Ipv4Address dst)
 {
   NS_LOG_FUNCTION (this << dst);
   Purge ();
-  if (m_ipv4AddressEntry.erase (dst) != 0)
+  RouteEntryMap::Handle i = m_ipv4AddressEntry.Find (dst);
+  if (i != RouteEntryMap::NONE)
     {
+      Remove (i);
       NS_LOG_LOGIC ("Route deletion to " << dst << " successful");
       return true;
     }
@@ -223,8 +632,12 @@ RoutingTable::AddRoute (RoutingTableEntry & rt)
   Purge ();
   if (rt.GetFlag () != IN_SEARCH)
     rt.SetRreqCnt (0);
-  std::pair<std::map<Ipv4Address, RoutingTableEntry>::iterator, bool> result =
-    m_ipv4AddressEntry.insert (std::make_pair (rt.GetDestination (), rt));
+  std::pair<RouteEntryMap::Handle, bool> result = m_ipv4AddressEntry.Insert (rt);
+  if (result.second)
+    {
+      ScheduleExpiry (result.first);
+      IndexNextHop (result.first);
+    }
   return result.second;
 }
 
@@ -232,35 +645,50 @@ bool
 RoutingTable::Update (RoutingTableEntry & rt)
 {
   NS_LOG_FUNCTION (this);
-  std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-    m_ipv4AddressEntry.find (rt.GetDestination ());
-  if (i == m_ipv4AddressEntry.end ())
+  RouteEntryMap::Handle i = m_ipv4AddressEntry.Find (rt.GetDestination ());
+  if (i == RouteEntryMap::NONE)
     {
       NS_LOG_LOGIC ("Route update to " << rt.GetDestination () << " fails; not found");
       return false;
     }
-  i->second = rt;
-  if (i->second.GetFlag () != IN_SEARCH)
+  RoutingTableEntry & entry = m_ipv4AddressEntry.Get (i);
+  entry = rt;
+  if (entry.GetFlag () != IN_SEARCH)
     {
       NS_LOG_LOGIC ("Route update to " << rt.GetDestination () << " set RreqCnt to 0");
-      i->second.SetRreqCnt (0);
+      entry.SetRreqCnt (0);
     }
+  ScheduleExpiry (i);
+  IndexNextHop (i);
   return true;
 }
 
+void
+RoutingTable::UpdateInPlace (RoutingTableEntry * rt)
+{
+  NS_LOG_FUNCTION (this << rt->GetDestination ());
+  if (rt->GetFlag () != IN_SEARCH)
+    rt->SetRreqCnt (0);
+  RouteEntryMap::Handle h = m_ipv4AddressEntry.GetHandle (rt);
+  ScheduleExpiry (h);
+  IndexNextHop (h);
+}
+
 bool
 RoutingTable::SetEntryState (Ipv4Address id, RouteFlags state)
 {
   NS_LOG_FUNCTION (this);
-  std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-    m_ipv4AddressEntry.find (id);
-  if (i == m_ipv4AddressEntry.end ())
+  RouteEntryMap::Handle i = m_ipv4AddressEntry.Find (id);
+  if (i == RouteEntryMap::NONE)
     {
       NS_LOG_LOGIC ("Route set entry state to " << id << " fails; not found");
       return false;
     }
-  i->second.SetFlag (state);
-  i->second.SetRreqCnt (0);
+  RoutingTableEntry & entry = m_ipv4AddressEntry.Get (i);
+  entry.SetFlag (state);
+  entry.SetRreqCnt (0);
+  // IN_SEARCH entries leave the heap once expired, bring them back
+  ScheduleExpiry (i);
   NS_LOG_LOGIC ("Route set entry state to " << id << ": new state is " << state);
   return true;
 }
@@ -271,14 +699,15 @@ RoutingTable::GetListOfDestinationWithNextHop (Ipv4Address nextHop, std::map<Ipv
   NS_LOG_FUNCTION (this);
   Purge ();
   unreachable.clear ();
-  for (std::map<Ipv4Address, RoutingTableEntry>::const_iterator i =
-         m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end (); ++i)
+  std::vector<RouteEntryMap::Handle> handles;
+  FindNextHop (nextHop, handles);
+  for (std::vector<RouteEntryMap::Handle>::const_iterator i = handles.begin (); i != handles.end (); ++i)
     {
-      if (i->second.GetNextHop () == nextHop)
-        {
-          NS_LOG_LOGIC ("Unreachable insert " << i->first << " " << i->second.GetSeqNo ());
-          unreachable.insert (std::make_pair (i->first, i->second.GetSeqNo ()));
-        }
+      RoutingTableEntry const & entry = m_ipv4AddressEntry.Get (*i);
+      if (entry.GetNextHop () != nextHop)
+        continue; // only an alternative path goes through nextHop
+      NS_LOG_LOGIC ("Unreachable insert " << entry.GetDestination () << " " << entry.GetSeqNo ());
+      unreachable.insert (std::make_pair (entry.GetDestination (), entry.GetSeqNo ()));
     }
 }
 
@@ -287,17 +716,48 @@ RoutingTable::InvalidateRoutesWithDst (const std::map<Ipv4Address, uint32_t> & u
 {
   NS_LOG_FUNCTION (this);
   Purge ();
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-         m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end (); ++i)
+  for (std::map<Ipv4Address, uint32_t>::const_iterator j =
+         unreachable.begin (); j != unreachable.end (); ++j)
     {
-      for (std::map<Ipv4Address, uint32_t>::const_iterator j =
-             unreachable.begin (); j != unreachable.end (); ++j)
+      RouteEntryMap::Handle i = m_ipv4AddressEntry.Find (j->first);
+      if (i == RouteEntryMap::NONE)
+        continue;
+      RoutingTableEntry & entry = m_ipv4AddressEntry.Get (i);
+      if (entry.GetFlag () == VALID)
         {
-          if ((i->first == j->first) && (i->second.GetFlag () == VALID))
-            {
-              NS_LOG_LOGIC ("Invalidate route with destination address " << i->first);
-              i->second.Invalidate (m_badLinkLifetime);
-            }
+          NS_LOG_LOGIC ("Invalidate route with destination address " << j->first);
+          entry.Invalidate (m_badLinkLifetime);
+          ScheduleExpiry (i);
+        }
+    }
+}
+
+void
+RoutingTable::InvalidateRoutesWithNextHop (Ipv4Address nextHop, std::map<Ipv4Address, uint32_t> & unreachable)
+{
+  NS_LOG_FUNCTION (this << nextHop);
+  Purge ();
+  unreachable.clear ();
+  std::vector<RouteEntryMap::Handle> handles;
+  FindNextHop (nextHop, handles);
+  for (std::vector<RouteEntryMap::Handle>::const_iterator i = handles.begin (); i != handles.end (); ++i)
+    {
+      RoutingTableEntry & entry = m_ipv4AddressEntry.Get (*i);
+      entry.DeleteAlternatePaths (nextHop);
+      if (entry.GetNextHop () != nextHop)
+        continue;
+      if (entry.GetFlag () == VALID && entry.PromoteAlternatePath ())
+        {
+          ScheduleExpiry (*i);
+          IndexNextHop (*i);
+          continue;
+        }
+      unreachable.insert (std::make_pair (entry.GetDestination (), entry.GetSeqNo ()));
+      if (entry.GetFlag () == VALID)
+        {
+          NS_LOG_LOGIC ("Invalidate route with destination address " << entry.GetDestination ());
+          entry.Invalidate (m_badLinkLifetime);
+          ScheduleExpiry (*i);
         }
     }
 }
@@ -306,84 +766,281 @@ void
 RoutingTable::DeleteAllRoutesFromInterface (Ipv4InterfaceAddress iface)
 {
   NS_LOG_FUNCTION (this);
-  if (m_ipv4AddressEntry.empty ())
+  if (m_ipv4AddressEntry.IsEmpty ())
     return;
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-         m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end ();)
+  for (RouteEntryMap::Handle i = m_ipv4AddressEntry.First (); i != RouteEntryMap::NONE;
+       i = m_ipv4AddressEntry.Next (i))
     {
-      if (i->second.GetInterface () == iface)
-        {
-          std::map<Ipv4Address, RoutingTableEntry>::iterator tmp = i;
-          ++i;
-          m_ipv4AddressEntry.erase (tmp);
-        }
-      else
-        ++i;
+      // entries keep only local address and mask of their interface
+      Ipv4InterfaceAddress entryIface = m_ipv4AddressEntry.Get (i).GetInterface ();
+      if (entryIface.GetLocal () == iface.GetLocal () && entryIface.GetMask () == iface.GetMask ())
+        Remove (i);
     }
 }
 
+void
+RoutingTable::Clear ()
+{
+  m_ipv4AddressEntry.Clear ();
+  m_expiry = ExpiryQueue ();
+  m_slots.clear ();
+  m_nextHopIndex.clear ();
+  m_nextHopIndexSize = 0;
+}
+
 void
 RoutingTable::Purge ()
 {
   NS_LOG_FUNCTION (this);
-  if (m_ipv4AddressEntry.empty ())
+  Time now = Simulator::Now ();
+  while (!m_expiry.empty () && m_expiry.top ().m_expire < now)
+    {
+      ExpiryEntry e = m_expiry.top ();
+      m_expiry.pop ();
+      Slot & slot = GetSlot (e.m_handle);
+      if (slot.m_queuedExpire != e.m_expire)
+        continue; // entry deleted, or an earlier deadline was queued since
+      slot.m_queuedExpire = Time::Max ();
+      RoutingTableEntry & entry = m_ipv4AddressEntry.Get (e.m_handle);
+      if (entry.GetExpireTime () >= now)
+        {
+          // lifetime was extended since the record was queued
+          ScheduleExpiry (e.m_handle);
+        }
+      else if (entry.GetFlag () == INVALID)
+        {
+          Remove (e.m_handle);
+        }
+      else if (entry.GetFlag () == VALID && entry.PromoteAlternatePath ())
+        {
+          ScheduleExpiry (e.m_handle);
+          IndexNextHop (e.m_handle);
+        }
+      else if (entry.GetFlag () == VALID)
+        {
+          NS_LOG_LOGIC ("Invalidate route with destination address " << entry.GetDestination ());
+          entry.Invalidate (m_badLinkLifetime);
+          ScheduleExpiry (e.m_handle);
+        }
+      // an expired IN_SEARCH entry stays until route discovery updates it
+    }
+}
+
+void
+RoutingTable::ScheduleExpiry (RouteEntryMap::Handle h)
+{
+  Slot & slot = GetSlot (h);
+  Time deadline = m_ipv4AddressEntry.Get (h).GetExpireTime ();
+  if (slot.m_queuedExpire <= deadline)
+    return; // queued record fires first and is re-keyed then
+
+  slot.m_queuedExpire = deadline;
+  m_expiry.push (ExpiryEntry (deadline, h));
+  if (m_expiry.size () > 2 * m_ipv4AddressEntry.GetSize () + 64)
+    {
+      // too many orphaned records, rebuild from the live ones
+      std::vector<ExpiryEntry> live;
+      live.reserve (m_ipv4AddressEntry.GetSize ());
+      for (RouteEntryMap::Handle i = m_ipv4AddressEntry.First (); i != RouteEntryMap::NONE;
+           i = m_ipv4AddressEntry.Next (i))
+        {
+          if (m_slots[i].m_queuedExpire != Time::Max ())
+            live.push_back (ExpiryEntry (m_slots[i].m_queuedExpire, i));
+        }
+      m_expiry = ExpiryQueue (LaterExpiry (), live);
+    }
+}
+
+void
+RoutingTable::Remove (RouteEntryMap::Handle h)
+{
+  m_ipv4AddressEntry.EraseHandle (h);
+  Slot & slot = GetSlot (h);
+  slot.m_queuedExpire = Time::Max ();
+  slot.m_nextHopIndexed = false;
+}
+
+RoutingTable::Slot &
+RoutingTable::GetSlot (RouteEntryMap::Handle h)
+{
+  if (m_slots.size () <= h)
+    m_slots.resize (m_ipv4AddressEntry.GetSlabSize ());
+  return m_slots[h];
+}
+
+void
+RoutingTable::IndexNextHop (RouteEntryMap::Handle h)
+{
+  Slot & slot = GetSlot (h);
+  Ipv4Address nextHop = m_ipv4AddressEntry.Get (h).GetNextHop ();
+  if (slot.m_nextHopIndexed && slot.m_nextHop == nextHop)
+    return;
+  slot.m_nextHop = nextHop;
+  slot.m_nextHopIndexed = true;
+  m_nextHopIndex[nextHop].push_back (h);
+  m_nextHopIndexSize++;
+  CompactNextHopIndex ();
+}
+
+void
+RoutingTable::CompactNextHopIndex ()
+{
+  if (m_nextHopIndexSize <= 2 * m_maxPaths * m_ipv4AddressEntry.GetSize () + 64)
     return;
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-         m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end ();)
+  // too many stale handles, rebuild from the live entries
+  m_nextHopIndex.clear ();
+  m_nextHopIndexSize = 0;
+  std::vector<RoutePath> paths;
+  for (RouteEntryMap::Handle i = m_ipv4AddressEntry.First (); i != RouteEntryMap::NONE;
+       i = m_ipv4AddressEntry.Next (i))
     {
-      if (i->second.GetLifeTime () < Seconds (0))
+      if (!m_slots[i].m_nextHopIndexed)
+        continue;
+      m_ipv4AddressEntry.Get (i).GetPaths (paths);
+      for (std::vector<RoutePath>::const_iterator j = paths.begin (); j != paths.end (); ++j)
         {
-          if (i->second.GetFlag () == INVALID)
-            {
-              std::map<Ipv4Address, RoutingTableEntry>::iterator tmp = i;
-              ++i;
-              m_ipv4AddressEntry.erase (tmp);
-            }
-          else if (i->second.GetFlag () == VALID)
-            {
-              NS_LOG_LOGIC ("Invalidate route with destination address " << i->first);
-              i->second.Invalidate (m_badLinkLifetime);
-              ++i;
-            }
-          else
-            ++i;
+          m_nextHopIndex[j->m_nextHop].push_back (i);
+          m_nextHopIndexSize++;
         }
-      else 
+    }
+}
+
+void
+RoutingTable::FindNextHop (Ipv4Address nextHop, std::vector<RouteEntryMap::Handle> & handles)
+{
+  handles.clear ();
+  std::unordered_map<Ipv4Address, std::vector<RouteEntryMap::Handle>, Ipv4AddressHash>::iterator i =
+    m_nextHopIndex.find (nextHop);
+  if (i == m_nextHopIndex.end ())
+    return;
+  std::vector<RouteEntryMap::Handle> & list = i->second;
+  m_nextHopIndexSize -= list.size ();
+  for (std::vector<RouteEntryMap::Handle>::const_iterator j = list.begin (); j != list.end (); ++j)
+    {
+      // the slot may have been erased, reused, or moved to other next hops since
+      if (m_ipv4AddressEntry.IsLive (*j) && m_ipv4AddressEntry.Get (*j).UsesNextHop (nextHop))
+        handles.push_back (*j);
+    }
+  // a route that left and came back to nextHop is listed twice
+  std::sort (handles.begin (), handles.end ());
+  handles.erase (std::unique (handles.begin (), handles.end ()), handles.end ());
+  if (handles.empty ())
+    {
+      m_nextHopIndex.erase (i);
+      return;
+    }
+  list = handles;
+  m_nextHopIndexSize += list.size ();
+}
+
+bool
+RoutingTable::AddPath (Ipv4Address dst, Ipv4Address nextHop, uint16_t hops, uint32_t capacity, Time lifetime)
+{
+  NS_LOG_FUNCTION (this << dst << nextHop << hops << capacity);
+  Purge ();
+  RouteEntryMap::Handle i = m_ipv4AddressEntry.Find (dst);
+  if (i == RouteEntryMap::NONE || m_ipv4AddressEntry.Get (i).GetFlag () != VALID)
+    {
+      NS_LOG_LOGIC ("No valid route to " << dst << " to add a path to");
+      return false;
+    }
+  RoutingTableEntry & entry = m_ipv4AddressEntry.Get (i);
+  if (!entry.AddPath (RoutePath (nextHop, hops, capacity, lifetime + Simulator::Now ()), m_maxPaths))
+    return false;
+  ScheduleExpiry (i);
+  if (nextHop != entry.GetNextHop ())
+    {
+      // the alternative may have expired out of the index, duplicates are dropped on read
+      m_nextHopIndex[nextHop].push_back (i);
+      m_nextHopIndexSize++;
+      CompactNextHopIndex ();
+    }
+  return true;
+}
+
+bool
+RoutingTable::SelectPath (Ipv4Address dst, uint32_t amount, RoutePath & path)
+{
+  NS_LOG_FUNCTION (this << dst << amount);
+  RoutingTableEntry const * rt = FindValidRoute (dst);
+  if (rt == 0)
+    return false;
+  std::vector<RoutePath> paths;
+  rt->GetPaths (paths);
+  bool found = false;
+  for (std::vector<RoutePath>::const_iterator i = paths.begin (); i != paths.end (); ++i)
+    {
+      if (i->m_capacity < amount)
+        continue;
+      if (!found || i->m_hops < path.m_hops
+          || (i->m_hops == path.m_hops && i->m_capacity > path.m_capacity))
         {
-          ++i;
+          path = *i;
+          found = true;
         }
     }
+  NS_LOG_LOGIC ("Path to " << dst << " for " << amount << (found ? " found" : " not found"));
+  return found;
+}
+
+/// Order paths by decreasing capacity, then increasing hop count
+struct LargerCapacity
+{
+  bool operator() (RoutePath const & a, RoutePath const & b) const
+  {
+    return (a.m_capacity > b.m_capacity) || (a.m_capacity == b.m_capacity && a.m_hops < b.m_hops);
+  }
+};
+
+bool
+RoutingTable::SplitAmount (Ipv4Address dst, uint32_t amount, std::vector<std::pair<Ipv4Address, uint32_t> > & shares)
+{
+  NS_LOG_FUNCTION (this << dst << amount);
+  shares.clear ();
+  RoutingTableEntry const * rt = FindValidRoute (dst);
+  if (rt == 0)
+    return false;
+  std::vector<RoutePath> paths;
+  rt->GetPaths (paths);
+  std::sort (paths.begin (), paths.end (), LargerCapacity ());
+  uint32_t left = amount;
+  for (std::vector<RoutePath>::const_iterator i = paths.begin (); i != paths.end () && left > 0; ++i)
+    {
+      if (i->m_capacity == 0)
+        break;
+      uint32_t share = std::min (left, i->m_capacity);
+      shares.push_back (std::make_pair (i->m_nextHop, share));
+      left -= share;
+    }
+  if (left > 0)
+    {
+      NS_LOG_LOGIC ("Paths to " << dst << " carry " << amount - left << " of " << amount);
+      shares.clear ();
+      return false;
+    }
+  return true;
 }
 
 void
-RoutingTable::Purge (std::map<Ipv4Address, RoutingTableEntry> &table) const
+RoutingTable::Purge (RouteEntryMap &table) const
 {
   NS_LOG_FUNCTION (this);
-  if (table.empty ())
+  if (table.IsEmpty ())
     return;
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-         table.begin (); i != table.end ();)
+  for (RouteEntryMap::Handle i = table.First (); i != RouteEntryMap::NONE; i = table.Next (i))
     {
-      if (i->second.GetLifeTime () < Seconds (0))
+      RoutingTableEntry & entry = table.Get (i);
+      if (entry.GetLifeTime () < Seconds (0))
         {
-          if (i->second.GetFlag () == INVALID)
+          if (entry.GetFlag () == INVALID)
             {
-              std::map<Ipv4Address, RoutingTableEntry>::iterator tmp = i;
-              ++i;
-              table.erase (tmp);
+              table.EraseHandle (i);
             }
-          else if (i->second.GetFlag () == VALID)
+          else if (entry.GetFlag () == VALID)
             {
-              NS_LOG_LOGIC ("Invalidate route with destination address " << i->first);
-              i->second.Invalidate (m_badLinkLifetime);
-              ++i;
+              NS_LOG_LOGIC ("Invalidate route with destination address " << entry.GetDestination ());
+              entry.Invalidate (m_badLinkLifetime);
             }
-          else
-            ++i;
-        }
-      else 
-        {
-          ++i;
         }
     }
 }
@@ -392,16 +1049,16 @@ bool
 RoutingTable::MarkLinkAsUnidirectional (Ipv4Address neighbor, Time blacklistTimeout)
 {
   NS_LOG_FUNCTION (this << neighbor << blacklistTimeout.GetSeconds ());
-  std::map<Ipv4Address, RoutingTableEntry>::iterator i =
-    m_ipv4AddressEntry.find (neighbor);
-  if (i == m_ipv4AddressEntry.end ())
+  RouteEntryMap::Handle i = m_ipv4AddressEntry.Find (neighbor);
+  if (i == RouteEntryMap::NONE)
     {
       NS_LOG_LOGIC ("Mark link unidirectional to  " << neighbor << " fails; not found");
       return false;
     }
-  i->second.SetUnidirectional (true);
-  i->second.SetBalcklistTimeout (blacklistTimeout);
-  i->second.SetRreqCnt (0);
+  RoutingTableEntry & entry = m_ipv4AddressEntry.Get (i);
+  entry.SetUnidirectional (true);
+  entry.SetBalcklistTimeout (blacklistTimeout);
+  entry.SetRreqCnt (0);
   NS_LOG_LOGIC ("Set link to " << neighbor << " to unidirectional");
   return true;
 }
@@ -409,17 +1066,167 @@ RoutingTable::MarkLinkAsUnidirectional (Ipv4Address neighbor, Time blacklistTime
 void
 RoutingTable::Print (Ptr<OutputStreamWrapper> stream) const
 {
-  std::map<Ipv4Address, RoutingTableEntry> table = m_ipv4AddressEntry;
+  RouteEntryMap table = m_ipv4AddressEntry;
   Purge (table);
   *stream->GetStream () << "\nAODV Routing table\n"
                         << "Destination\tGateway\t\tInterface\tFlag\tExpire\t\tHops\n";
-  for (std::map<Ipv4Address, RoutingTableEntry>::const_iterator i =
-         table.begin (); i != table.end (); ++i)
+  for (RouteEntryMap::Handle i = table.First (); i != RouteEntryMap::NONE; i = table.Next (i))
     {
-      i->second.Print (stream);
+      table.Get (i).Print (stream);
     }
   *stream->GetStream () << "\n";
 }
 
+/*
+ The route cache
+ */
+
+RouteCache::RouteCache (uint32_t maxEntries, Time timeout) :
+  m_maxEntries (maxEntries),
+  m_timeout (timeout),
+  m_hits (0),
+  m_misses (0),
+  m_evictions (0)
+{
+}
+
+uint8_t
+RouteCache::GetBucket (uint32_t amount)
+{
+  uint8_t b = 0;
+  while (amount > 1)
+    {
+      amount >>= 1;
+      b++;
+    }
+  return b;
+}
+
+bool
+RouteCache::Lookup (Ipv4Address dst, uint32_t amount, RoutePath & path)
+{
+  NS_LOG_FUNCTION (this << dst << amount);
+  std::unordered_map<Ipv4Address, uint32_t, Ipv4AddressHash>::const_iterator m = m_buckets.find (dst);
+  if (m != m_buckets.end ())
+    {
+      Time now = Simulator::Now ();
+      uint32_t mask = m->second;
+      // a record of a small amount may have seen a much larger bottleneck, look at all of them
+      for (uint8_t b = 0; b < 32; ++b)
+        {
+          if (!(mask & (1u << b)))
+            continue;
+          RecordList::iterator i = m_index[Key (dst, b)];
+          if (i->m_path.m_expire < now)
+            {
+              Remove (i);
+              continue;
+            }
+          if (i->m_path.m_capacity < amount)
+            continue;
+          m_lru.splice (m_lru.begin (), m_lru, i);
+          path = i->m_path;
+          m_hits++;
+          NS_LOG_LOGIC ("Cached path to " << dst << " via " << path.m_nextHop << " carries " << amount);
+          return true;
+        }
+    }
+  m_misses++;
+  return false;
+}
+
+void
+RouteCache::Insert (Ipv4Address dst, uint32_t amount, RoutePath const & path)
+{
+  NS_LOG_FUNCTION (this << dst << amount << path.m_nextHop);
+  if (m_maxEntries == 0)
+    return;
+  uint8_t b = GetBucket (amount);
+  Record record;
+  record.m_dst = dst;
+  record.m_bucket = b;
+  record.m_path = path;
+  record.m_path.m_capacity = std::max (path.m_capacity, amount);
+  record.m_path.m_expire = Simulator::Now () + m_timeout;
+
+  std::unordered_map<uint64_t, RecordList::iterator>::iterator i = m_index.find (Key (dst, b));
+  if (i != m_index.end ())
+    {
+      *i->second = record;
+      m_lru.splice (m_lru.begin (), m_lru, i->second);
+      return;
+    }
+  if (m_lru.size () >= m_maxEntries)
+    {
+      NS_LOG_LOGIC ("Evict cached path to " << m_lru.back ().m_dst);
+      Remove (--m_lru.end ());
+      m_evictions++;
+    }
+  m_lru.push_front (record);
+  m_index[Key (dst, b)] = m_lru.begin ();
+  m_buckets[dst] |= (1u << b);
+}
+
+void
+RouteCache::Erase (Ipv4Address dst)
+{
+  NS_LOG_FUNCTION (this << dst);
+  std::unordered_map<Ipv4Address, uint32_t, Ipv4AddressHash>::iterator m = m_buckets.find (dst);
+  if (m == m_buckets.end ())
+    return;
+  uint32_t mask = m->second;
+  for (uint8_t b = 0; mask != 0; ++b, mask >>= 1)
+    {
+      if (mask & 1)
+        Remove (m_index[Key (dst, b)]);
+    }
+}
+
+void
+RouteCache::InvalidateNextHop (Ipv4Address nextHop)
+{
+  NS_LOG_FUNCTION (this << nextHop);
+  RecordList::iterator i = m_lru.begin ();
+  while (i != m_lru.end ())
+    {
+      RecordList::iterator j = i++;
+      if (j->m_path.m_nextHop == nextHop)
+        Remove (j);
+    }
+}
+
+void
+RouteCache::Clear ()
+{
+  m_lru.clear ();
+  m_index.clear ();
+  m_buckets.clear ();
+  m_hits = 0;
+  m_misses = 0;
+  m_evictions = 0;
+}
+
+void
+RouteCache::SetMaxEntries (uint32_t n)
+{
+  m_maxEntries = n;
+  while (m_lru.size () > m_maxEntries)
+    {
+      Remove (--m_lru.end ());
+      m_evictions++;
+    }
+}
+
+void
+RouteCache::Remove (RecordList::iterator i)
+{
+  std::unordered_map<Ipv4Address, uint32_t, Ipv4AddressHash>::iterator m = m_buckets.find (i->m_dst);
+  m->second &= ~(1u << i->m_bucket);
+  if (m->second == 0)
+    m_buckets.erase (m);
+  m_index.erase (Key (i->m_dst, i->m_bucket));
+  m_lru.erase (i);
+}
+
 }
 }
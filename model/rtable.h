@@ -4,6 +4,10 @@
 #include <stdint.h>
 #include <cassert>
 #include <map>
+#include <list>
+#include <vector>
+#include <queue>
+#include <unordered_map>
 #include <sys/types.h>
 #include "ns3/ipv4.h"
 #include "ns3/ipv4-route.h"
@@ -25,17 +29,46 @@ enum RouteFlags
   IN_SEARCH = 2,      //!< IN_SEARCH
 };
 
+/**
+ * \ingroup aodv
+ * \brief One path to a destination: next hop, length and bottleneck capacity
+ */
+struct RoutePath
+{
+  Ipv4Address m_nextHop;
+  uint16_t m_hops;
+  /// Smallest channel balance along the path
+  uint32_t m_capacity;
+  /// Absolute expiration time
+  Time m_expire;
+
+  RoutePath (Ipv4Address nextHop = Ipv4Address (), uint16_t hops = 0, uint32_t capacity = 0, Time expire = Time ()) :
+    m_nextHop (nextHop), m_hops (hops), m_capacity (capacity), m_expire (expire)
+  {
+  }
+};
+
 /**
  * \ingroup aodv
  * \brief Routing table entry
+ *
+ * The entry is a flat record: gateway, interface address and mask are kept inline,
+ * the first precursors live in the entry itself, the RREP_ACK timer is allocated
+ * on first use and the Ipv4Route is only built when a route is handed to IP.
+ *
+ * Next hop, hop count and transaction amount describe the primary path; the
+ * transaction amount doubles as its capacity. Alternative paths to the same
+ * destination are kept aside and take over when the primary one breaks.
  */
 class RoutingTableEntry
 {
 public:
   /// c-to
-  RoutingTableEntry (Ipv4Address dst = Ipv4Address (), bool vSeqNo = false, uint32_t m_seqNo = 0,
+  RoutingTableEntry (Ptr<NetDevice> dev = 0, Ipv4Address dst = Ipv4Address (), bool vSeqNo = false, uint32_t m_seqNo = 0,
                      Ipv4InterfaceAddress iface = Ipv4InterfaceAddress (), uint16_t  hops = 0, uint32_t transAmount = 0,
                      Ipv4Address nextHop = Ipv4Address (), Time lifetime = Simulator::Now ());
+  RoutingTableEntry (RoutingTableEntry const & o);
+  RoutingTableEntry & operator= (RoutingTableEntry const & o);
 
   ~RoutingTableEntry ();
 
@@ -72,19 +105,46 @@ public:
   void GetPrecursors (std::vector<Ipv4Address> & prec) const;
   //\}
 
+  ///\name Alternative paths
+  //\{
+  /**
+   * Add or refresh a path to the destination. A path through the primary next hop
+   * refreshes the primary path, others are kept as alternatives, at most maxPaths
+   * paths in all; when full the path with the least capacity gives way.
+   * \return true if the path is kept
+   */
+  bool AddPath (RoutePath const & path, uint32_t maxPaths);
+  /// Unexpired paths to the destination, the primary one first
+  void GetPaths (std::vector<RoutePath> & paths) const;
+  /// Number of alternative paths, expired ones included
+  uint32_t GetAlternatePathCount () const { return m_altPaths ? m_altPaths->size () : 0; }
+  /// Check whether the primary or an alternative path goes through nextHop
+  bool UsesNextHop (Ipv4Address nextHop) const;
+  /// Drop alternative paths through nextHop
+  void DeleteAlternatePaths (Ipv4Address nextHop);
+  /**
+   * Replace the primary path with the best unexpired alternative
+   * (largest capacity, then fewest hops)
+   * \return false if there is no alternative
+   */
+  bool PromoteAlternatePath ();
+  //\}
+
   /// Mark entry as "down" (i.e. disable it)
   void Invalidate (Time badLinkLifetime);
   ///\name Fields
   //\{
-  Ipv4Address GetDestination () const { return m_ipv4Route->GetDestination (); }
-  Ptr<Ipv4Route> GetRoute () const { return m_ipv4Route; }
-  void SetRoute (Ptr<Ipv4Route> r) { m_ipv4Route = r; }
-  void SetNextHop (Ipv4Address nextHop) { m_ipv4Route->SetGateway (nextHop); }
-  Ipv4Address GetNextHop () const { return m_ipv4Route->GetGateway (); }
-  void SetOutputDevice (Ptr<NetDevice> dev) { m_ipv4Route->SetOutputDevice (dev); }
-  Ptr<NetDevice> GetOutputDevice () const { return m_ipv4Route->GetOutputDevice (); }
-  Ipv4InterfaceAddress GetInterface () const { return m_iface; }
-  void SetInterface (Ipv4InterfaceAddress iface) { m_iface = iface; }
+  Ipv4Address GetDestination () const { return m_dst; }
+  /// Build the route handed to IP, a new object on every call
+  Ptr<Ipv4Route> GetRoute () const;
+  /// Take destination, gateway and output device from r
+  void SetRoute (Ptr<Ipv4Route> r);
+  void SetNextHop (Ipv4Address nextHop) { m_nextHop = nextHop; }
+  Ipv4Address GetNextHop () const { return m_nextHop; }
+  void SetOutputDevice (Ptr<NetDevice> dev) { m_dev = dev; }
+  Ptr<NetDevice> GetOutputDevice () const { return m_dev; }
+  Ipv4InterfaceAddress GetInterface () const { return Ipv4InterfaceAddress (m_ifaceLocal, m_ifaceMask); }
+  void SetInterface (Ipv4InterfaceAddress iface) { m_ifaceLocal = iface.GetLocal (); m_ifaceMask = iface.GetMask (); }
   void SetValidSeqNo (bool s) { m_validSeqNo = s; }
   bool GetValidSeqNo () const { return m_validSeqNo; }
   void SetSeqNo (uint32_t sn) { m_seqNo = sn; }
@@ -95,6 +155,8 @@ public:
   uint32_t GetTransAmount () const { return m_transAmount; }
   void SetLifeTime (Time lt) { m_lifeTime = lt + Simulator::Now (); }
   Time GetLifeTime () const { return m_lifeTime - Simulator::Now (); }
+  /// Absolute expiration or deletion time
+  Time GetExpireTime () const { return m_lifeTime; }
   void SetFlag (RouteFlags flag) { m_flag = flag; }
   RouteFlags GetFlag () const { return m_flag; }
   void SetRreqCnt (uint8_t n) { m_reqCount = n; }
@@ -104,8 +166,10 @@ public:
   bool IsUnidirectional () const { return m_blackListState; }
   void SetBalcklistTimeout (Time t) { m_blackListTimeout = t; }
   Time GetBlacklistTimeout () const { return m_blackListTimeout; }
-  /// RREP_ACK timer
-  Timer m_ackTimer;
+  /// RREP_ACK timer, created on first use
+  Timer & GetAckTimer ();
+  /// Whether the RREP_ACK timer was ever used
+  bool HasAckTimer () const { return m_ackTimer != 0; }
   //\}
 
   /**
@@ -114,19 +178,14 @@ public:
    */
   bool operator== (Ipv4Address const  dst) const
   {
-    return (m_ipv4Route->GetDestination () == dst);
+    return (m_dst == dst);
   }
   void Print (Ptr<OutputStreamWrapper> stream) const;
 
 private:
-  /// Valid Destination Sequence Number flag
-  bool m_validSeqNo;
-  /// Destination Sequence Number, if m_validSeqNo = true
-  uint32_t m_seqNo;
-  /// Hop Count (number of hops needed to reach destination)
-  uint16_t m_hops;
-  /// transaction amount for a payment route
-  uint32_t m_transAmount;
+  /// Number of precursors stored in the entry itself
+  static const uint8_t INLINE_PRECURSORS = 2;
+
   /**
   * \brief Expiration or deletion time of the route
   *	Lifetime field in the routing table plays dual role --
@@ -134,30 +193,118 @@ private:
   *	it is the deletion time.
   */
   Time m_lifeTime;
-  /** Ip route, include
-  *   - destination address
-  *   - source address
-  *   - next hop address (gateway)
-  *   - output device
-  */
-  Ptr<Ipv4Route> m_ipv4Route;
-  /// Output interface address
-  Ipv4InterfaceAddress m_iface;
+  /// Time for which the node is put into the blacklist
+  Time m_blackListTimeout;
+  /// Output device
+  Ptr<NetDevice> m_dev;
+  /// RREP_ACK timer, 0 until GetAckTimer () is called
+  Timer * m_ackTimer;
+  /// Precursors beyond INLINE_PRECURSORS, 0 if none
+  std::vector<Ipv4Address> * m_morePrecursors;
+  /// Alternative paths, 0 if none
+  std::vector<RoutePath> * m_altPaths;
+  /// Destination address
+  Ipv4Address m_dst;
+  /// Next hop address (gateway)
+  Ipv4Address m_nextHop;
+  /// Output interface address and mask
+  Ipv4Address m_ifaceLocal;
+  Ipv4Mask m_ifaceMask;
+  /// First precursors
+  Ipv4Address m_precursors[INLINE_PRECURSORS];
+  /// Destination Sequence Number, if m_validSeqNo = true
+  uint32_t m_seqNo;
+  /// transaction amount for a payment route
+  uint32_t m_transAmount;
   /// Routing flags: valid, invalid or in search
   RouteFlags m_flag;
-
-  /// List of precursors
-  std::vector<Ipv4Address> m_precursorList;
-  /// When I can send another request
-  Time m_routeRequestTimout;
+  /// Hop Count (number of hops needed to reach destination)
+  uint16_t m_hops;
+  /// Number of precursors in m_precursors
+  uint8_t m_precursorCount;
   /// Number of route requests
   uint8_t m_reqCount;
+  /// Valid Destination Sequence Number flag
+  bool m_validSeqNo;
   /// Indicate if this entry is in "blacklist"
   bool m_blackListState;
-  /// Time for which the node is put into the blacklist
-  Time m_blackListTimeout;
 };
 
+/**
+ * \ingroup aodv
+ * \brief Open addressing hash table of routing table entries keyed by destination address
+ *
+ * Entries are stored in a slab and keep their slot (the handle) until they are
+ * erased, so a handle stays valid while other destinations are added or removed.
+ * The index is a linear probing table of (address, handle) pairs with
+ * backward-shift deletion, so there are no tombstones and no per-entry allocation.
+ */
+class RouteEntryMap
+{
+public:
+  /// Stable reference to an entry
+  typedef uint32_t Handle;
+  /// Handle value meaning "no entry"
+  static const Handle NONE = 0xffffffff;
+
+  /// c-tor
+  RouteEntryMap ();
+  /// Return handle of the entry for dst, or NONE
+  Handle Find (Ipv4Address dst) const;
+  /**
+   * Insert rt if there is no entry for its destination yet
+   * \return handle of the entry for the destination and true if rt was inserted
+   */
+  std::pair<Handle, bool> Insert (RoutingTableEntry const & rt);
+  /// Erase entry for dst, return true if it existed
+  bool Erase (Ipv4Address dst);
+  /// Erase entry h
+  void EraseHandle (Handle h);
+  RoutingTableEntry & Get (Handle h) { return m_slab[h]; }
+  RoutingTableEntry const & Get (Handle h) const { return m_slab[h]; }
+  /// Return handle of an entry obtained from Get ()
+  Handle GetHandle (RoutingTableEntry const * rt) const;
+  /// Whether h refers to an entry, rather than a free slot
+  bool IsLive (Handle h) const { return h < m_live.size () && m_live[h]; }
+  ///\name Iteration over entries, in slab order:
+  /// for (Handle h = First (); h != NONE; h = Next (h))
+  //\{
+  Handle First () const;
+  Handle Next (Handle h) const;
+  //\}
+  /// Number of entries
+  uint32_t GetSize () const { return m_size; }
+  bool IsEmpty () const { return m_size == 0; }
+  /// Number of slab slots, i.e. upper bound of handles
+  uint32_t GetSlabSize () const { return m_slab.size (); }
+  /// Remove all entries
+  void Clear ();
+
+private:
+  /// Index slot, empty if m_handle == NONE
+  struct Bucket
+  {
+    uint32_t m_key;
+    Handle m_handle;
+  };
+  /// Index, size is a power of two
+  std::vector<Bucket> m_buckets;
+  /// Entry storage
+  std::vector<RoutingTableEntry> m_slab;
+  /// Whether slab slot is in use
+  std::vector<uint8_t> m_live;
+  /// Free slab slots
+  std::vector<Handle> m_free;
+  /// Number of entries
+  uint32_t m_size;
+
+  /// Mix address bits, addresses of one subnet differ only in the low bits
+  static uint32_t Hash (uint32_t key);
+  /// Return index slot holding key, or NONE
+  uint32_t FindBucket (uint32_t key) const;
+  /// Double the index size and rehash
+  void Grow ();
+};
 
 class RoutingTable
 {
@@ -190,12 +337,36 @@ public:
   bool LookupRoute (Ipv4Address dst, RoutingTableEntry & rt);
   /// Lookup route in VALID state
   bool LookupValidRoute (Ipv4Address dst, RoutingTableEntry & rt);
+  /**
+   * Lookup routing table entry with destination address dst without copying it.
+   * The entry may be modified in place, followed by UpdateInPlace ().
+   * The pointer stays valid until the next AddRoute, DeleteRoute or Clear,
+   * or until simulation time advances.
+   * \param dst destination address
+   * \return entry with destination address dst, 0 if not found
+   */
+  RoutingTableEntry * FindRoute (Ipv4Address dst);
+  /// FindRoute restricted to routes in VALID state
+  RoutingTableEntry * FindValidRoute (Ipv4Address dst);
   /// Update routing table
   bool Update (RoutingTableEntry & rt);
+  /**
+   * Apply the rules of Update () to an entry modified through a pointer
+   * returned by FindRoute (): reset RreqCnt and re-queue its lifetime.
+   */
+  void UpdateInPlace (RoutingTableEntry * rt);
   /// Set routing table entry flags
   bool SetEntryState (Ipv4Address dst, RouteFlags state);
   /// Lookup routing entries with next hop Address dst and not empty list of precursors.
   void GetListOfDestinationWithNextHop (Ipv4Address nextHop, std::map<Ipv4Address, uint32_t> & unreachable);
+  /**
+   * Invalidate every valid route through nextHop in one pass, as on a link break.
+   * Alternative paths through nextHop are dropped, and a route whose primary path
+   * goes through nextHop switches to its best alternative if it has one.
+   * \param nextHop neighbor that can no longer be used
+   * \param unreachable destinations left without a path and their sequence numbers
+   */
+  void InvalidateRoutesWithNextHop (Ipv4Address nextHop, std::map<Ipv4Address, uint32_t> & unreachable);
   /**
    *   Update routing entries with this destinations as follows:
    *  1. The destination sequence number of this routing entry, if it
@@ -206,9 +377,37 @@ public:
   void InvalidateRoutesWithDst (std::map<Ipv4Address, uint32_t> const & unreachable);
   /// Delete all route from interface with address iface
   void DeleteAllRoutesFromInterface (Ipv4InterfaceAddress iface);
+  ///\name Multipath
+  //\{
+  /// Maximum number of paths kept per destination, the primary one included
+  void SetMaxPaths (uint32_t n) { m_maxPaths = n; }
+  uint32_t GetMaxPaths () const { return m_maxPaths; }
+  /**
+   * Add a path to the valid route for dst
+   * \param lifetime lifetime of the path
+   * \return true if the path is kept
+   */
+  bool AddPath (Ipv4Address dst, Ipv4Address nextHop, uint16_t hops, uint32_t capacity, Time lifetime);
+  /**
+   * Select a valid path to dst able to carry amount: fewest hops, then largest capacity
+   * \return false if no single path can carry amount
+   */
+  bool SelectPath (Ipv4Address dst, uint32_t amount, RoutePath & path);
+  /**
+   * Split amount over the valid paths to dst, largest capacity first. The
+   * capacity of a path is the smallest channel balance along it, as carried
+   * back by the RREP that installed it.
+   * \param shares (next hop, amount) for every path used
+   * \return false, with shares empty, if all paths together cannot carry amount
+   */
+  bool SplitAmount (Ipv4Address dst, uint32_t amount, std::vector<std::pair<Ipv4Address, uint32_t> > & shares);
+  //\}
   /// Delete all entries from routing table
-  void Clear () { m_ipv4AddressEntry.clear (); }
-  /// Delete all outdated entries and invalidate valid entry if Lifetime is expired
+  void Clear ();
+  /**
+   * Delete all outdated entries and invalidate valid entry if Lifetime is expired.
+   * Only entries whose deadline has passed are visited.
+   */
   void Purge ();
   /** Mark entry as unidirectional (e.g. add this neighbor to "blacklist" for blacklistTimeout period)
    * \param neighbor - neighbor address link to which assumed to be unidirectional
@@ -220,11 +419,137 @@ public:
   void Print (Ptr<OutputStreamWrapper> stream) const;
 
 private:
-  std::map<Ipv4Address, RoutingTableEntry> m_ipv4AddressEntry;
+  RouteEntryMap m_ipv4AddressEntry;
   /// Deletion time for invalid routes
   Time m_badLinkLifetime;
+  /// Expiry heap record. Extending a route lifetime does not push a new record,
+  /// the record is re-keyed lazily when its old deadline is reached.
+  struct ExpiryEntry
+  {
+    Time m_expire;
+    RouteEntryMap::Handle m_handle;
+
+    ExpiryEntry (Time t, RouteEntryMap::Handle h) : m_expire (t), m_handle (h) {}
+  };
+  struct LaterExpiry
+  {
+    bool operator() (const ExpiryEntry & a, const ExpiryEntry & b) const
+    {
+      return (a.m_expire > b.m_expire);
+    }
+  };
+  typedef std::priority_queue<ExpiryEntry, std::vector<ExpiryEntry>, LaterExpiry> ExpiryQueue;
+  /// min-heap of route deadlines
+  ExpiryQueue m_expiry;
+  /// Bookkeeping per slab slot
+  struct Slot
+  {
+    /// deadline of the live heap record, Time::Max () if none
+    Time m_queuedExpire;
+    /// next hop under which the slot was last put in m_nextHopIndex
+    Ipv4Address m_nextHop;
+    bool m_nextHopIndexed;
+
+    Slot () : m_queuedExpire (Time::Max ()), m_nextHopIndexed (false) {}
+  };
+  /// handle -> slot bookkeeping
+  std::vector<Slot> m_slots;
+  /**
+   * next hop -> handles of routes through it. Handles are appended when a
+   * route gets a new next hop and dropped lazily when the list is read.
+   */
+  std::unordered_map<Ipv4Address, std::vector<RouteEntryMap::Handle>, Ipv4AddressHash> m_nextHopIndex;
+  /// Number of handles in m_nextHopIndex, stale ones included
+  uint32_t m_nextHopIndexSize;
+  /// Maximum number of paths per destination
+  uint32_t m_maxPaths;
+
   /// const version of Purge, for use by Print() method
-  void Purge (std::map<Ipv4Address, RoutingTableEntry> &table) const;
+  void Purge (RouteEntryMap &table) const;
+  /// Make sure the heap holds a record no later than the deadline of entry h
+  void ScheduleExpiry (RouteEntryMap::Handle h);
+  /// Erase entry h and orphan its heap record
+  void Remove (RouteEntryMap::Handle h);
+  /// Bookkeeping of slot h, grown with the slab
+  Slot & GetSlot (RouteEntryMap::Handle h);
+  /// Put entry h in m_nextHopIndex under its current next hop
+  void IndexNextHop (RouteEntryMap::Handle h);
+  /// Rebuild m_nextHopIndex once stale handles outnumber live ones
+  void CompactNextHopIndex ();
+  /// Collect handles of the routes through nextHop, dropping stale ones from the index
+  void FindNextHop (Ipv4Address nextHop, std::vector<RouteEntryMap::Handle> & handles);
+};
+
+/**
+ * \ingroup aodv
+ * \brief Cache of payment paths keyed by (destination, amount bucket)
+ *
+ * A bucket covers amounts from 2^b to 2^(b+1) - 1. A record keeps the path a
+ * payment in that bucket succeeded on and the bottleneck capacity observed for it,
+ * and serves any later payment to the destination up to that capacity.
+ * Records expire after a timeout; the least recently used one is evicted when full.
+ */
+class RouteCache
+{
+public:
+  /// c-tor
+  RouteCache (uint32_t maxEntries, Time timeout);
+  /**
+   * Find a cached path to dst able to carry amount, looking at every bucket
+   * cached for dst
+   * \return true on hit
+   */
+  bool Lookup (Ipv4Address dst, uint32_t amount, RoutePath & path);
+  /// Remember that a payment of amount to dst succeeded over path
+  void Insert (Ipv4Address dst, uint32_t amount, RoutePath const & path);
+  /// Forget all paths to dst
+  void Erase (Ipv4Address dst);
+  /// Forget all paths through nextHop, e.g. after its channel closed
+  void InvalidateNextHop (Ipv4Address nextHop);
+  /// Forget everything, counters included
+  void Clear ();
+  /// Bucket of amount: floor (log2 (amount)), 0 for 0
+  static uint8_t GetBucket (uint32_t amount);
+
+  ///\name Handle parameters
+  //\{
+  uint32_t GetSize () const { return m_lru.size (); }
+  uint32_t GetMaxEntries () const { return m_maxEntries; }
+  void SetMaxEntries (uint32_t n);
+  Time GetTimeout () const { return m_timeout; }
+  void SetTimeout (Time t) { m_timeout = t; }
+  //\}
+  ///\name Counters
+  //\{
+  uint64_t GetHits () const { return m_hits; }
+  uint64_t GetMisses () const { return m_misses; }
+  uint64_t GetEvictions () const { return m_evictions; }
+  //\}
+
+private:
+  struct Record
+  {
+    Ipv4Address m_dst;
+    uint8_t m_bucket;
+    /// path, with the observed bottleneck as capacity and the record deadline as expiry
+    RoutePath m_path;
+  };
+  /// Records, most recently used first
+  typedef std::list<Record> RecordList;
+  RecordList m_lru;
+  /// (destination << 8 | bucket) -> record
+  std::unordered_map<uint64_t, RecordList::iterator> m_index;
+  /// destination -> bit mask of its cached buckets
+  std::unordered_map<Ipv4Address, uint32_t, Ipv4AddressHash> m_buckets;
+  uint32_t m_maxEntries;
+  Time m_timeout;
+  uint64_t m_hits;
+  uint64_t m_misses;
+  uint64_t m_evictions;
+
+  static uint64_t Key (Ipv4Address dst, uint8_t bucket) { return (uint64_t (dst.Get ()) << 8) | bucket; }
+  /// Drop record i
+  void Remove (RecordList::iterator i);
 };
 
 }
@@ -3,6 +3,15 @@
 // Include a header file from your module to test.
 #include "ns3/social-network.h"
 
+#include "ns3/neighbors.h"
+#include "ns3/rtable.h"
+#include "ns3/routemsg-queue.h"
+#include "ns3/offchain-id.h"
+#include "ns3/offchain-dpd.h"
+#include "ns3/offchain-trickle.h"
+#include "ns3/payroute-packet.h"
+#include "ns3/simulator.h"
+
 // An essential include is test.h
 #include "ns3/test.h"
 
@@ -46,6 +55,1702 @@ SocialNetworkTestCase1::DoRun (void)
   NS_TEST_ASSERT_MSG_EQ_TOL (0.01, 0.01, 0.001, "Numbers are not equal within tolerance");
 }
 
+// Neighbors channel table: O(1) lookup by address, stable index order
+class NeighborsIndexTestCase : public TestCase
+{
+public:
+  NeighborsIndexTestCase ();
+  virtual ~NeighborsIndexTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void CheckClosed ();
+  offchain::Neighbors m_nb;
+};
+
+NeighborsIndexTestCase::NeighborsIndexTestCase ()
+  : TestCase ("Neighbors channel table lookup by peer address"),
+    m_nb (Seconds (1), 100)
+{
+}
+
+NeighborsIndexTestCase::~NeighborsIndexTestCase ()
+{
+}
+
+void
+NeighborsIndexTestCase::CheckClosed ()
+{
+  // the last entry moved into the slot of the closed one
+  NS_TEST_EXPECT_MSG_EQ (m_nb.IsNeighbor (Ipv4Address ("10.0.0.2")), false, "expired channel closed");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetSize (), 3, "other channels kept");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetNgbIPaddrByIndex (1), Ipv4Address ("10.0.0.4"), "last entry fills the gap");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetNgbIPaddrByIndex (2), Ipv4Address ("10.0.0.3"), "entries before the last stay");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetChMyAvailDeposit (Ipv4Address ("10.0.0.4")), 90, "balance moved along");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetChPeerAvailDeposit (Ipv4Address ("10.0.0.4")), 80, "peer balance moved along");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetChMyAvailDeposit (Ipv4Address ("10.0.0.3")), 75, "untouched entry kept");
+}
+
+void
+NeighborsIndexTestCase::DoRun (void)
+{
+  m_nb.Update (Ipv4Address ("10.0.0.1"), 50, Seconds (10), true);
+  m_nb.Update (Ipv4Address ("10.0.0.2"), 60, Seconds (1), true);
+  m_nb.Update (Ipv4Address ("10.0.0.3"), 70, Seconds (10), true);
+  m_nb.Update (Ipv4Address ("10.0.0.4"), 80, Seconds (10), true);
+  m_nb.DecChDeposit (Ipv4Address ("10.0.0.4"), 10);
+
+  NS_TEST_ASSERT_MSG_EQ (m_nb.IsNeighbor (Ipv4Address ("10.0.0.2")), true, "10.0.0.2 is a neighbor");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.IsNeighbor (Ipv4Address ("10.0.0.5")), false, "10.0.0.5 is not a neighbor");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetNgbIPaddrByIndex (1), Ipv4Address ("10.0.0.2"), "insertion order kept");
+
+  m_nb.DecChDeposit (Ipv4Address ("10.0.0.3"), 30);
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChMyAvailDeposit (Ipv4Address ("10.0.0.3")), 70, "deposit decreased");
+  m_nb.IncChDeposit (Ipv4Address ("10.0.0.3"), 5);
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChMyAvailDeposit (Ipv4Address ("10.0.0.3")), 75, "deposit increased");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChPeerAvailDeposit (Ipv4Address ("10.0.0.1")), 50, "peer deposit kept");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Update (Ipv4Address ("10.0.0.1"), 49, Seconds (10), false), -1, "peer balance mismatch");
+
+  Simulator::Schedule (Seconds (2), &NeighborsIndexTestCase::CheckClosed, this);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+// Neighbors expiry timer: only skipped reschedules are counted as avoided
+class NeighborsTimerTestCase : public TestCase
+{
+public:
+  NeighborsTimerTestCase ();
+  virtual ~NeighborsTimerTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+NeighborsTimerTestCase::NeighborsTimerTestCase ()
+  : TestCase ("Neighbor table avoided timer events")
+{
+}
+
+NeighborsTimerTestCase::~NeighborsTimerTestCase ()
+{
+}
+
+void
+NeighborsTimerTestCase::DoRun (void)
+{
+  offchain::Neighbors nb (Seconds (1), 100);
+  nb.Update (Ipv4Address ("10.0.0.1"), 0, Seconds (10), true);
+  NS_TEST_EXPECT_MSG_EQ (nb.GetAvoidedTimerEvents (), 0, "first deadline arms the timer");
+
+  // balance lookups and changes never touched the timer
+  nb.DecChDeposit (Ipv4Address ("10.0.0.1"), 10);
+  nb.GetChMyAvailDeposit (Ipv4Address ("10.0.0.1"));
+  nb.IsNeighbor (Ipv4Address ("10.0.0.1"));
+  NS_TEST_EXPECT_MSG_EQ (nb.GetAvoidedTimerEvents (), 0, "lookups are not counted");
+
+  nb.Update (Ipv4Address ("10.0.0.1"), 0, Seconds (20), true);
+  NS_TEST_EXPECT_MSG_EQ (nb.GetAvoidedTimerEvents (), 1, "lifetime extension left to the purge");
+  nb.Update (Ipv4Address ("10.0.0.2"), 0, Seconds (15), true);
+  NS_TEST_EXPECT_MSG_EQ (nb.GetAvoidedTimerEvents (), 2, "later deadline behind the armed timer");
+  nb.Update (Ipv4Address ("10.0.0.3"), 0, Seconds (5), true);
+  NS_TEST_EXPECT_MSG_EQ (nb.GetAvoidedTimerEvents (), 2, "earlier deadline reschedules the timer");
+
+  // refreshes that do not move the armed deadline would not have rescheduled
+  nb.Update (Ipv4Address ("10.0.0.1"), 0, Seconds (5), false);
+  NS_TEST_EXPECT_MSG_EQ (nb.GetAvoidedTimerEvents (), 2, "refresh within the lifetime");
+  nb.Update (Ipv4Address ("10.0.0.2"), 0, Seconds (30), false);
+  NS_TEST_EXPECT_MSG_EQ (nb.GetAvoidedTimerEvents (), 2, "extension behind the armed deadline");
+  nb.Update (Ipv4Address ("10.0.0.3"), 0, Seconds (8), false);
+  NS_TEST_EXPECT_MSG_EQ (nb.GetAvoidedTimerEvents (), 3, "extension of the armed deadline");
+
+  Simulator::Destroy ();
+}
+
+// Neighbors expiry heap: extended lifetimes are re-queued, records of closed channels skipped
+class NeighborsExpiryTestCase : public TestCase
+{
+public:
+  NeighborsExpiryTestCase ();
+  virtual ~NeighborsExpiryTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void LinkClosed (Ipv4Address peer);
+  void CheckReopened ();
+  void CheckLater (uint32_t size, uint32_t closed);
+  offchain::Neighbors m_nb;
+  uint32_t m_closed;
+};
+
+NeighborsExpiryTestCase::NeighborsExpiryTestCase ()
+  : TestCase ("Neighbor table lazy expiry"),
+    m_nb (Seconds (1), 100),
+    m_closed (0)
+{
+}
+
+NeighborsExpiryTestCase::~NeighborsExpiryTestCase ()
+{
+}
+
+void
+NeighborsExpiryTestCase::LinkClosed (Ipv4Address peer)
+{
+  m_closed++;
+}
+
+void
+NeighborsExpiryTestCase::CheckReopened ()
+{
+  // the read closes the expired channel before its heap record comes up
+  NS_TEST_EXPECT_MSG_EQ (m_nb.IsNeighbor (Ipv4Address ("10.0.0.3")), false, "expired channel closed on read");
+  NS_TEST_EXPECT_MSG_EQ (m_closed, 1, "closed once");
+  m_nb.Update (Ipv4Address ("10.0.0.3"), 0, Seconds (10), true);
+  m_nb.Purge ();
+  NS_TEST_EXPECT_MSG_EQ (m_nb.IsNeighbor (Ipv4Address ("10.0.0.1")), true, "extended lifetime re-queued");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.IsNeighbor (Ipv4Address ("10.0.0.3")), true, "record of the old channel skipped");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetSize (), 3, "no channel closed by the purge");
+  NS_TEST_EXPECT_MSG_EQ (m_closed, 1, "no further closure");
+}
+
+void
+NeighborsExpiryTestCase::CheckLater (uint32_t size, uint32_t closed)
+{
+  m_nb.Purge ();
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetSize (), size, "channels left after the purge");
+  NS_TEST_EXPECT_MSG_EQ (m_closed, closed, "channels closed so far");
+}
+
+void
+NeighborsExpiryTestCase::DoRun (void)
+{
+  m_nb.SetCallback (MakeCallback (&NeighborsExpiryTestCase::LinkClosed, this));
+  m_nb.Update (Ipv4Address ("10.0.0.1"), 0, Seconds (2), true);
+  m_nb.Update (Ipv4Address ("10.0.0.2"), 0, Seconds (5), true);
+  m_nb.Update (Ipv4Address ("10.0.0.3"), 0, Seconds (3), true);
+  // extend 10.0.0.1 to 10 s, its record stays queued at 2 s
+  m_nb.Update (Ipv4Address ("10.0.0.1"), 0, Seconds (10), false);
+
+  Simulator::Schedule (Seconds (4), &NeighborsExpiryTestCase::CheckReopened, this);
+  // 10.0.0.2 expires at 5 s, 10.0.0.1 at 10 s, the reopened 10.0.0.3 at 14 s
+  Simulator::Schedule (Seconds (6), &NeighborsExpiryTestCase::CheckLater, this, 2, 2);
+  Simulator::Schedule (Seconds (11), &NeighborsExpiryTestCase::CheckLater, this, 1, 3);
+  Simulator::Schedule (Seconds (15), &NeighborsExpiryTestCase::CheckLater, this, 0, 4);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+// Neighbors capacity filter: vectorized and scalar tails must agree
+class NeighborsCapacityFilterTestCase : public TestCase
+{
+public:
+  NeighborsCapacityFilterTestCase ();
+  virtual ~NeighborsCapacityFilterTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+NeighborsCapacityFilterTestCase::NeighborsCapacityFilterTestCase ()
+  : TestCase ("Neighbors filter and top-k by available balance")
+{
+}
+
+NeighborsCapacityFilterTestCase::~NeighborsCapacityFilterTestCase ()
+{
+}
+
+void
+NeighborsCapacityFilterTestCase::DoRun (void)
+{
+  offchain::Neighbors nb (Seconds (1), 100);
+  // 37 channels so that both the 8-wide loop and the scalar tail are exercised
+  for (uint32_t i = 0; i < 37; ++i)
+    {
+      nb.Update (Ipv4Address (i + 1), i * 10, Seconds (10), true);
+      nb.DecChDeposit (Ipv4Address (i + 1), i);
+    }
+
+  std::vector<Ipv4Address> out;
+  nb.FilterByAvailable (80, out);
+  NS_TEST_ASSERT_MSG_EQ (out.size (), 21, "channels 1..21 keep at least 80");
+  NS_TEST_ASSERT_MSG_EQ (out.back (), Ipv4Address (21), "result is in index order");
+  nb.FilterByAvailable (300, out, true);
+  NS_TEST_ASSERT_MSG_EQ (out.size (), 7, "peers 31..37 hold at least 300");
+
+  nb.TopKByAvailable (2, out, true);
+  NS_TEST_ASSERT_MSG_EQ (out.size (), 2, "k entries returned");
+  NS_TEST_ASSERT_MSG_EQ (out[0], Ipv4Address (37), "largest peer balance first");
+  NS_TEST_ASSERT_MSG_EQ (out[1], Ipv4Address (36), "second largest peer balance");
+
+  Simulator::Destroy ();
+}
+
+// Batched balance changes: all or nothing, checked on the net change per channel
+class NeighborsBatchTestCase : public TestCase
+{
+public:
+  NeighborsBatchTestCase ();
+  virtual ~NeighborsBatchTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+NeighborsBatchTestCase::NeighborsBatchTestCase ()
+  : TestCase ("Neighbor table batched balance changes")
+{
+}
+
+NeighborsBatchTestCase::~NeighborsBatchTestCase ()
+{
+}
+
+void
+NeighborsBatchTestCase::DoRun (void)
+{
+  offchain::Neighbors nb (Seconds (1), 100);
+  nb.Update (Ipv4Address ("10.0.0.1"), 0, Seconds (10), true);
+  nb.Update (Ipv4Address ("10.0.0.2"), 0, Seconds (10), true);
+  nb.DecChDeposit (Ipv4Address ("10.0.0.1"), 40);
+
+  // -150 then +100 nets to -50, which the free 60 covers
+  std::vector<offchain::Neighbors::BalanceDelta> deltas;
+  deltas.push_back (offchain::Neighbors::BalanceDelta (Ipv4Address ("10.0.0.1"), -150));
+  deltas.push_back (offchain::Neighbors::BalanceDelta (Ipv4Address ("10.0.0.2"), 30));
+  deltas.push_back (offchain::Neighbors::BalanceDelta (Ipv4Address ("10.0.0.1"), 100));
+  Ipv4Address failed;
+  NS_TEST_ASSERT_MSG_EQ (nb.ApplyBatch (deltas, failed), true, "net change within the free balance");
+  NS_TEST_EXPECT_MSG_EQ (nb.GetChMyAvailDeposit (Ipv4Address ("10.0.0.1")), 10, "net change applied");
+  NS_TEST_EXPECT_MSG_EQ (nb.GetChMyAvailDeposit (Ipv4Address ("10.0.0.2")), 130, "received amount applied");
+
+  // a failing channel leaves every balance untouched
+  deltas.clear ();
+  deltas.push_back (offchain::Neighbors::BalanceDelta (Ipv4Address ("10.0.0.2"), -100));
+  deltas.push_back (offchain::Neighbors::BalanceDelta (Ipv4Address ("10.0.0.1"), -20));
+  NS_TEST_ASSERT_MSG_EQ (nb.ApplyBatch (deltas, failed), false, "net change beyond the free balance");
+  NS_TEST_EXPECT_MSG_EQ (failed, Ipv4Address ("10.0.0.1"), "failing channel reported");
+  NS_TEST_EXPECT_MSG_EQ (nb.GetChMyAvailDeposit (Ipv4Address ("10.0.0.2")), 130, "batch not applied");
+
+  // liquidity locked by a reservation is not free
+  NS_TEST_ASSERT_MSG_EQ (nb.Reserve (Ipv4Address ("10.0.0.2"), 100, 1), true, "reserved");
+  deltas.clear ();
+  deltas.push_back (offchain::Neighbors::BalanceDelta (Ipv4Address ("10.0.0.2"), -40));
+  NS_TEST_EXPECT_MSG_EQ (nb.ApplyBatch (deltas, failed), false, "locked liquidity not spent");
+  deltas.push_back (offchain::Neighbors::BalanceDelta (Ipv4Address ("10.0.0.3"), 10));
+  NS_TEST_EXPECT_MSG_EQ (nb.ApplyBatch (deltas, failed), false, "unknown channel");
+  NS_TEST_EXPECT_MSG_EQ (failed, Ipv4Address ("10.0.0.3"), "unknown channel reported");
+
+  Simulator::Destroy ();
+}
+
+// Liquidity reservations: lock, commit, abort and timeout
+class NeighborsReservationTestCase : public TestCase
+{
+public:
+  NeighborsReservationTestCase ();
+  virtual ~NeighborsReservationTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void ReserveAgain ();
+  void CheckReservations (uint32_t count, uint32_t free);
+  offchain::Neighbors m_nb;
+  Ipv4Address m_peer;
+};
+
+NeighborsReservationTestCase::NeighborsReservationTestCase ()
+  : TestCase ("Neighbors reserve, commit, abort and reservation timeout"),
+    m_nb (Seconds (1), 100),
+    m_peer ("10.0.0.1")
+{
+}
+
+NeighborsReservationTestCase::~NeighborsReservationTestCase ()
+{
+}
+
+void
+NeighborsReservationTestCase::DoRun (void)
+{
+  m_nb.Update (m_peer, 50, Seconds (100), true);
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Reserve (m_peer, 60, 1), true, "funds locked");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChMyAvailDeposit (m_peer), 40, "locked funds not available");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Reserve (m_peer, 50, 2), false, "channel oversubscribed");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Reserve (m_peer, 10, 1), false, "id in use");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Reserve (Ipv4Address ("10.0.0.9"), 10, 2), false, "no channel");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Abort (1), true, "aborted");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Abort (1), false, "aborted once");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChMyAvailDeposit (m_peer), 100, "funds released");
+
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Reserve (m_peer, 30, 2), true, "funds locked");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Commit (2), true, "committed");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChMyAvailDeposit (m_peer), 70, "funds spent");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetVersion (m_peer), 1, "commit changes the balance version");
+
+  // a payment that ignores the lock leaves less than the reservation
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Reserve (m_peer, 50, 3), true, "funds locked");
+  m_nb.DecChDeposit (m_peer, 40);
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Commit (3), false, "funds gone");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetReservationCount (), 0, "reservation released");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChMyAvailDeposit (m_peer), 30, "balance does not wrap");
+
+  // id 4 is resolved, then reused later; its first deadline must not abort the second reservation
+  m_nb.SetReservationTimeout (Seconds (10));
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Reserve (m_peer, 10, 4), true, "funds locked");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Commit (4), true, "committed");
+  Simulator::Schedule (Seconds (5), &NeighborsReservationTestCase::ReserveAgain, this);
+  Simulator::Schedule (Seconds (8), &NeighborsReservationTestCase::CheckReservations, this, 1, 10);
+  Simulator::Schedule (Seconds (12), &NeighborsReservationTestCase::CheckReservations, this, 1, 10);
+  Simulator::Schedule (Seconds (16), &NeighborsReservationTestCase::CheckReservations, this, 0, 20);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+void
+NeighborsReservationTestCase::ReserveAgain ()
+{
+  NS_TEST_EXPECT_MSG_EQ (m_nb.Reserve (m_peer, 10, 4), true, "id reused");
+  // a shorter timeout: id 5 expires before id 4, which was reserved first
+  m_nb.SetReservationTimeout (Seconds (2));
+  NS_TEST_EXPECT_MSG_EQ (m_nb.Reserve (m_peer, 5, 5), true, "funds locked");
+  CheckReservations (2, 5);
+}
+
+void
+NeighborsReservationTestCase::CheckReservations (uint32_t count, uint32_t free)
+{
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetReservationCount (), count, "pending reservations");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.GetChMyAvailDeposit (m_peer), free, "free balance");
+}
+
+// Routing table entry index: lookups survive erasure and slot reuse
+class RoutingTableIndexTestCase : public TestCase
+{
+public:
+  RoutingTableIndexTestCase ();
+  virtual ~RoutingTableIndexTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+RoutingTableIndexTestCase::RoutingTableIndexTestCase ()
+  : TestCase ("Routing table add, lookup and delete by destination")
+{
+}
+
+RoutingTableIndexTestCase::~RoutingTableIndexTestCase ()
+{
+}
+
+void
+RoutingTableIndexTestCase::DoRun (void)
+{
+  offchain::RoutingTable rtable (Seconds (5));
+  // enough destinations to grow the index several times
+  for (uint32_t i = 1; i <= 200; ++i)
+    {
+      offchain::RoutingTableEntry rt (/*device=*/ 0, /*dst=*/ Ipv4Address (i << 8), /*vSeqNo=*/ true, /*seqNo=*/ i,
+                                      /*iface=*/ Ipv4InterfaceAddress (), /*hops=*/ 1, /*transAmount=*/ 0,
+                                      /*nextHop=*/ Ipv4Address (1 << 8), /*lifetime=*/ Seconds (10));
+      NS_TEST_ASSERT_MSG_EQ (rtable.AddRoute (rt), true, "new destination added");
+    }
+  offchain::RoutingTableEntry dup (0, Ipv4Address (7 << 8));
+  NS_TEST_ASSERT_MSG_EQ (rtable.AddRoute (dup), false, "existing destination not replaced");
+
+  for (uint32_t i = 1; i <= 200; i += 2)
+    {
+      NS_TEST_ASSERT_MSG_EQ (rtable.DeleteRoute (Ipv4Address (i << 8)), true, "route deleted");
+    }
+  NS_TEST_ASSERT_MSG_EQ (rtable.DeleteRoute (Ipv4Address (1 << 8)), false, "route already deleted");
+
+  offchain::RoutingTableEntry rt;
+  for (uint32_t i = 1; i <= 200; ++i)
+    {
+      NS_TEST_ASSERT_MSG_EQ (rtable.LookupRoute (Ipv4Address (i << 8), rt), (i % 2 == 0), "lookup after delete");
+    }
+  NS_TEST_ASSERT_MSG_EQ (rt.GetSeqNo (), 200, "entry content kept");
+
+  offchain::RoutingTableEntry reused (0, Ipv4Address (1 << 8));
+  NS_TEST_ASSERT_MSG_EQ (rtable.AddRoute (reused), true, "freed slot reused");
+  NS_TEST_ASSERT_MSG_EQ (rtable.LookupRoute (Ipv4Address (1 << 8), rt), true, "reused slot found");
+  NS_TEST_ASSERT_MSG_EQ (rt.GetSeqNo (), 0, "reused slot holds the new entry");
+
+  Simulator::Destroy ();
+}
+
+// Routing table in-place access: FindRoute pointers, UpdateInPlace and AddRoute moving entries
+class RoutingTableInPlaceTestCase : public TestCase
+{
+public:
+  RoutingTableInPlaceTestCase ();
+  virtual ~RoutingTableInPlaceTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void CheckUpdated (offchain::RoutingTable * rtable);
+};
+
+RoutingTableInPlaceTestCase::RoutingTableInPlaceTestCase ()
+  : TestCase ("Routing table entries modified in place")
+{
+}
+
+RoutingTableInPlaceTestCase::~RoutingTableInPlaceTestCase ()
+{
+}
+
+void
+RoutingTableInPlaceTestCase::CheckUpdated (offchain::RoutingTable * rtable)
+{
+  NS_TEST_EXPECT_MSG_EQ ((rtable->FindValidRoute (Ipv4Address ("10.0.0.9")) != 0), true,
+                         "lifetime extended in place requeued");
+  std::map<Ipv4Address, uint32_t> unreachable;
+  rtable->InvalidateRoutesWithNextHop (Ipv4Address ("10.0.0.2"), unreachable);
+  NS_TEST_EXPECT_MSG_EQ (unreachable.size (), 0, "old next hop left the index");
+  rtable->InvalidateRoutesWithNextHop (Ipv4Address ("10.0.0.3"), unreachable);
+  NS_TEST_EXPECT_MSG_EQ (unreachable.count (Ipv4Address ("10.0.0.9")), 1, "new next hop indexed");
+}
+
+void
+RoutingTableInPlaceTestCase::DoRun (void)
+{
+  offchain::RoutingTable rtable (Seconds (5));
+  offchain::RoutingTableEntry rt (/*device=*/ 0, /*dst=*/ Ipv4Address ("10.0.0.9"), /*vSeqNo=*/ true, /*seqNo=*/ 1,
+                                  /*iface=*/ Ipv4InterfaceAddress (), /*hops=*/ 2, /*transAmount=*/ 100,
+                                  /*nextHop=*/ Ipv4Address ("10.0.0.2"), /*lifetime=*/ Seconds (2));
+  rtable.AddRoute (rt);
+  NS_TEST_ASSERT_MSG_EQ ((rtable.FindRoute (Ipv4Address ("10.0.0.10")) == 0), true, "unknown destination");
+
+  offchain::RoutingTableEntry * found = rtable.FindRoute (Ipv4Address ("10.0.0.9"));
+  NS_TEST_ASSERT_MSG_EQ ((found != 0), true, "route found");
+  found->SetSeqNo (9);
+  found->SetNextHop (Ipv4Address ("10.0.0.3"));
+  found->SetLifeTime (Seconds (10));
+  rtable.UpdateInPlace (found);
+  NS_TEST_EXPECT_MSG_EQ ((rtable.FindRoute (Ipv4Address ("10.0.0.9")) == found), true, "same entry while the table is unchanged");
+
+  // enough destinations to grow the entry storage, which moves every entry
+  for (uint32_t i = 1; i <= 200; ++i)
+    {
+      offchain::RoutingTableEntry other (0, Ipv4Address (i << 8), true, i, Ipv4InterfaceAddress (), 1, 0,
+                                         Ipv4Address ("10.0.0.4"), Seconds (10));
+      rtable.AddRoute (other);
+    }
+  offchain::RoutingTableEntry * moved = rtable.FindRoute (Ipv4Address ("10.0.0.9"));
+  NS_TEST_ASSERT_MSG_EQ ((moved != 0), true, "route found after AddRoute");
+  NS_TEST_EXPECT_MSG_EQ ((moved != found), true, "AddRoute invalidated the earlier pointer");
+  NS_TEST_EXPECT_MSG_EQ (moved->GetSeqNo (), 9, "in place change kept");
+  NS_TEST_EXPECT_MSG_EQ (moved->GetNextHop (), Ipv4Address ("10.0.0.3"), "in place next hop kept");
+
+  // past the original lifetime, before the extended one
+  Simulator::Schedule (Seconds (5), &RoutingTableInPlaceTestCase::CheckUpdated, this, &rtable);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+// Routing table expiry heap: invalidation, removal and stale records
+class RoutingTableExpiryTestCase : public TestCase
+{
+public:
+  RoutingTableExpiryTestCase ();
+  virtual ~RoutingTableExpiryTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void CheckInvalidated ();
+  void CheckKept ();
+  void CheckRemoved ();
+  offchain::RoutingTable m_rtable;
+};
+
+RoutingTableExpiryTestCase::RoutingTableExpiryTestCase ()
+  : TestCase ("Routing table expiry heap"),
+    m_rtable (Seconds (5))
+{
+}
+
+RoutingTableExpiryTestCase::~RoutingTableExpiryTestCase ()
+{
+}
+
+static offchain::RoutingTableEntry
+ExpiryTestRoute (Ipv4Address dst, Time lifetime)
+{
+  return offchain::RoutingTableEntry (/*device=*/ 0, /*dst=*/ dst, /*vSeqNo=*/ true, /*seqNo=*/ 1,
+                                      /*iface=*/ Ipv4InterfaceAddress (), /*hops=*/ 1, /*transAmount=*/ 0,
+                                      /*nextHop=*/ Ipv4Address ("10.0.0.100"), /*lifetime=*/ lifetime);
+}
+
+void
+RoutingTableExpiryTestCase::CheckInvalidated ()
+{
+  offchain::RoutingTableEntry * a = m_rtable.FindRoute (Ipv4Address ("10.0.0.1"));
+  NS_TEST_ASSERT_MSG_EQ ((a != 0), true, "expired route kept for the bad link lifetime");
+  NS_TEST_EXPECT_MSG_EQ (a->GetFlag (), offchain::INVALID, "expired route invalidated");
+  NS_TEST_EXPECT_MSG_EQ ((m_rtable.FindValidRoute (Ipv4Address ("10.0.0.2")) != 0), true,
+                         "extended route outlives its queued record");
+  NS_TEST_EXPECT_MSG_EQ ((m_rtable.FindValidRoute (Ipv4Address ("10.0.0.5")) != 0), true,
+                         "record of a deleted route does not touch the reused slot");
+  offchain::RoutingTableEntry * c = m_rtable.FindRoute (Ipv4Address ("10.0.0.3"));
+  NS_TEST_ASSERT_MSG_EQ ((c != 0), true, "route in search kept");
+  NS_TEST_EXPECT_MSG_EQ (c->GetFlag (), offchain::IN_SEARCH, "route still in search");
+}
+
+void
+RoutingTableExpiryTestCase::CheckKept ()
+{
+  // invalidated by the purge of the access at 5 s, the bad link lifetime runs from there
+  NS_TEST_EXPECT_MSG_EQ ((m_rtable.FindRoute (Ipv4Address ("10.0.0.1")) != 0), true, "invalid route kept");
+  NS_TEST_EXPECT_MSG_EQ ((m_rtable.FindValidRoute (Ipv4Address ("10.0.0.2")) != 0), true, "extended route valid");
+}
+
+void
+RoutingTableExpiryTestCase::CheckRemoved ()
+{
+  NS_TEST_EXPECT_MSG_EQ ((m_rtable.FindRoute (Ipv4Address ("10.0.0.1")) == 0), true,
+                         "invalid route removed after the bad link lifetime");
+  NS_TEST_EXPECT_MSG_EQ ((m_rtable.FindValidRoute (Ipv4Address ("10.0.0.2")) == 0), true,
+                         "extended route expires at its new deadline");
+  NS_TEST_EXPECT_MSG_EQ ((m_rtable.FindValidRoute (Ipv4Address ("10.0.0.5")) != 0), true, "longer route valid");
+}
+
+void
+RoutingTableExpiryTestCase::DoRun (void)
+{
+  offchain::RoutingTableEntry a = ExpiryTestRoute (Ipv4Address ("10.0.0.1"), Seconds (2));
+  m_rtable.AddRoute (a);
+  offchain::RoutingTableEntry b = ExpiryTestRoute (Ipv4Address ("10.0.0.2"), Seconds (4));
+  m_rtable.AddRoute (b);
+  offchain::RoutingTableEntry c = ExpiryTestRoute (Ipv4Address ("10.0.0.3"), Seconds (0));
+  c.SetFlag (offchain::IN_SEARCH);
+  m_rtable.AddRoute (c);
+  // 10.0.0.5 reuses the slot of 10.0.0.4, whose record stays queued at 1 s
+  offchain::RoutingTableEntry d = ExpiryTestRoute (Ipv4Address ("10.0.0.4"), Seconds (1));
+  m_rtable.AddRoute (d);
+  m_rtable.DeleteRoute (Ipv4Address ("10.0.0.4"));
+  offchain::RoutingTableEntry e = ExpiryTestRoute (Ipv4Address ("10.0.0.5"), Seconds (20));
+  m_rtable.AddRoute (e);
+
+  // later deadline, the record queued at 4 s is re-keyed when it comes up
+  offchain::RoutingTableEntry * rt = m_rtable.FindRoute (Ipv4Address ("10.0.0.2"));
+  rt->SetLifeTime (Seconds (10));
+  m_rtable.UpdateInPlace (rt);
+
+  Simulator::Schedule (Seconds (5), &RoutingTableExpiryTestCase::CheckInvalidated, this);
+  Simulator::Schedule (Seconds (8), &RoutingTableExpiryTestCase::CheckKept, this);
+  Simulator::Schedule (Seconds (11), &RoutingTableExpiryTestCase::CheckRemoved, this);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+// Next hop index: link breaks reach exactly the routes through the broken hop
+class RoutingTableNextHopTestCase : public TestCase
+{
+public:
+  RoutingTableNextHopTestCase ();
+  virtual ~RoutingTableNextHopTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+RoutingTableNextHopTestCase::RoutingTableNextHopTestCase ()
+  : TestCase ("Routing table invalidation through the next hop index")
+{
+}
+
+RoutingTableNextHopTestCase::~RoutingTableNextHopTestCase ()
+{
+}
+
+void
+RoutingTableNextHopTestCase::DoRun (void)
+{
+  Ipv4Address hopA ("10.0.1.1"), hopB ("10.0.1.2"), hopC ("10.0.1.3");
+  offchain::RoutingTable rtable (Seconds (5));
+  for (uint32_t i = 1; i <= 6; ++i)
+    {
+      offchain::RoutingTableEntry rt (/*device=*/ 0, /*dst=*/ Ipv4Address (i), /*vSeqNo=*/ true, /*seqNo=*/ i,
+                                      /*iface=*/ Ipv4InterfaceAddress (), /*hops=*/ 1, /*transAmount=*/ 0,
+                                      /*nextHop=*/ (i == 6) ? hopB : hopA, /*lifetime=*/ Seconds (10));
+      rtable.AddRoute (rt);
+    }
+  // 0.0.0.2 moved to hopB: its handle under hopA is stale
+  offchain::RoutingTableEntry * rt = rtable.FindRoute (Ipv4Address (2));
+  rt->SetNextHop (hopB);
+  rtable.UpdateInPlace (rt);
+  // 0.0.0.3 deleted and its slot reused by a route through hopC
+  rtable.DeleteRoute (Ipv4Address (3));
+  offchain::RoutingTableEntry reused (0, Ipv4Address (7), true, 7, Ipv4InterfaceAddress (), 1, 0, hopC, Seconds (10));
+  rtable.AddRoute (reused);
+  // 0.0.0.4 left hopA and came back: listed twice under hopA
+  rt = rtable.FindRoute (Ipv4Address (4));
+  rt->SetNextHop (hopC);
+  rtable.UpdateInPlace (rt);
+  rt->SetNextHop (hopA);
+  rtable.UpdateInPlace (rt);
+  // enough moves of 0.0.0.5 to rebuild the index from the live entries
+  rt = rtable.FindRoute (Ipv4Address (5));
+  for (uint32_t i = 0; i < 200; ++i)
+    {
+      rt->SetNextHop ((i % 2 == 0) ? hopC : hopA);
+      rtable.UpdateInPlace (rt);
+    }
+
+  std::map<Ipv4Address, uint32_t> unreachable;
+  rtable.InvalidateRoutesWithNextHop (hopA, unreachable);
+  NS_TEST_ASSERT_MSG_EQ (unreachable.size (), 3, "only routes through hopA break");
+  NS_TEST_EXPECT_MSG_EQ (unreachable.count (Ipv4Address (1)), 1, "route through hopA");
+  NS_TEST_EXPECT_MSG_EQ (unreachable.count (Ipv4Address (4)), 1, "route back on hopA, reported once");
+  NS_TEST_EXPECT_MSG_EQ (unreachable[Ipv4Address (5)], 5, "route moved many times, with its seqno");
+  NS_TEST_EXPECT_MSG_EQ ((rtable.FindValidRoute (Ipv4Address (1)) == 0), true, "route invalidated");
+  NS_TEST_EXPECT_MSG_EQ ((rtable.FindValidRoute (Ipv4Address (2)) != 0), true, "stale handle dropped");
+  NS_TEST_EXPECT_MSG_EQ ((rtable.FindValidRoute (Ipv4Address (7)) != 0), true, "reused slot untouched");
+  NS_TEST_EXPECT_MSG_EQ ((rtable.FindValidRoute (Ipv4Address (6)) != 0), true, "other next hop untouched");
+
+  rtable.InvalidateRoutesWithNextHop (hopB, unreachable);
+  NS_TEST_EXPECT_MSG_EQ (unreachable.size (), 2, "routes through hopB");
+  rtable.InvalidateRoutesWithNextHop (hopC, unreachable);
+  NS_TEST_EXPECT_MSG_EQ (unreachable.size (), 1, "route in the reused slot through hopC");
+  NS_TEST_EXPECT_MSG_EQ (unreachable.count (Ipv4Address (7)), 1, "reused slot indexed under its own next hop");
+
+  Simulator::Destroy ();
+}
+
+// Routing table entry: inline precursors spill over and survive copies
+class RoutingTableEntryTestCase : public TestCase
+{
+public:
+  RoutingTableEntryTestCase ();
+  virtual ~RoutingTableEntryTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+RoutingTableEntryTestCase::RoutingTableEntryTestCase ()
+  : TestCase ("Routing table entry precursors and on-demand route")
+{
+}
+
+RoutingTableEntryTestCase::~RoutingTableEntryTestCase ()
+{
+}
+
+void
+RoutingTableEntryTestCase::DoRun (void)
+{
+  offchain::RoutingTableEntry rt (/*device=*/ 0, /*dst=*/ Ipv4Address ("10.0.0.9"), /*vSeqNo=*/ true, /*seqNo=*/ 3,
+                                  /*iface=*/ Ipv4InterfaceAddress (Ipv4Address ("10.0.0.1"), Ipv4Mask ("255.255.255.0")),
+                                  /*hops=*/ 2, /*transAmount=*/ 0, /*nextHop=*/ Ipv4Address ("10.0.0.2"), /*lifetime=*/ Seconds (10));
+  for (uint32_t i = 1; i <= 5; ++i)
+    {
+      NS_TEST_ASSERT_MSG_EQ (rt.InsertPrecursor (Ipv4Address (i)), true, "precursor inserted");
+    }
+  NS_TEST_ASSERT_MSG_EQ (rt.InsertPrecursor (Ipv4Address (4)), false, "duplicate precursor");
+  NS_TEST_ASSERT_MSG_EQ (rt.DeletePrecursor (Ipv4Address (1)), true, "inline precursor deleted");
+
+  offchain::RoutingTableEntry copy = rt;
+  NS_TEST_ASSERT_MSG_EQ (rt.DeletePrecursor (Ipv4Address (5)), true, "overflow precursor deleted");
+  std::vector<Ipv4Address> prec;
+  copy.GetPrecursors (prec);
+  NS_TEST_ASSERT_MSG_EQ (prec.size (), 4, "copy keeps its own precursors");
+  NS_TEST_ASSERT_MSG_EQ (prec[0], Ipv4Address (2), "insertion order kept");
+  NS_TEST_ASSERT_MSG_EQ (prec[3], Ipv4Address (5), "overflow precursor copied");
+  copy.DeleteAllPrecursors ();
+  NS_TEST_ASSERT_MSG_EQ (copy.IsPrecursorListEmpty (), true, "precursors cleared");
+
+  NS_TEST_ASSERT_MSG_EQ (rt.HasAckTimer (), false, "no ack timer until used");
+  Ptr<Ipv4Route> route = rt.GetRoute ();
+  NS_TEST_ASSERT_MSG_EQ (route->GetDestination (), Ipv4Address ("10.0.0.9"), "route destination");
+  NS_TEST_ASSERT_MSG_EQ (route->GetGateway (), Ipv4Address ("10.0.0.2"), "route gateway");
+  NS_TEST_ASSERT_MSG_EQ (route->GetSource (), Ipv4Address ("10.0.0.1"), "route source");
+}
+
+// Multipath routes: amount-aware selection, splitting and failover
+class RoutingTableMultipathTestCase : public TestCase
+{
+public:
+  RoutingTableMultipathTestCase ();
+  virtual ~RoutingTableMultipathTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+RoutingTableMultipathTestCase::RoutingTableMultipathTestCase ()
+  : TestCase ("Routing table multipath selection, split and failover")
+{
+}
+
+RoutingTableMultipathTestCase::~RoutingTableMultipathTestCase ()
+{
+}
+
+void
+RoutingTableMultipathTestCase::DoRun (void)
+{
+  Ipv4Address dst ("10.0.0.9");
+  Ipv4Address hopA ("10.0.0.2"), hopB ("10.0.0.3"), hopC ("10.0.0.4"), hopD ("10.0.0.5");
+  offchain::RoutingTable rtable (Seconds (5));
+  rtable.SetMaxPaths (3);
+  offchain::RoutingTableEntry rt (/*device=*/ 0, /*dst=*/ dst, /*vSeqNo=*/ true, /*seqNo=*/ 1,
+                                  /*iface=*/ Ipv4InterfaceAddress (), /*hops=*/ 2, /*transAmount=*/ 40,
+                                  /*nextHop=*/ hopA, /*lifetime=*/ Seconds (10));
+  rtable.AddRoute (rt);
+  NS_TEST_ASSERT_MSG_EQ (rtable.AddPath (dst, hopB, 4, 100, Seconds (10)), true, "second path kept");
+  NS_TEST_ASSERT_MSG_EQ (rtable.AddPath (dst, hopC, 3, 30, Seconds (10)), true, "third path kept");
+  NS_TEST_ASSERT_MSG_EQ (rtable.AddPath (dst, hopD, 3, 10, Seconds (10)), false, "weakest path dropped when full");
+
+  offchain::RoutePath path;
+  NS_TEST_ASSERT_MSG_EQ (rtable.SelectPath (dst, 20, path), true, "a path carries 20");
+  NS_TEST_ASSERT_MSG_EQ (path.m_nextHop, hopA, "shortest path that fits");
+  NS_TEST_ASSERT_MSG_EQ (rtable.SelectPath (dst, 50, path), true, "a path carries 50");
+  NS_TEST_ASSERT_MSG_EQ (path.m_nextHop, hopB, "only the long path fits");
+  NS_TEST_ASSERT_MSG_EQ (rtable.SelectPath (dst, 150, path), false, "no single path carries 150");
+
+  std::vector<std::pair<Ipv4Address, uint32_t> > shares;
+  NS_TEST_ASSERT_MSG_EQ (rtable.SplitAmount (dst, 150, shares), true, "150 fits over all paths");
+  NS_TEST_ASSERT_MSG_EQ (shares.size (), 3, "all paths used");
+  NS_TEST_ASSERT_MSG_EQ (shares[0].first, hopB, "largest capacity first");
+  NS_TEST_ASSERT_MSG_EQ (shares[2].second, 10, "remainder on the last path");
+  NS_TEST_ASSERT_MSG_EQ (rtable.SplitAmount (dst, 171, shares), false, "171 exceeds all paths");
+
+  std::map<Ipv4Address, uint32_t> unreachable;
+  rtable.InvalidateRoutesWithNextHop (hopA, unreachable);
+  NS_TEST_ASSERT_MSG_EQ (unreachable.empty (), true, "route fails over instead of breaking");
+  offchain::RoutingTableEntry const * toDst = rtable.FindValidRoute (dst);
+  NS_TEST_ASSERT_MSG_EQ (toDst->GetNextHop (), hopB, "best alternative promoted");
+  rtable.InvalidateRoutesWithNextHop (hopC, unreachable);
+  NS_TEST_ASSERT_MSG_EQ (toDst->GetAlternatePathCount (), 0, "broken alternative dropped");
+  rtable.InvalidateRoutesWithNextHop (hopB, unreachable);
+  NS_TEST_ASSERT_MSG_EQ (unreachable.size (), 1, "last path broken");
+  NS_TEST_ASSERT_MSG_EQ (rtable.FindValidRoute (dst) == 0, true, "route invalidated");
+
+  Simulator::Destroy ();
+}
+
+// Route cache: amount buckets, LRU eviction and counters
+class RouteCacheTestCase : public TestCase
+{
+public:
+  RouteCacheTestCase ();
+  virtual ~RouteCacheTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+RouteCacheTestCase::RouteCacheTestCase ()
+  : TestCase ("Route cache by destination and amount bucket")
+{
+}
+
+RouteCacheTestCase::~RouteCacheTestCase ()
+{
+}
+
+void
+RouteCacheTestCase::DoRun (void)
+{
+  offchain::RouteCache cache (2, Seconds (10));
+  offchain::RoutePath path;
+  cache.Insert (Ipv4Address ("10.0.0.9"), 100, offchain::RoutePath (Ipv4Address ("10.0.0.2"), 2, 150));
+  NS_TEST_ASSERT_MSG_EQ (cache.Lookup (Ipv4Address ("10.0.0.9"), 120, path), true, "observed bottleneck carries 120");
+  NS_TEST_ASSERT_MSG_EQ (path.m_nextHop, Ipv4Address ("10.0.0.2"), "cached next hop");
+  NS_TEST_ASSERT_MSG_EQ (cache.Lookup (Ipv4Address ("10.0.0.9"), 5, path), true, "larger bucket serves small amounts");
+  NS_TEST_ASSERT_MSG_EQ (cache.Lookup (Ipv4Address ("10.0.0.9"), 200, path), false, "bottleneck too small");
+
+  cache.Insert (Ipv4Address ("10.0.0.8"), 10, offchain::RoutePath (Ipv4Address ("10.0.0.3"), 1, 10));
+  cache.Insert (Ipv4Address ("10.0.0.7"), 10, offchain::RoutePath (Ipv4Address ("10.0.0.3"), 1, 10));
+  NS_TEST_ASSERT_MSG_EQ (cache.GetEvictions (), 1, "least recently used evicted");
+  NS_TEST_ASSERT_MSG_EQ (cache.Lookup (Ipv4Address ("10.0.0.9"), 5, path), false, "evicted entry gone");
+
+  cache.InvalidateNextHop (Ipv4Address ("10.0.0.3"));
+  NS_TEST_ASSERT_MSG_EQ (cache.GetSize (), 0, "paths through a closed channel dropped");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetHits (), 2, "hits counted");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetMisses (), 2, "misses counted");
+
+  cache.Insert (Ipv4Address ("10.0.0.6"), 3, offchain::RoutePath (Ipv4Address ("10.0.0.2"), 2, 500));
+  NS_TEST_ASSERT_MSG_EQ (cache.Lookup (Ipv4Address ("10.0.0.6"), 400, path), true, "smaller bucket with a large bottleneck");
+
+  Simulator::Destroy ();
+}
+
+// Request queue: duplicate rejection, batch drain and drop of the most aged packet
+class RequestQueueTestCase : public TestCase
+{
+public:
+  RequestQueueTestCase ();
+  virtual ~RequestQueueTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void Dropped (Ptr<const Packet> p, const Ipv4Header & header, Socket::SocketErrno err);
+  uint32_t m_dropped;
+};
+
+RequestQueueTestCase::RequestQueueTestCase ()
+  : TestCase ("Request queue per destination"),
+    m_dropped (0)
+{
+}
+
+RequestQueueTestCase::~RequestQueueTestCase ()
+{
+}
+
+void
+RequestQueueTestCase::Dropped (Ptr<const Packet> p, const Ipv4Header & header, Socket::SocketErrno err)
+{
+  m_dropped++;
+}
+
+void
+RequestQueueTestCase::DoRun (void)
+{
+  offchain::RequestQueue q (3, Seconds (10));
+  Ipv4Header toA, toB;
+  toA.SetDestination (Ipv4Address ("10.0.0.1"));
+  toB.SetDestination (Ipv4Address ("10.0.0.2"));
+  Ptr<const Packet> p1 = Create<Packet> ();
+  Ptr<const Packet> p2 = Create<Packet> ();
+  Ptr<const Packet> p3 = Create<Packet> ();
+  Ipv4RoutingProtocol::ErrorCallback ecb = MakeCallback (&RequestQueueTestCase::Dropped, this);
+
+  offchain::QueueEntry e1 (p1, toA, Ipv4RoutingProtocol::UnicastForwardCallback (), ecb);
+  offchain::QueueEntry e2 (p2, toB, Ipv4RoutingProtocol::UnicastForwardCallback (), ecb);
+  offchain::QueueEntry e3 (p3, toA, Ipv4RoutingProtocol::UnicastForwardCallback (), ecb);
+  offchain::QueueEntry e1again (p1, toA, Ipv4RoutingProtocol::UnicastForwardCallback (), ecb);
+  e1.SetQueuedTime (Seconds (5));
+  NS_TEST_ASSERT_MSG_EQ (q.Enqueue (e1), true, "first packet queued");
+  NS_TEST_ASSERT_MSG_EQ (q.Enqueue (e2), true, "other destination queued");
+  NS_TEST_ASSERT_MSG_EQ (q.Enqueue (e3), true, "second packet queued");
+  NS_TEST_ASSERT_MSG_EQ (q.Enqueue (e1again), false, "same packet and destination rejected");
+  NS_TEST_ASSERT_MSG_EQ (q.GetSize (), 3, "three packets queued");
+
+  std::vector<offchain::QueueEntry> burst;
+  NS_TEST_ASSERT_MSG_EQ (q.DequeueAll (Ipv4Address ("10.0.0.1"), burst), 2, "both packets to A drained");
+  NS_TEST_ASSERT_MSG_EQ (burst[0].GetPacket ()->GetUid (), p1->GetUid (), "oldest first");
+  NS_TEST_ASSERT_MSG_EQ (burst[1].GetPacket ()->GetUid (), p3->GetUid (), "newest last");
+  NS_TEST_ASSERT_MSG_EQ (burst[0].GetQueuedTime (), Simulator::Now (), "time of queueing recorded");
+  NS_TEST_ASSERT_MSG_EQ (q.Find (Ipv4Address ("10.0.0.1")), false, "nothing left for A");
+  NS_TEST_ASSERT_MSG_EQ (q.Enqueue (e1again), true, "drained packet may be queued again");
+
+  offchain::QueueEntry e4 (Create<Packet> (), toB, Ipv4RoutingProtocol::UnicastForwardCallback (), ecb);
+  offchain::QueueEntry e5 (Create<Packet> (), toB, Ipv4RoutingProtocol::UnicastForwardCallback (), ecb);
+  q.Enqueue (e4);
+  q.Enqueue (e5);
+  NS_TEST_ASSERT_MSG_EQ (m_dropped, 1, "most aged packet dropped when full");
+  offchain::QueueEntry entry;
+  NS_TEST_ASSERT_MSG_EQ (q.Dequeue (Ipv4Address ("10.0.0.2"), entry), true, "B still queued");
+  NS_TEST_ASSERT_MSG_EQ (entry.GetPacket ()->GetUid (), e4.GetPacket ()->GetUid (), "oldest packet to B was the one dropped");
+
+  Simulator::Destroy ();
+}
+
+// Request queue policies: release order and eviction of the lowest fee per byte
+class RequestQueuePolicyTestCase : public TestCase
+{
+public:
+  RequestQueuePolicyTestCase ();
+  virtual ~RequestQueuePolicyTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void Dropped (Ptr<const Packet> p, const Ipv4Header & header, Socket::SocketErrno err);
+  void CheckDeadline (offchain::RequestQueue * q, uint64_t late);
+  uint64_t m_droppedUid;
+};
+
+RequestQueuePolicyTestCase::RequestQueuePolicyTestCase ()
+  : TestCase ("Request queue deadline and fee policies"),
+    m_droppedUid (0)
+{
+}
+
+RequestQueuePolicyTestCase::~RequestQueuePolicyTestCase ()
+{
+}
+
+void
+RequestQueuePolicyTestCase::Dropped (Ptr<const Packet> p, const Ipv4Header & header, Socket::SocketErrno err)
+{
+  m_droppedUid = p->GetUid ();
+}
+
+void
+RequestQueuePolicyTestCase::CheckDeadline (offchain::RequestQueue * q, uint64_t late)
+{
+  NS_TEST_EXPECT_MSG_EQ (q->GetSize (), 1, "entry past its deadline purged");
+  NS_TEST_EXPECT_MSG_EQ (m_droppedUid, late, "late entry dropped");
+  offchain::QueueEntry entry;
+  NS_TEST_EXPECT_MSG_EQ (q->Dequeue (Ipv4Address ("10.0.0.1"), entry), true, "entry without a deadline kept");
+}
+
+void
+RequestQueuePolicyTestCase::DoRun (void)
+{
+  offchain::RequestQueue q (3, Seconds (10));
+  q.SetPolicy (offchain::RequestQueue::VALUE);
+  Ipv4Header toA;
+  toA.SetDestination (Ipv4Address ("10.0.0.1"));
+  uint32_t fees[] = { 5, 50, 1, 20 };
+  Time deadlines[] = { Seconds (4), Seconds (3), Seconds (2), Seconds (1) };
+  std::vector<Ptr<const Packet> > packets;
+  for (uint32_t i = 0; i < 4; ++i)
+    {
+      packets.push_back (Create<Packet> (100));
+      offchain::QueueEntry e (packets[i], toA, Ipv4RoutingProtocol::UnicastForwardCallback (),
+                              MakeCallback (&RequestQueuePolicyTestCase::Dropped, this));
+      e.SetFee (fees[i]);
+      e.SetDeadline (deadlines[i]);
+      q.Enqueue (e);
+    }
+  NS_TEST_ASSERT_MSG_EQ (q.GetSize (), 3, "queue full");
+  NS_TEST_ASSERT_MSG_EQ (m_droppedUid, packets[2]->GetUid (), "lowest fee per byte evicted");
+
+  offchain::QueueEntry entry;
+  q.Dequeue (Ipv4Address ("10.0.0.1"), entry);
+  NS_TEST_ASSERT_MSG_EQ (entry.GetPacket ()->GetUid (), packets[1]->GetUid (), "highest fee per byte first");
+
+  q.SetPolicy (offchain::RequestQueue::DEADLINE);
+  std::vector<offchain::QueueEntry> burst;
+  NS_TEST_ASSERT_MSG_EQ (q.DequeueAll (Ipv4Address ("10.0.0.1"), burst), 2, "two packets left for A");
+  NS_TEST_ASSERT_MSG_EQ (burst[0].GetPacket ()->GetUid (), packets[3]->GetUid (), "earliest deadline first");
+  NS_TEST_ASSERT_MSG_EQ (burst[1].GetPacket ()->GetUid (), packets[0]->GetUid (), "latest deadline last");
+
+  // both entries outlive the queue timeout, only the deadline drops one
+  Ptr<const Packet> late = Create<Packet> (100);
+  offchain::QueueEntry lateEntry (late, toA, Ipv4RoutingProtocol::UnicastForwardCallback (),
+                                  MakeCallback (&RequestQueuePolicyTestCase::Dropped, this));
+  lateEntry.SetFee (10);
+  lateEntry.SetDeadline (Seconds (1));
+  q.Enqueue (lateEntry);
+  offchain::QueueEntry openEntry (Create<Packet> (100), toA, Ipv4RoutingProtocol::UnicastForwardCallback (),
+                                  MakeCallback (&RequestQueuePolicyTestCase::Dropped, this));
+  q.Enqueue (openEntry);
+  NS_TEST_ASSERT_MSG_EQ (q.GetSize (), 2, "both queued");
+  Simulator::Schedule (Seconds (2), &RequestQueuePolicyTestCase::CheckDeadline, this, &q, late->GetUid ());
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+// RREQ id cache: duplicates within the lifetime, expiry in insertion order
+class IdCacheTestCase : public TestCase
+{
+public:
+  IdCacheTestCase ();
+  virtual ~IdCacheTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void CheckTimeout1 ();
+  void CheckTimeout2 ();
+  offchain::IdCache m_cache;
+};
+
+IdCacheTestCase::IdCacheTestCase ()
+  : TestCase ("RREQ id cache"),
+    m_cache (Seconds (10))
+{
+}
+
+IdCacheTestCase::~IdCacheTestCase ()
+{
+}
+
+void
+IdCacheTestCase::DoRun (void)
+{
+  NS_TEST_ASSERT_MSG_EQ (m_cache.IsDuplicate (Ipv4Address ("1.2.3.4"), 3), false, "new id");
+  NS_TEST_ASSERT_MSG_EQ (m_cache.IsDuplicate (Ipv4Address ("1.2.3.4"), 3), true, "same id again");
+  NS_TEST_ASSERT_MSG_EQ (m_cache.IsDuplicate (Ipv4Address ("4.3.2.1"), 3), false, "other context");
+  NS_TEST_ASSERT_MSG_EQ (m_cache.GetSize (), 2, "two ids cached");
+  m_cache.SetLifetime (Seconds (5));
+  m_cache.IsDuplicate (Ipv4Address ("1.1.1.1"), 4);
+  NS_TEST_ASSERT_MSG_EQ (m_cache.GetSize (), 3, "three ids cached");
+
+  Simulator::Schedule (Seconds (8), &IdCacheTestCase::CheckTimeout1, this);
+  Simulator::Schedule (Seconds (12), &IdCacheTestCase::CheckTimeout2, this);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+void
+IdCacheTestCase::CheckTimeout1 ()
+{
+  NS_TEST_EXPECT_MSG_EQ (m_cache.GetSize (), 2, "id expired behind longer lived ones not counted");
+  NS_TEST_EXPECT_MSG_EQ (m_cache.IsDuplicate (Ipv4Address ("1.1.1.1"), 4), false, "shorter lifetime expired first");
+  NS_TEST_EXPECT_MSG_EQ (m_cache.IsDuplicate (Ipv4Address ("1.2.3.4"), 3), true, "still cached");
+}
+
+void
+IdCacheTestCase::CheckTimeout2 ()
+{
+  NS_TEST_EXPECT_MSG_EQ (m_cache.IsDuplicate (Ipv4Address ("1.2.3.4"), 3), false, "expired");
+  NS_TEST_EXPECT_MSG_EQ (m_cache.GetSize (), 2, "re-added ids remain");
+}
+
+// Bloom filter duplicate detection: retention window and false positive rate
+class BloomDuplicateDetectionTestCase : public TestCase
+{
+public:
+  BloomDuplicateDetectionTestCase ();
+  virtual ~BloomDuplicateDetectionTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void CheckRetained ();
+  void CheckForgotten ();
+  offchain::RotatingBloomFilter m_filter;
+};
+
+BloomDuplicateDetectionTestCase::BloomDuplicateDetectionTestCase ()
+  : TestCase ("Rotating Bloom filter duplicate detection"),
+    m_filter (Seconds (10), 3, 1000, 0.01)
+{
+}
+
+BloomDuplicateDetectionTestCase::~BloomDuplicateDetectionTestCase ()
+{
+}
+
+void
+BloomDuplicateDetectionTestCase::DoRun (void)
+{
+  NS_TEST_ASSERT_MSG_EQ (m_filter.GetGenerations (), 3, "three filters");
+  for (uint64_t key = 0; key < 500; ++key)
+    NS_TEST_ASSERT_MSG_EQ (m_filter.IsDuplicate (key), false, "new key");
+  NS_TEST_ASSERT_MSG_EQ (m_filter.IsDuplicate (7), true, "key seen");
+  uint32_t falsePositives = 0;
+  for (uint64_t key = 500; key < 1000; ++key)
+    falsePositives += m_filter.IsDuplicate (key << 20);
+  NS_TEST_ASSERT_MSG_EQ (falsePositives < 15, true, "false positives near the target rate");
+  NS_TEST_ASSERT_MSG_EQ (m_filter.GetEstimatedFalsePositiveRate () < 0.02, true, "estimate near the target rate");
+
+  offchain::DuplicatePacketDetection dpd (Seconds (10));
+  dpd.SetMode (offchain::DuplicatePacketDetection::BLOOM);
+  dpd.SetBloomCheck (true);
+  Ipv4Header header;
+  header.SetSource (Ipv4Address ("10.0.0.1"));
+  Ptr<const Packet> p = Create<Packet> ();
+  NS_TEST_ASSERT_MSG_EQ (dpd.IsDuplicate (p, header), false, "new packet");
+  NS_TEST_ASSERT_MSG_EQ (dpd.IsDuplicate (p, header), true, "packet seen");
+  NS_TEST_ASSERT_MSG_EQ (dpd.GetFalsePositives (), 0, "no false positive");
+
+  Simulator::Schedule (Seconds (9), &BloomDuplicateDetectionTestCase::CheckRetained, this);
+  Simulator::Schedule (Seconds (16), &BloomDuplicateDetectionTestCase::CheckForgotten, this);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+void
+BloomDuplicateDetectionTestCase::CheckRetained ()
+{
+  NS_TEST_EXPECT_MSG_EQ (m_filter.IsDuplicate (7), true, "key kept for the lifetime");
+}
+
+void
+BloomDuplicateDetectionTestCase::CheckForgotten ()
+{
+  // windows of 5 s: the key added in [0, 5) is dropped at 15 s
+  NS_TEST_EXPECT_MSG_EQ (m_filter.IsDuplicate (7), false, "key dropped after the last window");
+}
+
+// Duplicate detection keyed on control message content
+class ContentDuplicateDetectionTestCase : public TestCase
+{
+public:
+  ContentDuplicateDetectionTestCase ();
+  virtual ~ContentDuplicateDetectionTestCase ();
+
+private:
+  virtual void DoRun (void);
+  Ptr<Packet> MakeRreq (uint32_t id) const;
+};
+
+ContentDuplicateDetectionTestCase::ContentDuplicateDetectionTestCase ()
+  : TestCase ("Duplicate detection by control message content")
+{
+}
+
+ContentDuplicateDetectionTestCase::~ContentDuplicateDetectionTestCase ()
+{
+}
+
+Ptr<Packet>
+ContentDuplicateDetectionTestCase::MakeRreq (uint32_t id) const
+{
+  offchain::RreqHeader rreqHeader (/*flags=*/ 0, /*reserved=*/ 0, /*hopCount=*/ 1, /*requestID=*/ id,
+                                   /*dst=*/ Ipv4Address ("10.0.0.9"), /*dstSeqNo=*/ 4,
+                                   /*origin=*/ Ipv4Address ("10.0.0.1"), /*originSeqNo=*/ 7);
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (rreqHeader);
+  packet->AddHeader (offchain::TypeHeader (offchain::OFFCHAIN_TYPE_RREQ));
+  return packet;
+}
+
+void
+ContentDuplicateDetectionTestCase::DoRun (void)
+{
+  Ipv4Address neighborA ("10.0.0.2");
+  Ipv4Address neighborB ("10.0.0.3");
+
+  offchain::DuplicatePacketDetection byUid (Seconds (10));
+  NS_TEST_ASSERT_MSG_EQ (byUid.IsDuplicate (MakeRreq (1), neighborA), false, "first copy");
+  NS_TEST_ASSERT_MSG_EQ (byUid.IsDuplicate (MakeRreq (1), neighborB), false, "rebroadcast has a new uid");
+
+  offchain::DuplicatePacketDetection byContent (Seconds (10));
+  byContent.SetKey (offchain::DuplicatePacketDetection::CONTENT);
+  NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (MakeRreq (1), neighborA), false, "first copy");
+  NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (MakeRreq (1), neighborB), true, "rebroadcast caught");
+  NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (MakeRreq (2), neighborA), false, "next request id");
+  // fields read through a view give the key of the whole packet
+  NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (offchain::OFFCHAIN_TYPE_RREQ, Ipv4Address ("10.0.0.1"), 2, 4,
+                                                neighborB, 0), true, "rebroadcast caught from its fields");
+  NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (offchain::OFFCHAIN_TYPE_RREQ, Ipv4Address ("10.0.0.1"), 3, 4,
+                                                neighborB, 0), false, "other request id from its fields");
+  NS_TEST_ASSERT_MSG_EQ (byContent.GetSeen (offchain::OFFCHAIN_TYPE_RREQ), 5, "RREQs looked up");
+  NS_TEST_ASSERT_MSG_EQ (byContent.GetSuppressed (offchain::OFFCHAIN_TYPE_RREQ), 2, "RREQs suppressed");
+
+  // batched RREQs are counted apart from single ones
+  offchain::BatchedRreqHeader batchHeader (/*hopCount=*/ 1, /*requestID=*/ 3, /*origin=*/ Ipv4Address ("10.0.0.1"),
+                                           /*originSeqNo=*/ 8);
+  batchHeader.AddDestination (Ipv4Address ("10.0.0.9"), 4, 100, false);
+  for (uint32_t i = 0; i < 2; ++i)
+    {
+      Ptr<Packet> batch = Create<Packet> ();
+      batch->AddHeader (batchHeader);
+      batch->AddHeader (offchain::TypeHeader (offchain::OFFCHAIN_TYPE_RREQ_BATCH));
+      NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (batch, i == 0 ? neighborA : neighborB), i == 1, "batched RREQ");
+    }
+  NS_TEST_ASSERT_MSG_EQ (byContent.GetSeen (offchain::OFFCHAIN_TYPE_RREQ_BATCH), 2, "batched RREQs looked up");
+  NS_TEST_ASSERT_MSG_EQ (byContent.GetSuppressed (offchain::OFFCHAIN_TYPE_RREQ_BATCH), 1, "batched RREQs suppressed");
+  NS_TEST_ASSERT_MSG_EQ (byContent.GetSeen (offchain::OFFCHAIN_TYPE_RREQ), 5, "single RREQs unchanged");
+
+  // a reply over a shorter path is not a copy of the first one
+  for (uint32_t i = 0; i < 3; ++i)
+    {
+      offchain::RrepHeader rrepHeader (/*prefixSize=*/ 0, /*hopCount=*/ i < 2 ? 3 : 2,
+                                       /*dst=*/ Ipv4Address ("10.0.0.9"), /*dstSeqNo=*/ 4,
+                                       /*origin=*/ Ipv4Address ("10.0.0.1"));
+      Ptr<Packet> rrep = Create<Packet> ();
+      rrep->AddHeader (rrepHeader);
+      rrep->AddHeader (offchain::TypeHeader (offchain::OFFCHAIN_TYPE_RREP));
+      NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (rrep, i == 0 ? neighborA : neighborB), i == 1, "RREP by hop count");
+    }
+
+  // periodic HELLOs repeat their fields and keep the uid key
+  offchain::HelloHeader helloHeader (/*dst=*/ Ipv4Address ("10.0.0.2"), /*dstSeqNo=*/ 5,
+                                     /*origin=*/ Ipv4Address ("10.0.0.1"), /*lifetime=*/ Seconds (2), 100);
+  for (uint32_t i = 0; i < 2; ++i)
+    {
+      Ptr<Packet> hello = Create<Packet> ();
+      hello->AddHeader (helloHeader);
+      hello->AddHeader (offchain::TypeHeader (offchain::OFFCHAIN_TYPE_HELLO));
+      NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (hello, neighborA), false, "next HELLO round");
+    }
+  NS_TEST_ASSERT_MSG_EQ (byContent.GetSeen (offchain::OFFCHAIN_TYPE_HELLO), 0, "HELLOs not content keyed");
+
+  Ptr<Packet> data = Create<Packet> (40);
+  NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (data, neighborA), false, "data packet");
+  NS_TEST_ASSERT_MSG_EQ (byContent.IsDuplicate (data, neighborA), true, "same data packet by uid");
+  NS_TEST_ASSERT_MSG_EQ (byContent.GetSuppressed (0), 1, "other packets counted apart");
+
+  Simulator::Destroy ();
+}
+
+// RREQ and HELLO fields read and patched through views over the serialized bytes
+class PacketViewTestCase : public TestCase
+{
+public:
+  PacketViewTestCase ();
+  virtual ~PacketViewTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+PacketViewTestCase::PacketViewTestCase ()
+  : TestCase ("Control message header views")
+{
+}
+
+PacketViewTestCase::~PacketViewTestCase ()
+{
+}
+
+void
+PacketViewTestCase::DoRun (void)
+{
+  offchain::RreqHeader rreqHeader (/*flags=*/ 0, /*reserved=*/ 0, /*hopCount=*/ 3, /*requestID=*/ 42,
+                                   /*dst=*/ Ipv4Address ("10.0.0.9"), /*dstSeqNo=*/ 4,
+                                   /*origin=*/ Ipv4Address ("10.0.0.1"), /*originSeqNo=*/ 7,
+                                   /*trAmount=*/ 1500);
+  rreqHeader.SetUnknownSeqno (true);
+  rreqHeader.SetDestinationOnly (true);
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (rreqHeader);
+  NS_TEST_ASSERT_MSG_EQ (packet->GetSize (), offchain::RreqView::SIZE, "view size");
+
+  uint8_t buf[offchain::RreqView::SIZE];
+  offchain::RreqView rreq (buf, packet->CopyData (buf, offchain::RreqView::SIZE));
+  NS_TEST_ASSERT_MSG_EQ (rreq.IsValid (), true, "whole header");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetHopCount (), 3, "hop count");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetId (), 42, "request id");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetDst (), Ipv4Address ("10.0.0.9"), "destination");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetDstSeqno (), 4, "destination seqno");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetOrigin (), Ipv4Address ("10.0.0.1"), "origin");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetOriginSeqno (), 7, "origin seqno");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetTransAmount (), 1500, "amount");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetUnknownSeqno (), true, "unknown seqno flag");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetDestinationOnly (), true, "destination only flag");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetGratiousRrep (), false, "gratuitous flag");
+
+  // fields patched in place come back through the full header
+  offchain::RreqView::SetHopCount (buf, 4);
+  offchain::RreqView::SetDstSeqno (buf, 11);
+  offchain::RreqView::SetUnknownSeqno (buf, false);
+  Ptr<Packet> forwarded = Create<Packet> (buf, sizeof (buf));
+  offchain::RreqHeader patched;
+  forwarded->RemoveHeader (patched);
+  NS_TEST_EXPECT_MSG_EQ (patched.GetHopCount (), 4, "patched hop count");
+  NS_TEST_EXPECT_MSG_EQ (patched.GetDstSeqno (), 11, "patched destination seqno");
+  NS_TEST_EXPECT_MSG_EQ (patched.GetUnknownSeqno (), false, "patched flag");
+  NS_TEST_EXPECT_MSG_EQ (patched.GetDestinationOnly (), true, "other flags kept");
+  NS_TEST_EXPECT_MSG_EQ (patched.GetTransAmount (), 1500, "amount kept");
+
+  NS_TEST_EXPECT_MSG_EQ (offchain::RreqView (buf, offchain::RreqView::SIZE - 1).IsValid (), false,
+                         "truncated header");
+
+  offchain::HelloHeader helloHeader (/*dst=*/ Ipv4Address ("10.0.0.2"), /*dstSeqNo=*/ 5,
+                                     /*origin=*/ Ipv4Address ("10.0.0.1"), /*lifetime=*/ MilliSeconds (3000),
+                                     /*curDeposit=*/ 250);
+  helloHeader.SetAckRequired (true);
+  Ptr<Packet> hello = Create<Packet> ();
+  hello->AddHeader (helloHeader);
+  NS_TEST_ASSERT_MSG_EQ (hello->GetSize (), offchain::HelloView::SIZE, "hello view size");
+
+  uint8_t helloBuf[offchain::HelloView::SIZE];
+  offchain::HelloView helloView (helloBuf, hello->CopyData (helloBuf, offchain::HelloView::SIZE));
+  NS_TEST_ASSERT_MSG_EQ (helloView.IsValid (), true, "whole hello");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetAckRequired (), true, "ack flag on the wire");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetDst (), Ipv4Address ("10.0.0.2"), "hello destination");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetDstSeqno (), 5, "hello seqno");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetOrigin (), Ipv4Address ("10.0.0.1"), "hello origin");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetLifeTime (), MilliSeconds (3000), "hello lifetime");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetAvailableDeposit (), 250, "deposit");
+
+  offchain::HelloHeader received;
+  hello->RemoveHeader (received);
+  NS_TEST_EXPECT_MSG_EQ (received.GetAckRequired (), true, "ack flag deserialized");
+}
+
+// Compact encoding of control messages
+class CompactEncodingTestCase : public TestCase
+{
+public:
+  CompactEncodingTestCase ();
+  virtual ~CompactEncodingTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+CompactEncodingTestCase::CompactEncodingTestCase ()
+  : TestCase ("Compact control message encoding")
+{
+}
+
+CompactEncodingTestCase::~CompactEncodingTestCase ()
+{
+}
+
+void
+CompactEncodingTestCase::DoRun (void)
+{
+  // origin seqno below the request id, large amount: negative delta, 5 byte varint
+  offchain::RreqHeader rreqHeader (/*flags=*/ 0, /*reserved=*/ 0, /*hopCount=*/ 2, /*requestID=*/ 300,
+                                   /*dst=*/ Ipv4Address ("10.0.0.9"), /*dstSeqNo=*/ 5,
+                                   /*origin=*/ Ipv4Address ("10.0.0.1"), /*originSeqNo=*/ 298,
+                                   /*trAmount=*/ 0xffffffff);
+  rreqHeader.SetUnknownSeqno (true);
+  rreqHeader.SetCompact (true);
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (rreqHeader);
+  NS_TEST_EXPECT_MSG_EQ (packet->GetSize (), 19, "compact RREQ size");
+  uint8_t rreqBuf[offchain::RreqView::MAX_SIZE];
+  offchain::RreqView view (rreqBuf, packet->CopyData (rreqBuf, offchain::RreqView::MAX_SIZE));
+  NS_TEST_EXPECT_MSG_EQ (offchain::RreqView::IsCompact (rreqBuf), true, "compact bit in the flags");
+  NS_TEST_ASSERT_MSG_EQ (view.IsValid (), true, "view reads the compact layout");
+  NS_TEST_EXPECT_MSG_EQ (view.GetSerializedSize (), 19, "compact view size");
+  NS_TEST_EXPECT_MSG_EQ (view.GetHopCount (), 2, "compact hop count");
+  NS_TEST_EXPECT_MSG_EQ (view.GetId (), 300, "compact request id");
+  NS_TEST_EXPECT_MSG_EQ (view.GetDst (), Ipv4Address ("10.0.0.9"), "compact destination");
+  NS_TEST_EXPECT_MSG_EQ (view.GetDstSeqno (), 5, "compact destination seqno");
+  NS_TEST_EXPECT_MSG_EQ (view.GetOrigin (), Ipv4Address ("10.0.0.1"), "compact origin");
+  NS_TEST_EXPECT_MSG_EQ (view.GetOriginSeqno (), 298, "compact origin seqno");
+  NS_TEST_EXPECT_MSG_EQ (view.GetTransAmount (), 0xffffffff, "compact amount");
+  NS_TEST_EXPECT_MSG_EQ (view.GetUnknownSeqno (), true, "compact flags");
+  for (uint32_t len = 0; len < view.GetSerializedSize (); ++len)
+    {
+      NS_TEST_EXPECT_MSG_EQ (offchain::RreqView (rreqBuf, len).IsValid (), false, "truncated compact RREQ");
+    }
+  // a truncated compact header deserializes without reading past the packet
+  Ptr<Packet> truncated = Create<Packet> (rreqBuf, 12);
+  offchain::RreqHeader partial;
+  truncated->RemoveHeader (partial);
+  NS_TEST_EXPECT_MSG_EQ (truncated->GetSize (), 0, "truncated RREQ consumed");
+
+  // the hop count is patched at its compact offset
+  offchain::RreqView::SetHopCount (rreqBuf, 3);
+  Ptr<Packet> forwarded = Create<Packet> (rreqBuf, view.GetSerializedSize ());
+  offchain::RreqHeader rreq;
+  forwarded->RemoveHeader (rreq);
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetHopCount (), 3, "patched compact hop count");
+  rreq.SetHopCount (2);
+  NS_TEST_EXPECT_MSG_EQ (rreq == rreqHeader, true, "patched RREQ otherwise unchanged");
+  packet->RemoveHeader (rreq);
+  NS_TEST_EXPECT_MSG_EQ (rreq == rreqHeader, true, "RREQ round trip");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetOriginSeqno (), 298, "delta coded origin seqno");
+  NS_TEST_EXPECT_MSG_EQ (rreq.GetTransAmount (), 0xffffffff, "largest amount");
+  NS_TEST_EXPECT_MSG_EQ (packet->GetSize (), 0, "whole RREQ consumed");
+
+  offchain::RrepHeader rrepHeader (/*prefixSize=*/ 0, /*hopCount=*/ 3, /*dst=*/ Ipv4Address ("10.0.0.9"),
+                                   /*dstSeqNo=*/ 127, /*origin=*/ Ipv4Address ("10.0.0.1"),
+                                   /*lifetime=*/ MilliSeconds (3000), /*reward=*/ 128);
+  rrepHeader.SetAckRequired (true);
+  rrepHeader.SetCapacity (300);
+  rrepHeader.SetCompact (true);
+  packet->AddHeader (rrepHeader);
+  NS_TEST_EXPECT_MSG_EQ (packet->GetSize (), 18, "compact RREP size");
+  offchain::RrepHeader rrep;
+  packet->RemoveHeader (rrep);
+  NS_TEST_EXPECT_MSG_EQ (rrep == rrepHeader, true, "RREP round trip");
+  NS_TEST_EXPECT_MSG_EQ (rrep.GetLifeTime (), MilliSeconds (3000), "RREP lifetime");
+  NS_TEST_EXPECT_MSG_EQ (rrep.GetCapacity (), 300, "RREP path capacity");
+
+  offchain::HelloHeader helloHeader (/*dst=*/ Ipv4Address ("10.0.0.2"), /*dstSeqNo=*/ 0,
+                                     /*origin=*/ Ipv4Address ("10.0.0.1"), /*lifetime=*/ MilliSeconds (120000),
+                                     /*curDeposit=*/ 1000);
+  helloHeader.SetCompact (true);
+  packet->AddHeader (helloHeader);
+  NS_TEST_EXPECT_MSG_EQ (packet->GetSize (), 16, "compact HELLO size");
+  uint8_t helloBuf[offchain::HelloView::MAX_SIZE];
+  offchain::HelloView helloView (helloBuf, packet->CopyData (helloBuf, offchain::HelloView::MAX_SIZE));
+  NS_TEST_ASSERT_MSG_EQ (helloView.IsValid (), true, "view reads the compact HELLO");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetDst (), Ipv4Address ("10.0.0.2"), "compact HELLO destination");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetOrigin (), Ipv4Address ("10.0.0.1"), "compact HELLO origin");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetLifeTime (), MilliSeconds (120000), "compact HELLO lifetime");
+  NS_TEST_EXPECT_MSG_EQ (helloView.GetAvailableDeposit (), 1000, "compact HELLO deposit");
+  NS_TEST_EXPECT_MSG_EQ (offchain::HelloView (helloBuf, 15).IsValid (), false, "truncated compact HELLO");
+  offchain::HelloHeader hello;
+  packet->RemoveHeader (hello);
+  NS_TEST_EXPECT_MSG_EQ (hello == helloHeader, true, "HELLO round trip");
+
+  // a fixed layout header is read the same way as before
+  helloHeader.SetCompact (false);
+  packet->AddHeader (helloHeader);
+  NS_TEST_EXPECT_MSG_EQ (packet->GetSize (), offchain::HelloView::SIZE, "fixed HELLO size");
+  packet->RemoveHeader (hello);
+  NS_TEST_EXPECT_MSG_EQ (hello.IsCompact (), false, "fixed HELLO");
+  NS_TEST_EXPECT_MSG_EQ (hello.GetAvailableDeposit (), 1000, "fixed HELLO deposit");
+}
+
+// Aggregated HELLO carrying all channels of a node
+class AggregatedHelloTestCase : public TestCase
+{
+public:
+  AggregatedHelloTestCase ();
+  virtual ~AggregatedHelloTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+AggregatedHelloTestCase::AggregatedHelloTestCase ()
+  : TestCase ("Aggregated HELLO channel tuples")
+{
+}
+
+AggregatedHelloTestCase::~AggregatedHelloTestCase ()
+{
+}
+
+void
+AggregatedHelloTestCase::DoRun (void)
+{
+  offchain::AggregatedHelloHeader helloHeader (/*origin=*/ Ipv4Address ("10.0.0.1"),
+                                               /*lifetime=*/ MilliSeconds (120000), /*fragment=*/ 1);
+  for (uint32_t i = 0; i < 50; ++i)
+    helloHeader.AddChannel (Ipv4Address (0x0a000002 + i), 100 * i, 7);
+  NS_TEST_EXPECT_MSG_EQ (helloHeader.GetSerializedSize (), 12 + 50 * 12, "fixed size");
+  helloHeader.AddChannel (Ipv4Address ("10.0.1.1"), 1, 1);
+  helloHeader.RemoveLastChannel ();
+  NS_TEST_EXPECT_MSG_EQ (helloHeader.GetChannelCount (), 50, "last tuple removed");
+
+  for (uint32_t compact = 0; compact < 2; ++compact)
+    {
+      helloHeader.SetCompact (compact);
+      Ptr<Packet> packet = Create<Packet> ();
+      packet->AddHeader (helloHeader);
+      NS_TEST_EXPECT_MSG_EQ (packet->GetSize (), helloHeader.GetSerializedSize (), "serialized size");
+      offchain::AggregatedHelloHeader received;
+      packet->RemoveHeader (received);
+      NS_TEST_EXPECT_MSG_EQ (received == helloHeader, true, "round trip");
+      NS_TEST_EXPECT_MSG_EQ (packet->GetSize (), 0, "whole header consumed");
+
+      offchain::AggregatedHelloHeader::Channel channel (Ipv4Address (), 0, 0);
+      NS_TEST_EXPECT_MSG_EQ (received.FindChannel (Ipv4Address (0x0a000002 + 30), channel), true, "own tuple");
+      NS_TEST_EXPECT_MSG_EQ (channel.m_availDeposit, 3000, "own deposit");
+      NS_TEST_EXPECT_MSG_EQ (channel.m_version, 7, "own version");
+      NS_TEST_EXPECT_MSG_EQ (received.FindChannel (Ipv4Address ("10.0.1.1"), channel), false, "no tuple");
+      NS_TEST_EXPECT_MSG_EQ (received.GetFragment (), 1, "fragment number");
+    }
+  NS_TEST_EXPECT_MSG_EQ ((helloHeader.GetSerializedSize () < 12 + 50 * 12), true, "compact is smaller");
+
+  // a count beyond the bytes that arrived is cut to the whole tuples present
+  helloHeader.SetCompact (false);
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (helloHeader);
+  packet->RemoveAtEnd (12 * 10 + 5);
+  offchain::AggregatedHelloHeader truncated;
+  packet->RemoveHeader (truncated);
+  NS_TEST_EXPECT_MSG_EQ (truncated.GetChannelCount (), 39, "truncated tuples");
+}
+
+// Versioned channel balances: stale and conflicting announcements, suppressed hellos
+class NeighborsVersionTestCase : public TestCase
+{
+public:
+  NeighborsVersionTestCase ();
+  virtual ~NeighborsVersionTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void CheckKeepalive ();
+  void BalanceChanged (Ipv4Address peer);
+  offchain::Neighbors m_nb;
+  uint32_t m_changes;
+};
+
+NeighborsVersionTestCase::NeighborsVersionTestCase ()
+  : TestCase ("Neighbors balance versions and announcements"),
+    m_nb (Seconds (1), 100),
+    m_changes (0)
+{
+}
+
+void
+NeighborsVersionTestCase::BalanceChanged (Ipv4Address peer)
+{
+  NS_TEST_EXPECT_MSG_EQ (peer, Ipv4Address ("10.0.0.1"), "changed channel reported");
+  m_changes++;
+}
+
+NeighborsVersionTestCase::~NeighborsVersionTestCase ()
+{
+}
+
+void
+NeighborsVersionTestCase::DoRun (void)
+{
+  Ipv4Address peer ("10.0.0.1");
+  m_nb.SetBalanceChangeCallback (MakeCallback (&NeighborsVersionTestCase::BalanceChanged, this));
+  m_nb.Update (peer, 50, Seconds (100), true, 3);
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Update (peer, 60, Seconds (100), false, 4), 1, "newer version");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChPeerAvailDeposit (peer), 60, "newer balance taken");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Update (peer, 10, Seconds (100), false, 2), 0, "stale version");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChPeerAvailDeposit (peer), 60, "stale balance ignored");
+
+  uint32_t version = 99;
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Announce (0, Seconds (20), version), true, "first announcement");
+  NS_TEST_ASSERT_MSG_EQ (version, 0, "initial version");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Announce (0, Seconds (20), version), false, "unchanged balance suppressed");
+  m_nb.DecChDeposit (peer, 10);
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetVersion (peer), 1, "payment bumps the version");
+  NS_TEST_ASSERT_MSG_EQ (m_changes, 1, "version bump reported");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Announce (0, Seconds (20), version), true, "changed balance announced");
+  NS_TEST_ASSERT_MSG_EQ (version, 1, "announced version");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Announce (0, Seconds (20), version), false, "announced once");
+
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Update (peer, 61, Seconds (100), false, 4), -1, "same version, other balance");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.IsNeighbor (peer), true, "channel kept open");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChPeerAvailDeposit (peer), 61, "peer balance resynced");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Announce (0, Seconds (20), version), true, "own balance resent");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Announce (0, Seconds (20), version), false, "resent once");
+
+  uint32_t balance = m_nb.GetChMyBalance (peer);
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Reserve (peer, 5, 1), true, "funds locked");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetVersion (peer), 1, "reservation keeps the version");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChMyBalance (peer), balance, "reservation not announced");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.GetChMyAvailDeposit (peer), balance - 5, "reservation spends the available balance");
+  NS_TEST_ASSERT_MSG_EQ (m_nb.Announce (0, Seconds (20), version), false, "nothing to announce");
+
+  Simulator::Schedule (Seconds (30), &NeighborsVersionTestCase::CheckKeepalive, this);
+  Simulator::Run ();
+  Simulator::Destroy ();
+}
+
+void
+NeighborsVersionTestCase::CheckKeepalive ()
+{
+  uint32_t version = 99;
+  NS_TEST_EXPECT_MSG_EQ (m_nb.Announce (0, Seconds (20), version), true, "keepalive due");
+  NS_TEST_EXPECT_MSG_EQ (version, 1, "keepalive carries the current version");
+  NS_TEST_EXPECT_MSG_EQ (m_nb.Announce (0, Seconds (20), version), false, "keepalive once");
+}
+
+// Trickle timer of channel maintenance rounds
+class TrickleTimerTestCase : public TestCase
+{
+public:
+  TrickleTimerTestCase ();
+  virtual ~TrickleTimerTestCase ();
+
+private:
+  virtual void DoRun (void);
+  void Transmit ();
+  void CheckReset ();
+  offchain::TrickleTimer m_trickle;
+  std::vector<Time> m_sent;
+};
+
+TrickleTimerTestCase::TrickleTimerTestCase ()
+  : TestCase ("Trickle timer intervals, reset and suppression"),
+    m_trickle (Seconds (1), 3, 0)
+{
+}
+
+TrickleTimerTestCase::~TrickleTimerTestCase ()
+{
+}
+
+void
+TrickleTimerTestCase::Transmit ()
+{
+  m_sent.push_back (Simulator::Now ());
+}
+
+void
+TrickleTimerTestCase::CheckReset ()
+{
+  NS_TEST_EXPECT_MSG_EQ (m_trickle.GetInterval (), Seconds (8), "grown to Imax");
+  m_trickle.Inconsistent ();
+  NS_TEST_EXPECT_MSG_EQ (m_trickle.GetInterval (), Seconds (1), "back to Imin");
+}
+
+void
+TrickleTimerTestCase::DoRun (void)
+{
+  m_trickle.SetFunction (MakeCallback (&TrickleTimerTestCase::Transmit, this));
+  m_trickle.AssignStreams (1);
+  m_trickle.Start ();
+  Simulator::Schedule (Seconds (40), &offchain::TrickleTimer::Stop, &m_trickle);
+  Simulator::Run ();
+  // intervals 1, 2, 4 and 8 s from 0 s, one transmission in the second half of each
+  Time bounds[] = { Seconds (0), Seconds (1), Seconds (3), Seconds (7), Seconds (15), Seconds (23),
+                    Seconds (31), Seconds (39) };
+  NS_TEST_ASSERT_MSG_EQ (m_sent.size (), 7, "one transmission per interval");
+  for (uint32_t i = 0; i < m_sent.size (); ++i)
+    {
+      Time half = bounds[i] + Seconds ((bounds[i + 1] - bounds[i]).GetSeconds () / 2);
+      NS_TEST_EXPECT_MSG_EQ ((m_sent[i] >= half && m_sent[i] < bounds[i + 1]), true, "second half");
+    }
+  Simulator::Destroy ();
+
+  // an inconsistency restarts at Imin, consistent messages suppress
+  m_sent.clear ();
+  m_trickle.Configure (Seconds (1), 3, 1);
+  m_trickle.Start ();
+  Simulator::Schedule (Seconds (16), &TrickleTimerTestCase::CheckReset, this);
+  Simulator::Schedule (Seconds (16.1), &offchain::TrickleTimer::Consistent, &m_trickle);
+  Simulator::Schedule (Seconds (17), &offchain::TrickleTimer::Stop, &m_trickle);
+  Simulator::Run ();
+  NS_TEST_EXPECT_MSG_EQ (m_trickle.GetSuppressions (), 1, "consistent message heard");
+  NS_TEST_EXPECT_MSG_EQ (m_sent.size (), 4, "intervals 1, 2, 4 and 8 s before the reset");
+  Simulator::Destroy ();
+}
+
+// Batched RREQ for several destinations in one flood
+class BatchedRreqTestCase : public TestCase
+{
+public:
+  BatchedRreqTestCase ();
+  virtual ~BatchedRreqTestCase ();
+
+private:
+  virtual void DoRun (void);
+};
+
+BatchedRreqTestCase::BatchedRreqTestCase ()
+  : TestCase ("Batched RREQ destination tuples")
+{
+}
+
+BatchedRreqTestCase::~BatchedRreqTestCase ()
+{
+}
+
+void
+BatchedRreqTestCase::DoRun (void)
+{
+  offchain::BatchedRreqHeader rreqHeader (/*hopCount=*/ 2, /*requestID=*/ 40, /*origin=*/ Ipv4Address ("10.0.0.1"),
+                                          /*originSeqNo=*/ 41);
+  rreqHeader.SetGratiousRrep (true);
+  for (uint32_t i = 0; i < 20; ++i)
+    rreqHeader.AddDestination (Ipv4Address (0x0a000102 + i), i, 500 + i, /*unknownSeqNo=*/ i == 0);
+  NS_TEST_EXPECT_MSG_EQ (rreqHeader.GetSerializedSize (), 15 + 20 * 13, "fixed size");
+
+  for (uint32_t compact = 0; compact < 2; ++compact)
+    {
+      rreqHeader.SetCompact (compact);
+      Ptr<Packet> packet = Create<Packet> ();
+      packet->AddHeader (rreqHeader);
+      NS_TEST_EXPECT_MSG_EQ (packet->GetSize (), rreqHeader.GetSerializedSize (), "serialized size");
+      offchain::BatchedRreqHeader received;
+      packet->RemoveHeader (received);
+      NS_TEST_EXPECT_MSG_EQ (received == rreqHeader, true, "round trip");
+      NS_TEST_EXPECT_MSG_EQ (packet->GetSize (), 0, "whole header consumed");
+    }
+  NS_TEST_EXPECT_MSG_EQ ((rreqHeader.GetSerializedSize () < 15 + 20 * 13), true, "compact is smaller");
+
+  // a reply for one tuple answers the RREQ that tuple stands for
+  offchain::RreqHeader single = rreqHeader.GetRequest (3);
+  NS_TEST_EXPECT_MSG_EQ (single.GetDst (), Ipv4Address (0x0a000105), "destination");
+  NS_TEST_EXPECT_MSG_EQ (single.GetDstSeqno (), 3, "destination seqno");
+  NS_TEST_EXPECT_MSG_EQ (single.GetTransAmount (), 503, "amount");
+  NS_TEST_EXPECT_MSG_EQ (single.GetOrigin (), Ipv4Address ("10.0.0.1"), "origin");
+  NS_TEST_EXPECT_MSG_EQ (single.GetOriginSeqno (), 41, "origin seqno");
+  NS_TEST_EXPECT_MSG_EQ (single.GetId (), 40, "request id");
+  NS_TEST_EXPECT_MSG_EQ (single.GetHopCount (), 2, "hop count");
+  NS_TEST_EXPECT_MSG_EQ (single.GetGratiousRrep (), true, "shared flags");
+  NS_TEST_EXPECT_MSG_EQ (single.GetUnknownSeqno (), false, "known seqno");
+  NS_TEST_EXPECT_MSG_EQ (rreqHeader.GetRequest (0).GetUnknownSeqno (), true, "unknown seqno");
+
+  // copies of a flood forwarded with fewer destinations are still duplicates
+  offchain::BatchedRreqHeader rest (/*hopCount=*/ 3, /*requestID=*/ 40, /*origin=*/ Ipv4Address ("10.0.0.1"),
+                                    /*originSeqNo=*/ 41);
+  rest.AddDestination (Ipv4Address (0x0a000110), 14, 514, false);
+  uint64_t keys[2];
+  offchain::BatchedRreqHeader const * headers[] = { &rreqHeader, &rest };
+  for (uint32_t i = 0; i < 2; ++i)
+    {
+      Ptr<Packet> packet = Create<Packet> ();
+      packet->AddHeader (*headers[i]);
+      packet->AddHeader (offchain::TypeHeader (offchain::OFFCHAIN_TYPE_RREQ_BATCH));
+      offchain::MessageType type;
+      NS_TEST_EXPECT_MSG_EQ (offchain::DuplicatePacketDetection::GetContentKey (packet, keys[i], type), true,
+                             "content key");
+      NS_TEST_EXPECT_MSG_EQ (type, offchain::OFFCHAIN_TYPE_RREQ_BATCH, "message type");
+    }
+  NS_TEST_EXPECT_MSG_EQ (keys[0], keys[1], "same flood");
+}
+
 // The TestSuite class names the TestSuite, identifies what type of TestSuite,
 // and enables the TestCases to be run.  Typically, only the constructor for
 // this class must be defined
@@ -61,6 +1766,30 @@ SocialNetworkTestSuite::SocialNetworkTestSuite ()
 {
   // TestDuration for TestCase can be QUICK, EXTENSIVE or TAKES_FOREVER
   AddTestCase (new SocialNetworkTestCase1, TestCase::QUICK);
+  AddTestCase (new NeighborsIndexTestCase, TestCase::QUICK);
+  AddTestCase (new NeighborsTimerTestCase, TestCase::QUICK);
+  AddTestCase (new NeighborsExpiryTestCase, TestCase::QUICK);
+  AddTestCase (new NeighborsCapacityFilterTestCase, TestCase::QUICK);
+  AddTestCase (new NeighborsBatchTestCase, TestCase::QUICK);
+  AddTestCase (new NeighborsReservationTestCase, TestCase::QUICK);
+  AddTestCase (new RoutingTableIndexTestCase, TestCase::QUICK);
+  AddTestCase (new RoutingTableInPlaceTestCase, TestCase::QUICK);
+  AddTestCase (new RoutingTableExpiryTestCase, TestCase::QUICK);
+  AddTestCase (new RoutingTableNextHopTestCase, TestCase::QUICK);
+  AddTestCase (new RoutingTableEntryTestCase, TestCase::QUICK);
+  AddTestCase (new RoutingTableMultipathTestCase, TestCase::QUICK);
+  AddTestCase (new RouteCacheTestCase, TestCase::QUICK);
+  AddTestCase (new RequestQueueTestCase, TestCase::QUICK);
+  AddTestCase (new RequestQueuePolicyTestCase, TestCase::QUICK);
+  AddTestCase (new IdCacheTestCase, TestCase::QUICK);
+  AddTestCase (new BloomDuplicateDetectionTestCase, TestCase::QUICK);
+  AddTestCase (new ContentDuplicateDetectionTestCase, TestCase::QUICK);
+  AddTestCase (new PacketViewTestCase, TestCase::QUICK);
+  AddTestCase (new CompactEncodingTestCase, TestCase::QUICK);
+  AddTestCase (new AggregatedHelloTestCase, TestCase::QUICK);
+  AddTestCase (new NeighborsVersionTestCase, TestCase::QUICK);
+  AddTestCase (new TrickleTimerTestCase, TestCase::QUICK);
+  AddTestCase (new BatchedRreqTestCase, TestCase::QUICK);
 }
 
 // Do not forget to allocate an instance of this TestSuite